@@ -1,608 +1,7660 @@
+#ifdef _WIN32
+#define _CRT_RAND_S // rand_s(), for encryption keys and nonces
+#endif
 #include <FL/Fl.H>
+#include <FL/Fl_Image.H>
 #include <FL/Fl_Input.H>
+#include <FL/Fl_JPEG_Image.H>
+#include <FL/Fl_Multiline_Input.H>
+#include <FL/Fl_PNG_Image.H>
 #include <FL/Fl_Window.H>
 #include <FL/fl_draw.H>
+#include <FL/filename.H>
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <new>
+#include <regex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #ifdef _WIN32
+#include <process.h>
 #include <shlobj.h>
 #include <windows.h>
 #else
+#include <fcntl.h>
 #include <pwd.h>
 #endif
 
-struct TodoItem {
-  std::string text;
-  bool completed;
-  int y_position;
-  int swipe_offset; // Horizontal offset for swipe gesture (positive = right,
-                    // negative = left)
-
-  TodoItem(const std::string &t)
-      : text(t), completed(false), y_position(0), swipe_offset(0) {}
+// Heap use by subsystem (--track-memory, --mem-report, --metrics-file).
+// Whether a process accounts is settled at its first allocation, from
+// CLEAR_TRACK_MEMORY; the options set it and run the program again (see
+// main()). Without it, new and delete go straight to malloc and free.
+// With it, every block carries a 16-byte header with its size and tag, so
+// that it is subtracted from the same tag when freed, and each allocation
+// and free is one relaxed atomic add on the tag's counter. The tag is the
+// innermost MemoryScope on the allocating thread. No block is ever freed
+// in the other layout, since the process never switches.
+enum MemoryTag {
+  MEM_OTHER,      // Outside any MemoryScope
+  MEM_MODEL,      // Item lists and list changes
+  MEM_TEXT,       // Item text
+  MEM_LAYOUT,     // Frame drawing, glyph atlas
+  MEM_ROW_IMAGES, // Composed row images
+  MEM_IO,         // Storage, trash and metrics files
+  MEM_INDEX,      // Derived lookups: due-date index, board columns
+  MEM_UNDO,       // What Ctrl+Z puts back
+  MEM_TAGS
 };
 
-class ClearApp : public Fl_Window {
-private:
-  std::vector<TodoItem> items;
-  int selected_index;
-  int drag_start_y;
-  int drag_start_x;
-  bool is_dragging;
-  bool is_swiping;
-  bool is_pulling_down; // Pull down to add new item
-  int pull_down_offset; // Offset for pull-down animation
-  int drag_offset;
-  int item_height;
-  std::string data_file;
-  int editing_index;        // Index of item being edited
-  std::string editing_text; // Text being edited
-  int pending_click_index;  // Index of item pending click (to handle
-                            // double-click)
-  bool can_reorder;         // Whether reordering is allowed (after long press)
-  Fl_Input *input_widget;   // Input widget for editing items
-  int scroll_offset;        // Vertical scroll offset (positive = scrolled down)
+static const char *const memory_tag_names[MEM_TAGS] = {
+    "other", "model", "text", "layout", "row_images", "io", "index", "undo"};
 
-  // Error message display
-  struct ErrorDisplay {
-    std::string message;
-    bool is_visible;
+// Live blocks in the high 32 bits, their bytes (with headers) in 16-byte
+// units in the low 32, so one add updates both. A block takes at least one
+// unit, so neither half wraps before a tag holds 64 GB.
+static const unsigned long long MEMORY_BLOCK = 1ull << 32;
+static const size_t MEMORY_UNIT = 16;
 
-    ErrorDisplay() : message(""), is_visible(false) {}
-  } error_display;
+enum { MEMORY_UNDECIDED, MEMORY_PLAIN, MEMORY_TRACKED };
+static int memory_mode = MEMORY_UNDECIDED; // Set before any thread starts
+static std::atomic<unsigned long long> memory_usage[MEM_TAGS];
+static thread_local unsigned char current_memory_tag = MEM_OTHER;
 
-  // Calculate luminance of a color (0-255)
-  double get_luminance(Fl_Color color) {
-    unsigned char r, g, b;
-    Fl::get_color(color, r, g, b);
-    // Use relative luminance formula (ITU-R BT.709)
-    return 0.2126 * r + 0.7152 * g + 0.0722 * b;
+static bool memory_tracked() {
+  if (memory_mode == MEMORY_UNDECIDED) {
+    const char *track = getenv("CLEAR_TRACK_MEMORY");
+    memory_mode = (track && *track) ? MEMORY_TRACKED : MEMORY_PLAIN;
   }
+  return memory_mode == MEMORY_TRACKED;
+}
 
-  // Get appropriate text color based on background color
-  Fl_Color get_text_color(Fl_Color bg_color) {
-    double luminance = get_luminance(bg_color);
-    // If background is bright (luminance > 128), use black text
-    // Otherwise use white text
-    return (luminance > 128) ? FL_BLACK : FL_WHITE;
+// Attribute allocations in the enclosing scope to a subsystem
+class MemoryScope {
+public:
+  explicit MemoryScope(MemoryTag tag) : saved(current_memory_tag) {
+    current_memory_tag = tag;
   }
+  ~MemoryScope() { current_memory_tag = saved; }
 
-  // Get color based on position in list (red -> orange -> yellow gradient)
-  Fl_Color get_color_by_position(int position, int total_items) {
-    if (total_items <= 1) {
-      return FL_RED;
-    }
+private:
+  unsigned char saved;
+};
 
-    // Calculate ratio from 0.0 (top, red) to 1.0 (bottom, yellow)
-    double ratio = (double)position / (total_items - 1);
+static const size_t MEMORY_HEADER = 16; // Keeps malloc's alignment
 
-    // Interpolate from red (255,0,0) -> orange (255,165,0) -> yellow
-    // (255,255,0)
-    unsigned char r, g, b;
+static unsigned long long memory_bytes(int tag) {
+  return (memory_usage[tag].load(std::memory_order_relaxed) &
+          (MEMORY_BLOCK - 1)) *
+         MEMORY_UNIT;
+}
 
-    if (ratio < 0.5) {
-      // Red to Orange (0.0 to 0.5)
-      double local_ratio = ratio * 2.0; // 0.0 to 1.0
-      r = 255;
-      g = (unsigned char)(165 * local_ratio);
-      b = 0;
-    } else {
-      // Orange to Yellow (0.5 to 1.0)
-      double local_ratio = (ratio - 0.5) * 2.0; // 0.0 to 1.0
-      r = 255;
-      g = (unsigned char)(165 + (255 - 165) * local_ratio);
-      b = 0;
-    }
+static unsigned long long memory_objects(int tag) {
+  return memory_usage[tag].load(std::memory_order_relaxed) >> 32;
+}
 
-    return fl_rgb_color(r, g, b);
+#ifndef CLEAR_NO_MAIN // Called from main() only
+// Live heap use per subsystem, for --mem-report
+static void print_memory_report(FILE *out) {
+  unsigned long long total_bytes = 0, total_objects = 0;
+  fprintf(out, "Heap in use by subsystem:\n");
+  for (int tag = 0; tag < MEM_TAGS; tag++) {
+    fprintf(out, "  %-11s %12llu bytes %9llu blocks\n", memory_tag_names[tag],
+            memory_bytes(tag), memory_objects(tag));
+    total_bytes += memory_bytes(tag);
+    total_objects += memory_objects(tag);
   }
+  fprintf(out, "  %-11s %12llu bytes %9llu blocks\n", "total", total_bytes,
+          total_objects);
+  fprintf(out, "Bytes include a %zu-byte header per block, kept only while "
+               "accounting.\n",
+          MEMORY_HEADER);
+}
+#endif // CLEAR_NO_MAIN
 
-  // Get application data directory path
-  static std::string get_data_directory() {
-    std::string home_dir;
-    std::string data_dir;
+// A block's share of its tag's counter
+static unsigned long long memory_charge(size_t size) {
+  return MEMORY_BLOCK + (size + MEMORY_HEADER + MEMORY_UNIT - 1) / MEMORY_UNIT;
+}
 
-#ifdef _WIN32
-    // Windows: Use %APPDATA%\Clear
-    char appdata_path[MAX_PATH];
-    if (SUCCEEDED(SHGetFolderPathA(NULL, CSIDL_APPDATA, NULL,
-                                   SHGFP_TYPE_CURRENT, appdata_path))) {
-      home_dir = appdata_path;
-      data_dir = home_dir + "\\Clear";
-    } else {
-      // Fallback to current directory
-      data_dir = ".";
-    }
-#else
-    // Unix-like systems (macOS, Linux)
-    const char *home = getenv("HOME");
-    if (!home) {
-      // Fallback to getpwuid
-      struct passwd *pw = getpwuid(getuid());
-      if (pw) {
-        home = pw->pw_dir;
-      }
-    }
+static void *tracked_alloc(size_t size) {
+  if (!memory_tracked())
+    return malloc(size ? size : 1);
+  unsigned char *block = (unsigned char *)malloc(size + MEMORY_HEADER);
+  if (!block)
+    return nullptr;
+  unsigned char tag = current_memory_tag;
+  memory_usage[tag].fetch_add(memory_charge(size), std::memory_order_relaxed);
+  memcpy(block, &size, sizeof(size));
+  block[sizeof(size)] = tag;
+  return block + MEMORY_HEADER;
+}
 
-    if (home) {
-      home_dir = home;
-#ifdef __APPLE__
-      // macOS: ~/Library/Application Support/Clear
-      data_dir = home_dir + "/Library/Application Support/Clear";
-#else
-      // Linux: ~/.config/Clear (or ~/.local/share/Clear)
-      // Using XDG_CONFIG_HOME if set, otherwise ~/.config
-      const char *xdg_config = getenv("XDG_CONFIG_HOME");
-      if (xdg_config) {
-        data_dir = std::string(xdg_config) + "/Clear";
-      } else {
-        data_dir = home_dir + "/.config/Clear";
-      }
-#endif
-    } else {
-      // Fallback to current directory
-      data_dir = ".";
-    }
-#endif
+static void tracked_free(void *pointer) {
+  if (!pointer)
+    return;
+  if (memory_mode != MEMORY_TRACKED) {
+    free(pointer);
+    return;
+  }
+  unsigned char *block = (unsigned char *)pointer - MEMORY_HEADER;
+  unsigned char tag = block[sizeof(size_t)];
+  size_t size;
+  memcpy(&size, block, sizeof(size));
+  memory_usage[tag].fetch_sub(memory_charge(size), std::memory_order_relaxed);
+  free(block);
+}
 
-    // Create directory if it doesn't exist (recursively)
-    if (data_dir != ".") {
-#ifdef _WIN32
-      // Create all parent directories recursively on Windows
-      std::string path = data_dir;
-      size_t pos = 0;
-      while ((pos = path.find_first_of("\\/", pos + 1)) != std::string::npos) {
-        std::string dir = path.substr(0, pos);
-        CreateDirectoryA(dir.c_str(), NULL);
-      }
-      // Create the final directory
-      CreateDirectoryA(data_dir.c_str(), NULL);
-#else
-      // Create all parent directories recursively
-      std::string path = data_dir;
-      size_t pos = 0;
-      while ((pos = path.find_first_of('/', pos + 1)) != std::string::npos) {
-        std::string dir = path.substr(0, pos);
-        mkdir(dir.c_str(), 0755);
-      }
-      // Create the final directory
-      mkdir(data_dir.c_str(), 0755);
-#endif
-    }
+void *operator new(size_t size) {
+  void *pointer = tracked_alloc(size);
+  if (!pointer)
+    throw std::bad_alloc();
+  return pointer;
+}
 
-    return data_dir;
-  }
+void *operator new[](size_t size) { return operator new(size); }
 
-  // Escape/unescape text for file storage
-  std::string escape_text(const std::string &text) {
-    std::string result;
-    for (char c : text) {
-      if (c == '\n') {
-        result += "\\n";
-      } else if (c == '\\') {
-        result += "\\\\";
-      } else {
-        result += c;
-      }
-    }
-    return result;
-  }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return tracked_alloc(size);
+}
 
-  std::string unescape_text(const std::string &text) {
-    std::string result;
-    for (size_t i = 0; i < text.length(); i++) {
-      if (text[i] == '\\' && i + 1 < text.length()) {
-        if (text[i + 1] == 'n') {
-          result += '\n';
-          i++;
-        } else if (text[i + 1] == '\\') {
-          result += '\\';
-          i++;
-        } else {
-          result += text[i];
-        }
-      } else {
-        result += text[i];
-      }
-    }
-    return result;
-  }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return tracked_alloc(size);
+}
 
-  void show_error(const std::string &message) {
-    // Cancel any existing timeout to prevent multiple timers
-    Fl::remove_timeout(hide_error_cb, this);
+void operator delete(void *pointer) noexcept { tracked_free(pointer); }
+void operator delete[](void *pointer) noexcept { tracked_free(pointer); }
 
-    error_display.message = message;
-    error_display.is_visible = true;
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+  tracked_free(pointer);
+}
 
-    // Auto-hide after 3 seconds
-    Fl::add_timeout(3.0, hide_error_cb, this);
-    redraw();
-  }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+  tracked_free(pointer);
+}
 
-  void hide_error() {
-    error_display.is_visible = false;
-    error_display.message = "";
-    Fl::remove_timeout(hide_error_cb, this);
-    redraw();
-  }
+struct TodoItem {
+  unsigned id; // Identifies the item for this run (not saved)
+  std::string text;
+  std::string notes_hash; // Notes blob in BlobStore, empty if none
+  bool completed;
+  int y_position;
+  int swipe_offset; // Horizontal offset for swipe gesture (positive = right,
+                    // negative = left)
 
-  static void hide_error_cb(void *data) {
-    ClearApp *app = static_cast<ClearApp *>(data);
-    app->hide_error();
+  TodoItem(const std::string &t)
+      : id(allocate_id()), completed(false), y_position(0), swipe_offset(0) {
+    set_text(t);
   }
 
-  // Calculate text dimensions more accurately
-  void measure_text(const std::string &text, int &width, int &height,
-                    int font_size = 14) {
-    fl_font(FL_HELVETICA_BOLD, font_size);
-    width = (int)fl_width(text.c_str());
-    height = (int)fl_height();
+  // Copies account their text to MEM_TEXT too, whoever makes them
+  TodoItem(const TodoItem &other)
+      : id(other.id), notes_hash(other.notes_hash),
+        completed(other.completed), y_position(other.y_position),
+        swipe_offset(other.swipe_offset) {
+    set_text(other.text);
   }
 
-  // Draw rounded rectangle with specified color and corner radius
-  void draw_rounded_rect(int x, int y, int w, int h, int radius) {
-    // Draw four rounded corners using pie slices
-    // Top-left corner
-    fl_pie(x, y, radius * 2, radius * 2, 90, 180);
-    // Top-right corner
-    fl_pie(x + w - radius * 2, y, radius * 2, radius * 2, 0, 90);
-    // Bottom-right corner
-    fl_pie(x + w - radius * 2, y + h - radius * 2, radius * 2, radius * 2, 270,
-           360);
-    // Bottom-left corner
-    fl_pie(x, y + h - radius * 2, radius * 2, radius * 2, 180, 270);
-
-    // Draw rectangular parts (top, middle, bottom)
-    fl_rectf(x + radius, y, w - radius * 2, h);      // Middle vertical strip
-    fl_rectf(x, y + radius, radius, h - radius * 2); // Left strip
-    fl_rectf(x + w - radius, y + radius, radius, h - radius * 2); // Right strip
+  TodoItem(TodoItem &&other) = default;
+  TodoItem &operator=(TodoItem &&other) = default;
+
+  TodoItem &operator=(const TodoItem &other) {
+    id = other.id;
+    set_text(other.text);
+    notes_hash = other.notes_hash;
+    completed = other.completed;
+    y_position = other.y_position;
+    swipe_offset = other.swipe_offset;
+    return *this;
   }
 
-  // Draw rounded rectangle border
-  void draw_rounded_rect_border(int x, int y, int w, int h, int radius) {
-    // Draw four corner arcs
-    fl_arc(x, y, radius * 2, radius * 2, 90, 180);                // Top-left
-    fl_arc(x + w - radius * 2, y, radius * 2, radius * 2, 0, 90); // Top-right
-    fl_arc(x + w - radius * 2, y + h - radius * 2, radius * 2, radius * 2, 270,
-           360); // Bottom-right
-    fl_arc(x, y + h - radius * 2, radius * 2, radius * 2, 180,
-           270); // Bottom-left
+  void set_text(const std::string &t) {
+    MemoryScope scope(MEM_TEXT);
+    text = t;
+  }
 
-    // Draw straight edges
-    fl_line(x + radius, y, x + w - radius, y);         // Top
-    fl_line(x + w, y + radius, x + w, y + h - radius); // Right
-    fl_line(x + w - radius, y + h, x + radius, y + h); // Bottom
-    fl_line(x, y + h - radius, x, y + radius);         // Left
+  static unsigned allocate_id() {
+    static unsigned next_id = 1;
+    return next_id++;
   }
+};
 
-  void save_to_file() {
-    std::ofstream file(data_file);
-    if (!file.is_open()) {
-      show_error("Failed to save file: " + data_file);
-      return;
-    }
+// One change to the list, as emitted by the ClearApp mutation methods
+struct ModelChange {
+  // UPDATE_TEXT also covers a changed notes reference
+  enum Kind { INSERT, REMOVE, UPDATE_TEXT, TOGGLE, MOVE };
 
-    for (const auto &item : items) {
-      // Save with color index 0 for backward compatibility (color is now
-      // position-based)
-      file << "0|" << (item.completed ? "1" : "0") << "|"
-           << escape_text(item.text) << "\n";
-    }
+  Kind kind;
+  unsigned item_id;
+  int index;      // Position after the change (before it, for REMOVE);
+                  // a hint only if merging cleared positions_exact
+  int from_index; // Previous position (MOVE only)
 
-    file.close();
+  ModelChange(Kind k, unsigned id, int i, int from = -1)
+      : kind(k), item_id(id), index(i), from_index(from) {}
+};
 
-    // Check if write failed
-    if (file.fail()) {
-      show_error("Error saving file: " + data_file);
+// All changes of one transaction, delivered to subscribers together
+struct ChangeSet {
+  std::vector<ModelChange> changes;
+  // Replaying the changes in order gives every position they name. Not so
+  // once merge() dropped an item inserted and removed again: later changes
+  // counted it.
+  bool positions_exact;
+
+  ChangeSet() : positions_exact(true) {}
+
+  bool empty() const { return changes.empty(); }
+
+  // Whether positions of existing items may have shifted
+  bool structural() const {
+    for (const ModelChange &change : changes) {
+      if (change.kind == ModelChange::INSERT ||
+          change.kind == ModelChange::REMOVE ||
+          change.kind == ModelChange::MOVE)
+        return true;
     }
+    return false;
   }
 
-  bool load_from_file() {
-    std::ifstream file(data_file);
-    if (!file.is_open()) {
-      // File doesn't exist or can't be opened
-      // This is normal for first run, so don't show error
-      return false;
-    }
-
-    items.clear();
-    std::string line;
-    bool loaded_any = false;
-    while (std::getline(file, line)) {
-      if (line.empty())
-        continue;
-
-      size_t pos1 = line.find('|');
-      if (pos1 == std::string::npos)
+  // Fold changes to the same item: repeated text updates keep the last,
+  // toggles pair off, consecutive moves collapse into one, a removal drops
+  // earlier updates, and an item inserted and removed in the same
+  // transaction disappears entirely
+  void merge() {
+    std::vector<ModelChange> merged;
+    std::unordered_set<unsigned> touched; // Items with a change in merged
+    for (const ModelChange &change : changes) {
+      if (touched.insert(change.item_id).second) {
+        merged.push_back(change); // First change to the item: nothing to fold
         continue;
-
-      size_t pos2 = line.find('|', pos1 + 1);
-      if (pos2 == std::string::npos)
+      }
+      if (change.kind == ModelChange::REMOVE) {
+        // Earlier text updates and toggles of a removed item are moot, and
+        // so are its moves if it was inserted in this transaction
+        bool inserted = false;
+        for (const ModelChange &prev : merged) {
+          if (prev.item_id == change.item_id &&
+              prev.kind == ModelChange::INSERT)
+            inserted = true;
+        }
+        for (size_t j = merged.size(); j-- > 0;) {
+          if (merged[j].item_id == change.item_id &&
+              (merged[j].kind != ModelChange::MOVE || inserted))
+            merged.erase(merged.begin() + j);
+        }
+        if (!inserted)
+          merged.push_back(change);
+        else
+          positions_exact = false;
         continue;
+      }
 
-      // Color index is stored but not used (for backward compatibility)
-      bool completed = (line.substr(pos1 + 1, pos2 - pos1 - 1) == "1");
-      std::string text = unescape_text(line.substr(pos2 + 1));
-
-      TodoItem item(text);
-      item.completed = completed;
-      items.push_back(item);
-      loaded_any = true;
+      bool folded = false;
+      for (size_t i = merged.size(); i-- > 0 && !folded;) {
+        ModelChange &prev = merged[i];
+        if (prev.item_id != change.item_id)
+          continue;
+        if (change.kind == ModelChange::UPDATE_TEXT &&
+            (prev.kind == ModelChange::UPDATE_TEXT ||
+             prev.kind == ModelChange::INSERT)) {
+          folded = true; // Text is read from the item itself
+        } else if (change.kind == ModelChange::TOGGLE &&
+                   prev.kind == ModelChange::TOGGLE) {
+          merged.erase(merged.begin() + i);
+          folded = true;
+        } else if (change.kind == ModelChange::MOVE &&
+                   prev.kind == ModelChange::MOVE && i + 1 == merged.size()) {
+          prev.index = change.index;
+          if (prev.index == prev.from_index)
+            merged.erase(merged.begin() + i);
+          folded = true;
+        }
+        break; // Only the latest change to the item can absorb this one
+      }
+      if (!folded)
+        merged.push_back(change);
     }
+    changes.swap(merged);
+  }
+};
 
-    file.close();
+// Delivers model changes to subscribers, one merged ChangeSet per
+// transaction. Transactions nest; only the outermost commit delivers.
+class ModelEventBus {
+public:
+  typedef std::function<void(const ChangeSet &)> Subscriber;
 
-    // Check if read failed
-    if (file.fail() && !file.eof()) {
-      show_error("Error reading file: " + data_file);
-    }
+  ModelEventBus() : depth(0), next_token(1) {}
 
-    return loaded_any; // Return true if we loaded at least one item
+  // Subscribers are called in subscription order
+  int subscribe(const Subscriber &subscriber) {
+    subscribers.push_back(std::make_pair(next_token, subscriber));
+    return next_token++;
   }
 
-  void add_sample_items() {
-    // Add sample items for first-time users
-    items.push_back(TodoItem("Welcome to Clear"));
-    items.push_back(TodoItem("Pull down to add new task"));
-    items.push_back(TodoItem("Click to edit task"));
-    items.push_back(TodoItem("Double-click to complete"));
-    items.push_back(TodoItem("Swipe right to delete"));
-    items.push_back(TodoItem("Long press to reorder"));
+  void unsubscribe(int token) {
+    for (size_t i = 0; i < subscribers.size(); i++) {
+      if (subscribers[i].first == token) {
+        subscribers.erase(subscribers.begin() + i);
+        return;
+      }
+    }
   }
 
-  void draw_item(int index, int y, bool is_editing = false, int visual_position = -1, int total_visual_items = -1) {
-    if (index < 0 || index >= (int)items.size())
-      return;
-
-    TodoItem &item = items[index];
-    item.y_position = y;
+  void begin() { depth++; }
 
-    int x_offset = item.swipe_offset;
-    int abs_offset = abs(x_offset);
+  void emit(const ModelChange &change) {
+    pending.changes.push_back(change);
+    if (depth == 0) {
+      deliver();
+    }
+  }
 
-    // Get color based on position in list (not item's stored color)
-    // For completed items, use dark gray instead
-    Fl_Color item_color;
-    if (item.completed) {
-      item_color = fl_rgb_color(64, 64, 64); // Dark gray for completed items
-    } else {
-      // Use visual position if provided (for sorted display), otherwise use actual index
-      if (visual_position >= 0 && total_visual_items > 0) {
-        item_color = get_color_by_position(visual_position, total_visual_items);
-      } else {
-        item_color = get_color_by_position(index, items.size());
-      }
+  void commit() {
+    if (depth > 0 && --depth == 0) {
+      deliver();
     }
+  }
 
-    // Draw swipe background based on direction
-    if (x_offset > 0) {
-      // Swiped right (finger moves right) - item moves right, show complete
-      // background (green) on left
-      int right_offset = abs_offset;
-      if (right_offset > w())
-        right_offset = w();
-      fl_color(FL_GREEN);
-      fl_rectf(0, y, right_offset, item_height);
-      fl_color(FL_WHITE);
-      fl_font(FL_HELVETICA_BOLD, 16);
-      fl_draw("COMPLETE", right_offset / 2 - 40, y + item_height / 2 + 5);
-    } else if (x_offset < 0) {
-      // Swiped left (finger moves left) - item moves left, show delete
-      // background (red) on right
-      int left_offset = abs_offset;
-      if (left_offset > w())
-        left_offset = w();
-      fl_color(FL_RED);
-      fl_rectf(w() - left_offset, y, left_offset, item_height);
-      fl_color(FL_WHITE);
-      fl_font(FL_HELVETICA_BOLD, 16);
-      fl_draw("DELETE", w() - left_offset / 2 - 30, y + item_height / 2 + 5);
+  bool in_transaction() const { return depth > 0; }
+
+private:
+  void deliver() {
+    ChangeSet set;
+    set.changes.swap(pending.changes);
+    set.merge();
+    if (set.empty())
+      return;
+    for (size_t i = 0; i < subscribers.size(); i++) {
+      subscribers[i].second(set);
     }
+  }
 
-    // Draw colored background (shifted by swipe)
-    int bg_x = (x_offset > 0) ? abs_offset : 0;
-    int bg_w = w() - abs_offset;
-    if (bg_w < 0)
-      bg_w = 0;
+  int depth;
+  int next_token;
+  ChangeSet pending;
+  std::vector<std::pair<int, Subscriber> > subscribers;
+};
 
-    if (is_editing) {
-      // When editing, only draw background in the left 20px padding area
-      // Fl_Input widget will handle the rest
-      fl_color(item_color);
-      fl_rectf(bg_x, y, 20, item_height);
-    } else {
-      // When not editing, draw full background and text
-      fl_color(item_color);
-      fl_rectf(bg_x, y, bg_w, item_height);
+// Groups the changes made during its lifetime into one transaction
+class ModelTransaction {
+public:
+  explicit ModelTransaction(ModelEventBus &b) : bus(b) { bus.begin(); }
+  ~ModelTransaction() { bus.commit(); }
 
-      // Draw text with appropriate color based on background
-      Fl_Color text_color = get_text_color(item_color);
-      fl_color(text_color);
-      fl_font(FL_HELVETICA_BOLD, 18);
+private:
+  ModelEventBus &bus;
+  ModelTransaction(const ModelTransaction &);
+  ModelTransaction &operator=(const ModelTransaction &);
+};
 
-      std::string display_text = item.text;
-      if (item.completed) {
-        // display_text = "✓ " + display_text;
-      }
+// Pre-rendered glyphs for one font/size, used to compose row text without
+// going through fl_draw for every visible row on every frame.
+// Glyphs are stored as coverage masks (0-255), so one atlas serves every text
+// colour: the colour is applied when a glyph is blended into a row image.
+class GlyphAtlas {
+public:
+  GlyphAtlas(Fl_Font f, Fl_Fontsize s)
+      : font(f), size(s), cell_w(0), cell_h(0), ascent(0), height(0),
+        descent(0), built(false) {}
+
+  bool ready() const { return built; }
+
+  // Render the printable ASCII range into an offscreen buffer and read back
+  // the coverage. Must be called while a window is current (e.g. in draw()).
+  void build() {
+    fl_font(font, size);
+    height = fl_height();
+    descent = fl_descent();
+
+    double max_advance = 0;
+    for (int c = FIRST_GLYPH; c <= LAST_GLYPH; c++) {
+      advances[c - FIRST_GLYPH] = fl_width((unsigned int)c);
+      if (advances[c - FIRST_GLYPH] > max_advance)
+        max_advance = advances[c - FIRST_GLYPH];
+    }
 
-      int text_x = (x_offset > 0) ? (abs_offset + 20) : (bg_x + 20);
-      int text_y = y + item_height / 2 + 6;
-      
-      // Draw text
-      fl_draw(display_text.c_str(), text_x, text_y);
-      
-      // Draw strikethrough for completed items
-      if (item.completed) {
-        int text_w, text_h;
-        measure_text(display_text, text_w, text_h, 18);
-        // Draw strikethrough line with same color as text
-        fl_line(text_x, text_y - text_h / 2, text_x + text_w, text_y - text_h / 2);
+    // Pad each cell so overhanging glyphs (bold, italic) are not cut off
+    cell_w = (int)ceil(max_advance) + GLYPH_PAD * 2;
+    cell_h = height + GLYPH_PAD * 2;
+    ascent = height - descent + GLYPH_PAD;
+
+    int atlas_w = cell_w * GLYPH_COUNT;
+    Fl_Offscreen offscreen = fl_create_offscreen(atlas_w, cell_h);
+    if (!offscreen)
+      return;
+
+    std::vector<uchar> rgb(atlas_w * cell_h * 3);
+    fl_begin_offscreen(offscreen);
+    fl_color(FL_BLACK);
+    fl_rectf(0, 0, atlas_w, cell_h);
+    fl_color(FL_WHITE);
+    fl_font(font, size);
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+      char glyph = (char)(FIRST_GLYPH + i);
+      fl_draw(&glyph, 1, i * cell_w + GLYPH_PAD, ascent);
+    }
+    fl_read_image(&rgb[0], 0, 0, atlas_w, cell_h);
+    fl_end_offscreen();
+    fl_delete_offscreen(offscreen);
+
+    // Keep one channel as coverage, rearranged so each glyph is contiguous
+    coverage.assign(GLYPH_COUNT * cell_w * cell_h, 0);
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+      uchar *cell = &coverage[i * cell_w * cell_h];
+      for (int y = 0; y < cell_h; y++) {
+        const uchar *src = &rgb[(y * atlas_w + i * cell_w) * 3];
+        for (int x = 0; x < cell_w; x++) {
+          cell[y * cell_w + x] = src[x * 3 + 1];
+        }
       }
     }
+    built = true;
   }
 
-  // Get sorted indices (incomplete first, then completed)
-  std::vector<int> get_sorted_indices() {
-    std::vector<int> indices;
-    // First add incomplete items
-    for (size_t i = 0; i < items.size(); i++) {
-      if (!items[i].completed) {
-        indices.push_back(i);
-      }
+  // Whether every byte of text has a glyph in the atlas
+  bool can_render(const std::string &text) const {
+    if (!built)
+      return false;
+    for (char c : text) {
+      if ((unsigned char)c < FIRST_GLYPH || (unsigned char)c > LAST_GLYPH)
+        return false;
     }
-    // Then add completed items
-    for (size_t i = 0; i < items.size(); i++) {
-      if (items[i].completed) {
-        indices.push_back(i);
-      }
+    return true;
+  }
+
+  // Text width from cached advances (text must pass can_render)
+  int text_width(const std::string &text) const {
+    double width = 0;
+    for (char c : text) {
+      width += advances[(unsigned char)c - FIRST_GLYPH];
     }
-    return indices;
+    return (int)width;
   }
 
-  int get_item_at_y(int y) {
-    int start_y = 0; // Start from top
-    // Adjust y coordinate for scroll offset
-    int adjusted_y = y + scroll_offset;
-    if (adjusted_y < start_y)
-      return -1; // Above first item
-    int visual_index = (adjusted_y - start_y) / item_height;
-    
-    // Get sorted indices to map visual position to actual index
-    std::vector<int> sorted_indices = get_sorted_indices();
-    if (visual_index >= 0 && visual_index < (int)sorted_indices.size()) {
-      return sorted_indices[visual_index];
+  int line_height() const { return height; }
+
+  // Blend text into an RGB image of dst_w x dst_h pixels, starting at pen
+  // position x with the given baseline (text must pass can_render)
+  void compose(uchar *dst, int dst_w, int dst_h, int x, int baseline,
+               const std::string &text, uchar r, uchar g, uchar b) const {
+    double pen_x = x;
+    int top = baseline - ascent;
+    for (char c : text) {
+      int glyph = (unsigned char)c - FIRST_GLYPH;
+      const uchar *cell = &coverage[glyph * cell_w * cell_h];
+      int cell_x = (int)(pen_x + 0.5) - GLYPH_PAD;
+      for (int cy = 0; cy < cell_h; cy++) {
+        int dy = top + cy;
+        if (dy < 0 || dy >= dst_h)
+          continue;
+        for (int cx = 0; cx < cell_w; cx++) {
+          int dx = cell_x + cx;
+          int a = cell[cy * cell_w + cx];
+          if (a == 0 || dx < 0 || dx >= dst_w)
+            continue;
+          uchar *p = &dst[(dy * dst_w + dx) * 3];
+          p[0] = (uchar)(p[0] + ((r - p[0]) * a) / 255);
+          p[1] = (uchar)(p[1] + ((g - p[1]) * a) / 255);
+          p[2] = (uchar)(p[2] + ((b - p[2]) * a) / 255);
+        }
+      }
+      pen_x += advances[glyph];
     }
-    return -1;
   }
 
-  // Get maximum scroll offset (how far we can scroll down)
-  int get_max_scroll_offset() {
-    int total_height = items.size() * item_height;
-    int visible_height = h() - 40; // Subtract space for instructions at bottom
-    int max_scroll = total_height - visible_height;
-    return (max_scroll > 0) ? max_scroll : 0;
+private:
+  static const int FIRST_GLYPH = 32; // ' '
+  static const int LAST_GLYPH = 126; // '~'
+  static const int GLYPH_COUNT = LAST_GLYPH - FIRST_GLYPH + 1;
+  static const int GLYPH_PAD = 2;
+
+  Fl_Font font;
+  Fl_Fontsize size;
+  int cell_w;
+  int cell_h;
+  int ascent; // Baseline offset from the top of a cell
+  int height;
+  int descent;
+  bool built;
+  double advances[GLYPH_COUNT];
+  std::vector<uchar> coverage; // GLYPH_COUNT cells of cell_w * cell_h
+};
+
+// Composed pixels of one row (background + text), reused across frames until
+// anything that affects its appearance changes
+struct RowImage {
+  std::string text;
+  Fl_Color bg_color;
+  Fl_Color text_color;
+  bool completed;
+  int width;
+  int height;
+  int gradient_position; // Row in the smooth gradient, -1 for a flat fill
+  int gradient_total;
+  bool has_text; // Text composed in (otherwise drawn on top with fl_draw)
+  int last_frame; // Frame it was last drawn in
+  std::vector<uchar> pixels;
+
+  RowImage()
+      : bg_color(0), text_color(0), completed(false), width(0), height(0),
+        gradient_position(-1), gradient_total(0), has_text(false),
+        last_frame(0) {}
+
+  bool matches(const TodoItem &item, Fl_Color bg, Fl_Color fg, int w, int h,
+               int gpos, int gtotal, bool with_text) const {
+    return width == w && height == h && bg_color == bg && text_color == fg &&
+           completed == item.completed && gradient_position == gpos &&
+           gradient_total == gtotal && has_text == with_text &&
+           (!with_text || text == item.text);
   }
+};
 
-  // Clamp scroll offset to valid range
-  void clamp_scroll_offset() {
-    int max_scroll = get_max_scroll_offset();
-    if (scroll_offset < 0) {
-      scroll_offset = 0;
-    } else if (scroll_offset > max_scroll) {
-      scroll_offset = max_scroll;
+// Whether hash is a blob hash (64 lowercase hex digits, see BlobStore)
+static bool valid_blob_hash(const std::string &hash) {
+  if (hash.size() != 64)
+    return false;
+  for (char c : hash) {
+    if (!isdigit((unsigned char)c) && (c < 'a' || c > 'f'))
+      return false;
+  }
+  return true;
+}
+
+// An item has at most one image attachment, referenced by an
+// "img:<blob name>" word in its text, e.g. "img:<64 hex digits>.png".
+// Returns the length of such a word at pos, or 0.
+static size_t attachment_word_at(const std::string &text, size_t pos) {
+  if ((pos > 0 && text[pos - 1] != ' ') || text.compare(pos, 4, "img:") != 0)
+    return 0;
+  size_t end = text.find(' ', pos);
+  if (end == std::string::npos)
+    end = text.size();
+  if (end < pos + 70 || text[pos + 68] != '.' ||
+      !valid_blob_hash(text.substr(pos + 4, 64)))
+    return 0;
+  return end - pos;
+}
+
+static size_t find_attachment_word(const std::string &text) {
+  size_t pos = 0;
+  while ((pos = text.find("img:", pos)) != std::string::npos) {
+    if (attachment_word_at(text, pos))
+      return pos;
+    pos++;
+  }
+  return std::string::npos;
+}
+
+// text with its attachment word set to name
+static std::string replace_attachment(const std::string &text,
+                                      const std::string &name) {
+  size_t pos = find_attachment_word(text);
+  if (pos == std::string::npos)
+    return text.empty() ? "img:" + name : text + " img:" + name;
+  return text.substr(0, pos) + "img:" + name +
+         text.substr(pos + attachment_word_at(text, pos));
+}
+
+// A run of item text in one inline style. Markers are stripped from text.
+struct TextSpan {
+  enum { BOLD = 1, CODE = 2, STRIKE = 4, LINK = 8 };
+  std::string text;
+  unsigned style;
+  int x;     // Offset from the start of the row text, once measured
+  int width;
+
+  TextSpan(const std::string &t, unsigned s)
+      : text(t), style(s), x(0), width(0) {}
+};
+
+// Item text split into styled spans: **bold**, `code`, ~~strike~~ and bare
+// http(s):// links. The attachment word is taken out and drawn as a
+// thumbnail instead. Parsed once per edit and kept with the row layout so
+// drawing and link hit-testing just walk the spans.
+struct RichText {
+  std::string source; // Item text the spans were parsed from
+  std::vector<TextSpan> spans;
+  std::string attachment; // Blob name of the attached image, or empty
+  bool parsed;
+  bool formatted; // Any styled span (else the row is drawn as plain text)
+  bool measured;  // Span x/width are set
+  int width;
+  int last_frame; // Frame it was last drawn in
+
+  RichText()
+      : parsed(false), formatted(false), measured(false), width(0),
+        last_frame(0) {}
+
+  void parse(const std::string &text) {
+    source = text;
+    spans.clear();
+    attachment.clear();
+    parsed = true;
+    formatted = false;
+    measured = false;
+    unsigned style = 0;
+    std::string run;
+    size_t i = 0;
+    while (i < text.size()) {
+      // ** and ~~ toggle their style only when a closing marker follows
+      bool bold = text.compare(i, 2, "**") == 0 &&
+                  ((style & TextSpan::BOLD) ||
+                   text.find("**", i + 2) != std::string::npos);
+      bool strike = text.compare(i, 2, "~~") == 0 &&
+                    ((style & TextSpan::STRIKE) ||
+                     text.find("~~", i + 2) != std::string::npos);
+      if (bold || strike) {
+        flush(run, style);
+        style ^= bold ? TextSpan::BOLD : TextSpan::STRIKE;
+        i += 2;
+        continue;
+      }
+      size_t word = attachment.empty() ? attachment_word_at(text, i) : 0;
+      if (word) {
+        attachment = text.substr(i + 4, word - 4);
+        i += word;
+        continue;
+      }
+      if (text[i] == '`') {
+        size_t end = text.find('`', i + 1);
+        if (end != std::string::npos && end > i + 1) {
+          flush(run, style);
+          spans.push_back(TextSpan(text.substr(i + 1, end - i - 1),
+                                   style | TextSpan::CODE));
+          i = end + 1;
+          continue;
+        }
+      }
+      if ((i == 0 || isspace((unsigned char)text[i - 1]) ||
+           text[i - 1] == '(') &&
+          (text.compare(i, 7, "http://") == 0 ||
+           text.compare(i, 8, "https://") == 0)) {
+        size_t end = i;
+        while (end < text.size() && !isspace((unsigned char)text[end]))
+          end++;
+        if (text[end - 1] == ')' && i > 0 && text[i - 1] == '(')
+          end--;
+        flush(run, style);
+        spans.push_back(TextSpan(text.substr(i, end - i),
+                                 style | TextSpan::LINK));
+        i = end;
+        continue;
+      }
+      run += text[i++];
+    }
+    flush(run, style);
+    formatted = !attachment.empty();
+    for (const TextSpan &span : spans) {
+      if (span.style)
+        formatted = true;
     }
   }
 
-  void reorder_items(int from_index, int to_index) {
-    if (from_index < 0 || from_index >= (int)items.size() || to_index < 0 ||
-        to_index >= (int)items.size() || from_index == to_index) {
-      return;
+  // Span holding a link at x (relative to the row text), or null
+  const TextSpan *link_at(int x) const {
+    if (!measured)
+      return 0;
+    for (const TextSpan &span : spans) {
+      if ((span.style & TextSpan::LINK) && x >= span.x &&
+          x < span.x + span.width)
+        return &span;
     }
+    return 0;
+  }
 
-    TodoItem item = items[from_index];
-    items.erase(items.begin() + from_index);
-    items.insert(items.begin() + to_index, item);
-    save_to_file();
-    redraw();
+private:
+  void flush(std::string &run, unsigned style) {
+    if (!run.empty()) {
+      spans.push_back(TextSpan(run, style));
+      run.clear();
+    }
   }
+};
 
-public:
-  ClearApp(int W, int H, const char *title)
-      : Fl_Window(W, H, title), selected_index(-1), is_dragging(false),
-        is_swiping(false), is_pulling_down(false), pull_down_offset(0),
-        drag_offset(0), item_height(60), data_file(""), editing_index(-1),
-        pending_click_index(-1), can_reorder(false), input_widget(nullptr),
-        scroll_offset(0) {
+// Green channel of the red -> orange -> yellow ramp over a whole list (red
+// is 255, blue 0), per pixel row, so that rows can be filled without the
+// banding of one flat colour per row. Matches get_color_by_position() at
+// the vertical centre of every row. The ramp is a closed-form function of
+// the pixel row, so only the rows being composed are computed: pixel rows
+// [first, first + count) of total rows of row_height pixels.
+static void gradient_green(int total, int row_height, int first, int count,
+                           uchar *green) {
+  // ratio = (y - row_height / 2) / ((total - 1) * row_height), clamped to
+  // [0, 1]. Both ramp halves are linear in ratio, and 330 * ratio stays
+  // below 75 + 180 * ratio exactly while ratio < 0.5, so g is the minimum
+  // of the two.
+  float half = row_height / 2.0f;
+  float inv_span = (total > 1) ? 1.0f / ((total - 1) * row_height) : 0.0f;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 v_half = _mm_set1_ps(half);
+  const __m128 v_inv = _mm_set1_ps(inv_span);
+  const __m128 v_zero = _mm_setzero_ps();
+  const __m128 v_one = _mm_set1_ps(1.0f);
+  const __m128 v_330 = _mm_set1_ps(330.0f);
+  const __m128 v_180 = _mm_set1_ps(180.0f);
+  const __m128 v_75 = _mm_set1_ps(75.0f);
+  const __m128 v_step = _mm_set1_ps(4.0f);
+  __m128 v_y = _mm_setr_ps(first, first + 1.0f, first + 2.0f, first + 3.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 ratio = _mm_mul_ps(_mm_sub_ps(v_y, v_half), v_inv);
+    ratio = _mm_min_ps(_mm_max_ps(ratio, v_zero), v_one);
+    __m128 g = _mm_min_ps(_mm_mul_ps(ratio, v_330),
+                          _mm_add_ps(v_75, _mm_mul_ps(ratio, v_180)));
+    // Truncate like the (unsigned char) cast in get_color_by_position()
+    __m128i gi = _mm_cvttps_epi32(g);
+    gi = _mm_packs_epi32(gi, gi);
+    gi = _mm_packus_epi16(gi, gi);
+    int packed = _mm_cvtsi128_si32(gi);
+    memcpy(&green[i], &packed, 4);
+    v_y = _mm_add_ps(v_y, v_step);
+  }
+#endif
+  for (; i < count; i++) {
+    float ratio = (first + i - half) * inv_span;
+    ratio = std::min(std::max(ratio, 0.0f), 1.0f);
+    green[i] = (uchar)std::min(ratio * 330.0f, 75.0f + ratio * 180.0f);
+  }
+}
 
-    // Initialize data file path to application data directory
-    std::string data_dir = get_data_directory();
-    if (data_dir == ".") {
-      data_file = "todos.txt"; // Fallback to current directory
-    } else {
-#ifdef _WIN32
-      data_file = data_dir + "\\todos.txt";
+// Screen scale factor of a window, the device pixels per FLTK unit.
+// FLTK 1.3 draws one pixel per unit.
+static float window_scale(const Fl_Window *window) {
+#if FL_API_VERSION >= 10400
+  return Fl::screen_scale(window->screen_num());
 #else
-      data_file = data_dir + "/todos.txt";
+  (void)window;
+  return 1.0f;
 #endif
-    }
+}
 
-    color(fl_rgb_color(64, 64, 64));  // deep gray
+// What rows are drawn from at one screen scale factor: the glyphs rendered
+// at that scale's pixel size, and the row images composed from them. A
+// window moved to a monitor of another scale switches to that scale's set
+// and keeps the other for a while in case it returns.
+struct ScaledRows {
+  explicit ScaledRows(float s, int frame)
+      : scale(s), atlas(FL_HELVETICA_BOLD, (Fl_Fontsize)lround(18 * s)),
+        first_frame(frame), last_frame(frame) {}
+
+  // A length in units as device pixels
+  int pixels(int units) const { return (int)lround(units * scale); }
+
+  float scale;
+  GlyphAtlas atlas;       // Row text (FL_HELVETICA_BOLD, 18 units)
+  std::unordered_map<unsigned, RowImage> rows; // By item id
+  int first_frame;        // Frame the window first drew at this scale
+  int last_frame;         // Frame it last did
+};
 
-    // Create input widget (initially hidden)
-    input_widget = new Fl_Input(0, 0, w(), item_height);
-    input_widget->callback(input_callback, this);
-    input_widget->when(FL_WHEN_CHANGED | FL_WHEN_ENTER_KEY | FL_WHEN_RELEASE);
-    input_widget->box(FL_FLAT_BOX); // Flat box (background but no border)
-    input_widget->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
-    // Ensure the widget can receive focus and display properly
-    input_widget->set_visible_focus();
-    input_widget->hide();
+// Records one frame of drawing and submits it in a single pass.
+// On submit, colour and font changes are only issued when a drawing command
+// actually needs a different state than the one last issued, and adjacent
+// rectangles of the same colour are merged into one fl_rectf.
+class DrawBatch {
+public:
+  // Command counts for the last submitted frame
+  struct Stats {
+    int recorded;       // Commands emitted by draw code
+    int submitted;      // FLTK calls actually made
+    int dropped_state;  // Redundant colour/font changes removed
+    int merged_rects;   // Rectangles folded into a neighbour
+
+    Stats() : recorded(0), submitted(0), dropped_state(0), merged_rects(0) {}
+  };
+
+  DrawBatch()
+      : current_color(FL_BLACK), current_font(FL_HELVETICA), current_size(14),
+        recorded_state(0), merged_rects(0) {}
+
+  void color(Fl_Color c) {
+    current_color = c;
+    recorded_state++;
+  }
 
-    // Load items from file
-    bool loaded = load_from_file();
+  void font(Fl_Font f, Fl_Fontsize s) {
+    current_font = f;
+    current_size = s;
+    recorded_state++;
+  }
 
-    // If no items loaded (first run), add sample items
-    if (!loaded || items.empty()) {
-      add_sample_items();
-      save_to_file(); // Save sample items to file
+  void rectf(int x, int y, int w, int h) {
+    if (w <= 0 || h <= 0)
+      return;
+    Command cmd = make(CMD_RECTF);
+    cmd.x = x;
+    cmd.y = y;
+    cmd.w = w;
+    cmd.h = h;
+
+    // Merge with the previous rectangle when they share colour and an edge
+    if (!commands.empty()) {
+      Command &prev = commands.back();
+      if (prev.type == CMD_RECTF && prev.color == cmd.color) {
+        if (prev.x == x && prev.w == w && prev.y + prev.h == y) {
+          prev.h += h;
+          merged_rects++;
+          return;
+        }
+        if (prev.y == y && prev.h == h && prev.x + prev.w == x) {
+          prev.w += w;
+          merged_rects++;
+          return;
+        }
+      }
     }
+    commands.push_back(cmd);
+  }
 
-    end();
+  void text(const char *str, int x, int y) {
+    Command cmd = make(CMD_TEXT);
+    cmd.x = x;
+    cmd.y = y;
+    cmd.text_offset = text_arena.size();
+    cmd.text_length = strlen(str);
+    text_arena.append(str, cmd.text_length);
+    commands.push_back(cmd);
   }
 
-  ~ClearApp() { save_to_file(); }
+  void line(int x1, int y1, int x2, int y2) {
+    Command cmd = make(CMD_LINE);
+    cmd.x = x1;
+    cmd.y = y1;
+    cmd.w = x2;
+    cmd.h = y2;
+    commands.push_back(cmd);
+  }
 
-  void add_item(const std::string &text = "") {
-    // Finish any existing editing first
-    if (editing_index >= 0) {
-      finish_editing();
-    }
+  void pie(int x, int y, int w, int h, double a1, double a2) {
+    Command cmd = make(CMD_PIE);
+    cmd.x = x;
+    cmd.y = y;
+    cmd.w = w;
+    cmd.h = h;
+    cmd.a1 = a1;
+    cmd.a2 = a2;
+    commands.push_back(cmd);
+  }
 
-    // Reset pull down state to avoid position calculation issues
-    is_pulling_down = false;
-    pull_down_offset = 0;
+  void arc(int x, int y, int w, int h, double a1, double a2) {
+    Command cmd = make(CMD_ARC);
+    cmd.x = x;
+    cmd.y = y;
+    cmd.w = w;
+    cmd.h = h;
+    cmd.a1 = a1;
+    cmd.a2 = a2;
+    commands.push_back(cmd);
+  }
 
-    // Reset scroll to top when adding new item at the beginning
-    scroll_offset = 0;
+  // RGB pixels must stay valid until submit(). w x h are pixels, drawn at
+  // scale pixels per unit.
+  void image(const uchar *pixels, int x, int y, int w, int h,
+             float scale = 1.0f) {
+    Command cmd = make(CMD_IMAGE);
+    cmd.x = x;
+    cmd.y = y;
+    cmd.w = w;
+    cmd.h = h;
+    cmd.a1 = scale;
+    cmd.pixels = pixels;
+    commands.push_back(cmd);
+  }
 
-    // Insert new item at the beginning
-    items.insert(items.begin(), TodoItem(text));
+  void push_clip(int x, int y, int w, int h) {
+    Command cmd = make(CMD_PUSH_CLIP);
+    cmd.x = x;
+    cmd.y = y;
+    cmd.w = w;
+    cmd.h = h;
+    commands.push_back(cmd);
+  }
 
-    // Start editing the new item
-    editing_index = 0;
-    editing_text = text;
-    start_editing(0);
+  void pop_clip() { commands.push_back(make(CMD_POP_CLIP)); }
+
+  // Replay the recorded frame through FLTK and start a new one
+  void submit() {
+    Stats frame;
+    frame.recorded = recorded_state + merged_rects + (int)commands.size();
+    frame.merged_rects = merged_rects;
+
+    // The FLTK state on entry is unknown, so the first change always goes out
+    bool have_color = false, have_font = false;
+    Fl_Color applied_color = 0;
+    Fl_Font applied_font = 0;
+    Fl_Fontsize applied_size = 0;
+    int state_changes = 0;
+
+    for (const Command &cmd : commands) {
+      if (cmd.type != CMD_IMAGE && cmd.type != CMD_PUSH_CLIP &&
+          cmd.type != CMD_POP_CLIP &&
+          (!have_color || applied_color != cmd.color)) {
+        fl_color(cmd.color);
+        applied_color = cmd.color;
+        have_color = true;
+        state_changes++;
+      }
+      if (cmd.type == CMD_TEXT &&
+          (!have_font || applied_font != cmd.font ||
+           applied_size != cmd.size)) {
+        fl_font(cmd.font, cmd.size);
+        applied_font = cmd.font;
+        applied_size = cmd.size;
+        have_font = true;
+        state_changes++;
+      }
+
+      switch (cmd.type) {
+      case CMD_RECTF:
+        fl_rectf(cmd.x, cmd.y, cmd.w, cmd.h);
+        break;
+      case CMD_TEXT:
+        fl_draw(text_arena.data() + cmd.text_offset, (int)cmd.text_length,
+                cmd.x, cmd.y);
+        break;
+      case CMD_LINE:
+        fl_line(cmd.x, cmd.y, cmd.w, cmd.h);
+        break;
+      case CMD_PIE:
+        fl_pie(cmd.x, cmd.y, cmd.w, cmd.h, cmd.a1, cmd.a2);
+        break;
+      case CMD_ARC:
+        fl_arc(cmd.x, cmd.y, cmd.w, cmd.h, cmd.a1, cmd.a2);
+        break;
+      case CMD_IMAGE:
+#if FL_API_VERSION >= 10400
+        if (cmd.a1 != 1.0) {
+          // Pixels of a scaled screen go out as they are, into an area the
+          // size of the image in units
+          Fl_RGB_Image image(cmd.pixels, cmd.w, cmd.h, 3);
+          image.scale((int)lround(cmd.w / cmd.a1),
+                      (int)lround(cmd.h / cmd.a1), 0, 1);
+          image.draw(cmd.x, cmd.y);
+          break;
+        }
+#endif
+        fl_draw_image(cmd.pixels, cmd.x, cmd.y, cmd.w, cmd.h, 3);
+        break;
+      case CMD_PUSH_CLIP:
+        fl_push_clip(cmd.x, cmd.y, cmd.w, cmd.h);
+        break;
+      case CMD_POP_CLIP:
+        fl_pop_clip();
+        break;
+      }
+    }
+
+    frame.submitted = (int)commands.size() + state_changes;
+    frame.dropped_state = recorded_state - state_changes;
+    if (frame.dropped_state < 0)
+      frame.dropped_state = 0;
+    last_frame = frame;
 
-    save_to_file();
+    commands.clear();
+    text_arena.clear();
+    recorded_state = 0;
+    merged_rects = 0;
   }
 
-  void start_editing(int index) {
-    if (index < 0 || index >= (int)items.size()) {
-      return;
-    }
+  const Stats &stats() const { return last_frame; }
 
-    // Finish any existing editing first
-    if (editing_index >= 0 && editing_index != index) {
-      finish_editing();
+private:
+  enum CommandType {
+    CMD_RECTF,
+    CMD_TEXT,
+    CMD_LINE, // x, y, w, h hold x1, y1, x2, y2
+    CMD_PIE,
+    CMD_ARC,
+    CMD_IMAGE, // a1 holds the pixels per unit
+    CMD_PUSH_CLIP,
+    CMD_POP_CLIP
+  };
+
+  // Drawing commands carry the colour and font current when they were
+  // recorded; the state commands themselves are never stored
+  struct Command {
+    CommandType type;
+    int x, y, w, h;
+    double a1, a2;
+    Fl_Color color;
+    Fl_Font font;
+    Fl_Fontsize size;
+    size_t text_offset;
+    size_t text_length;
+    const uchar *pixels;
+  };
+
+  Command make(CommandType type) const {
+    Command cmd;
+    cmd.type = type;
+    cmd.x = cmd.y = cmd.w = cmd.h = 0;
+    cmd.a1 = cmd.a2 = 0;
+    cmd.color = current_color;
+    cmd.font = current_font;
+    cmd.size = current_size;
+    cmd.text_offset = cmd.text_length = 0;
+    cmd.pixels = nullptr;
+    return cmd;
+  }
+
+  std::vector<Command> commands;
+  std::string text_arena; // Text of all CMD_TEXT commands in this frame
+  Fl_Color current_color;
+  Fl_Font current_font;
+  Fl_Fontsize current_size;
+  int recorded_state; // Colour/font changes recorded this frame
+  int merged_rects;
+  Stats last_frame;
+};
+
+// Runtime metrics, exported with --metrics-file. The hot paths only do
+// relaxed atomic increments; the exporter reads the values on the UI thread.
+
+// Latencies above this count as stalls (several frames without a redraw)
+static const double STALL_SECONDS = 0.1;
+
+// Latency distribution over fixed buckets
+class LatencyHistogram {
+public:
+  enum { BUCKETS = 12 };
+
+  LatencyHistogram() : sum_us(0) {
+    for (int i = 0; i <= BUCKETS; i++) {
+      counts[i].store(0, std::memory_order_relaxed);
     }
+  }
 
-    editing_index = index;
-    editing_text = items[index].text;
+  // Upper bound of bucket i, in seconds
+  static double bound(int i) {
+    static const double bounds[BUCKETS] = {0.0005, 0.001, 0.0025, 0.005,
+                                           0.01,   0.025, 0.05,   0.1,
+                                           0.25,   0.5,   1.0,    2.5};
+    return bounds[i];
+  }
 
-    // Calculate position for input widget
-    int start_y = 0;
-    int item_y = start_y + index * item_height - scroll_offset;
-    if (is_pulling_down && pull_down_offset > 0) {
-      item_y += pull_down_offset;
+  void observe(double seconds) {
+    int bucket = 0;
+    while (bucket < BUCKETS && seconds > bound(bucket)) {
+      bucket++;
+    }
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum_us.fetch_add((unsigned long long)(seconds * 1e6),
+                     std::memory_order_relaxed);
+  }
+
+  // Observations in bucket i alone; bucket BUCKETS is everything slower
+  unsigned long long count(int i) const {
+    return counts[i].load(std::memory_order_relaxed);
+  }
+
+  double sum() const {
+    return sum_us.load(std::memory_order_relaxed) / 1e6;
+  }
+
+private:
+  std::atomic<unsigned long long> counts[BUCKETS + 1];
+  std::atomic<unsigned long long> sum_us;
+};
+
+struct Metrics {
+  LatencyHistogram save;  // StorageBackend::save() from the UI
+  LatencyHistogram load;  // StorageBackend::load()
+  LatencyHistogram draw;  // ClearApp::draw()
+  LatencyHistogram event; // ClearApp::handle()
+  std::atomic<unsigned long long> fsyncs;
+  std::atomic<unsigned long long> stalls;
+
+  Metrics() : fsyncs(0), stalls(0) {}
+};
+
+static Metrics metrics;
+
+// Times the enclosing scope into a histogram
+class ScopedLatency {
+public:
+  explicit ScopedLatency(LatencyHistogram &h)
+      : histogram(h), start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedLatency() {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    histogram.observe(seconds);
+    if (seconds > STALL_SECONDS) {
+      metrics.stalls.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  LatencyHistogram &histogram;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Escape/unescape text for file storage
+static std::string escape_text(const std::string &text) {
+  std::string result;
+  for (char c : text) {
+    if (c == '\n') {
+      result += "\\n";
+    } else if (c == '\\') {
+      result += "\\\\";
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+static std::string unescape_text(const std::string &text) {
+  std::string result;
+  for (size_t i = 0; i < text.length(); i++) {
+    if (text[i] == '\\' && i + 1 < text.length()) {
+      if (text[i + 1] == 'n') {
+        result += '\n';
+        i++;
+      } else if (text[i + 1] == '\\') {
+        result += '\\';
+        i++;
+      } else {
+        result += text[i];
+      }
+    } else {
+      result += text[i];
+    }
+  }
+  return result;
+}
+
+// Combine two change stamps into one that changes when either does
+static long long mix_stamp(long long stamp, long long more) {
+  return (long long)((unsigned long long)stamp * 31 + (unsigned long long)more);
+}
+
+// Size and a stamp of a file, used to tell whether a file changed. The
+// stamp mixes the modification time in nanoseconds with the inode, so a
+// same-size rewrite within one second (or a rename over it) still shows.
+static bool file_signature(const std::string &path, long long &size,
+                           long long &stamp) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return false;
+  }
+  size = (long long)info.st_size;
+#if defined(__APPLE__)
+  long long nanoseconds = info.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  long long nanoseconds = 0;
+#else
+  long long nanoseconds = info.st_mtim.tv_nsec;
+#endif
+  stamp = mix_stamp((long long)info.st_mtime * 1000000000LL + nanoseconds,
+                    (long long)info.st_ino);
+  return true;
+}
+
+// One line of todos.txt: "<color>[;n=<notes hash>]|<completed>|<escaped
+// text>". Older versions ignore everything before the first '|'.
+static std::string format_item_line(const TodoItem &item) {
+  // Save with color index 0 for backward compatibility (color is now
+  // position-based)
+  std::string color = "0";
+  if (!item.notes_hash.empty())
+    color += ";n=" + item.notes_hash;
+  return color + "|" + (item.completed ? "1" : "0") + "|" +
+         escape_text(item.text) + "\n";
+}
+
+static bool parse_item_line(const std::string &line, bool &completed,
+                            std::string &text, std::string &notes_hash) {
+  if (line.empty())
+    return false;
+
+  size_t pos1 = line.find('|');
+  if (pos1 == std::string::npos)
+    return false;
+
+  size_t pos2 = line.find('|', pos1 + 1);
+  if (pos2 == std::string::npos)
+    return false;
+
+  // Color index is stored but not used (for backward compatibility)
+  completed = (pos2 == pos1 + 2 && line[pos1 + 1] == '1');
+  text = unescape_text(line.substr(pos2 + 1));
+  notes_hash.clear();
+  size_t notes = line.find(";n=");
+  if (notes < pos1) {
+    std::string hash = line.substr(notes + 3, pos1 - notes - 3);
+    if (valid_blob_hash(hash))
+      notes_hash = hash;
+  }
+  return true;
+}
+
+// A positional edit of the stored list, replayed in order
+struct StorageOp {
+  enum Kind { INSERT, REMOVE, SET }; // SET rewrites text and completed
+
+  Kind kind;
+  int index;
+
+  StorageOp(Kind k, int i) : kind(k), index(i) {}
+};
+
+// Item ids in the order they were last stored, used by incremental backends
+// to turn a ChangeSet into positional StorageOps
+class StoredOrder {
+public:
+  StoredOrder() : valid(false) {}
+
+  void reset(const std::vector<TodoItem> &items) {
+    ids.clear();
+    ids.reserve(items.size());
+    for (const TodoItem &item : items) {
+      ids.push_back(item.id);
+    }
+    valid = true;
+  }
+
+  void invalidate() { valid = false; }
+
+  // Fill ops with the edits that turn the stored list into items. Returns
+  // false if the change set doesn't account for the difference, in which
+  // case the caller must store the whole list.
+  bool apply(const std::vector<TodoItem> &items, const ChangeSet &changes,
+             std::vector<StorageOp> &ops) {
+    ops.clear();
+    if (!valid)
+      return false;
+
+    // Removed and moved items are taken out first; moved ones come back as
+    // inserts at their new position
+    std::vector<unsigned> relocated;
+    for (const ModelChange &change : changes.changes) {
+      if (change.kind == ModelChange::REMOVE ||
+          change.kind == ModelChange::MOVE)
+        relocated.push_back(change.item_id);
+    }
+    std::sort(relocated.begin(), relocated.end());
+    if (!relocated.empty()) {
+      for (size_t i = ids.size(); i-- > 0;) {
+        if (std::binary_search(relocated.begin(), relocated.end(), ids[i])) {
+          ops.push_back(StorageOp(StorageOp::REMOVE, i));
+          ids.erase(ids.begin() + i);
+        }
+      }
+    }
+
+    std::vector<unsigned> written; // Items whose content an INSERT stores
+    if (changes.structural()) {
+      for (size_t i = 0; i < items.size(); i++) {
+        if (i < ids.size() && ids[i] == items[i].id)
+          continue;
+        ids.insert(ids.begin() + i, items[i].id);
+        ops.push_back(StorageOp(StorageOp::INSERT, i));
+        written.push_back(items[i].id);
+      }
+    }
+    if (ids.size() != items.size()) {
+      valid = false;
+      return false;
+    }
+
+    std::sort(written.begin(), written.end());
+    std::unordered_set<unsigned> set_ids; // Items a SET already stores
+    for (const ModelChange &change : changes.changes) {
+      if (change.kind != ModelChange::UPDATE_TEXT &&
+          change.kind != ModelChange::TOGGLE)
+        continue;
+      if (std::binary_search(written.begin(), written.end(), change.item_id) ||
+          set_ids.count(change.item_id))
+        continue;
+      int index = find_index(items, change);
+      if (index < 0 || ids[index] != change.item_id) {
+        valid = false;
+        return false;
+      }
+      ops.push_back(StorageOp(StorageOp::SET, index));
+      set_ids.insert(change.item_id);
+    }
+    return true;
+  }
+
+private:
+  // Current index of a changed item, trying the position hint first
+  static int find_index(const std::vector<TodoItem> &items,
+                        const ModelChange &change) {
+    if (change.index >= 0 && change.index < (int)items.size() &&
+        items[change.index].id == change.item_id)
+      return change.index;
+    for (size_t i = 0; i < items.size(); i++) {
+      if (items[i].id == change.item_id)
+        return i;
+    }
+    return -1;
+  }
+
+  bool valid;
+  std::vector<unsigned> ids;
+};
+
+// Fold our edits (base -> ours) into a list another process saved over
+// base (theirs). Records are matched to theirs by content. A base record
+// theirs no longer has is paired by position with the first unmatched
+// record of theirs between its matched neighbours: their edit of it.
+// Their order wins, except for items we moved or inserted, which go after
+// the item that precedes them in ours. Where both sides changed a record,
+// ours takes its slot and their version is dropped. Records of theirs that
+// we kept take our item ids, so theirs can serve as the base for the next
+// merge.
+static void merge_lists(const std::vector<TodoItem> &base,
+                        const std::vector<TodoItem> &ours,
+                        std::vector<TodoItem> &theirs,
+                        const ChangeSet *changes,
+                        std::vector<TodoItem> &merged) {
+  // Base record -> matching record in theirs, in order
+  std::map<std::string, std::vector<size_t> > by_content;
+  for (size_t i = 0; i < theirs.size(); i++) {
+    by_content[format_item_line(theirs[i])].push_back(i);
+  }
+  std::map<unsigned, long> in_theirs; // Base item id -> index in theirs
+  long last = -1;
+  for (const TodoItem &item : base) {
+    std::map<std::string, std::vector<size_t> >::const_iterator match =
+        by_content.find(format_item_line(item));
+    if (match == by_content.end())
+      continue;
+    std::vector<size_t>::const_iterator next =
+        last < 0 ? match->second.begin()
+                 : std::upper_bound(match->second.begin(),
+                                    match->second.end(), (size_t)last);
+    if (next != match->second.end()) {
+      last = *next;
+      in_theirs[item.id] = last;
+    }
+  }
+
+  // Pair the rest by position. limit[i] is the index in theirs of the
+  // first content-matched base record from i on.
+  std::vector<long> limit(base.size() + 1, (long)theirs.size());
+  for (size_t i = base.size(); i-- > 0;) {
+    std::map<unsigned, long>::const_iterator found =
+        in_theirs.find(base[i].id);
+    limit[i] = (found != in_theirs.end()) ? found->second : limit[i + 1];
+  }
+  std::vector<bool> used(theirs.size(), false);
+  for (const std::pair<const unsigned, long> &match : in_theirs) {
+    used[match.second] = true;
+  }
+  std::unordered_set<unsigned> edited; // Base records they edited
+  long cursor = 0;
+  for (size_t i = 0; i < base.size(); i++) {
+    std::map<unsigned, long>::const_iterator found =
+        in_theirs.find(base[i].id);
+    if (found != in_theirs.end()) {
+      cursor = found->second + 1;
+      continue;
+    }
+    while (cursor < limit[i] && used[cursor]) {
+      cursor++;
+    }
+    if (cursor < limit[i]) {
+      in_theirs[base[i].id] = cursor;
+      used[cursor] = true;
+      edited.insert(base[i].id);
+      cursor++;
+    }
+  }
+
+  std::vector<unsigned> moved;
+  if (changes) {
+    for (const ModelChange &change : changes->changes) {
+      if (change.kind == ModelChange::MOVE)
+        moved.push_back(change.item_id);
+    }
+    std::sort(moved.begin(), moved.end());
+  }
+
+  // Our version of each record of theirs we kept, null if we removed it
+  std::vector<const TodoItem *> slots(theirs.size());
+  for (size_t i = 0; i < theirs.size(); i++) {
+    slots[i] = &theirs[i];
+  }
+  std::map<unsigned, size_t> in_ours;
+  for (size_t i = 0; i < ours.size(); i++) {
+    in_ours[ours[i].id] = i;
+  }
+  std::vector<unsigned> stale; // Records only they removed
+  for (const TodoItem &item : base) {
+    std::map<unsigned, long>::const_iterator slot = in_theirs.find(item.id);
+    std::map<unsigned, size_t>::const_iterator mine = in_ours.find(item.id);
+    bool unchanged = mine != in_ours.end() &&
+                     ours[mine->second].text == item.text &&
+                     ours[mine->second].completed == item.completed &&
+                     ours[mine->second].notes_hash == item.notes_hash;
+    if (slot == in_theirs.end()) {
+      if (unchanged)
+        stale.push_back(item.id);
+      continue;
+    }
+    if (mine == in_ours.end() ||
+        std::binary_search(moved.begin(), moved.end(), item.id)) {
+      slots[slot->second] = nullptr;
+    } else if (unchanged && edited.count(item.id)) {
+      theirs[slot->second].id = item.id; // Their edit, under our id
+    } else {
+      slots[slot->second] = &ours[mine->second];
+    }
+  }
+
+  // Everything else of ours is placed after its predecessor in ours
+  std::vector<std::vector<const TodoItem *> > after(theirs.size() + 1);
+  std::sort(stale.begin(), stale.end());
+  long anchor = 0; // Slot index + 1 of the last placed item of ours
+  for (const TodoItem &item : ours) {
+    std::map<unsigned, long>::const_iterator slot = in_theirs.find(item.id);
+    if (slot != in_theirs.end() && slots[slot->second] &&
+        slots[slot->second]->id == item.id) {
+      anchor = slot->second + 1;
+    } else if (!std::binary_search(stale.begin(), stale.end(), item.id)) {
+      after[anchor].push_back(&item);
+    }
+  }
+
+  for (size_t i = 0; i < theirs.size(); i++) {
+    if (slots[i]) {
+      theirs[i].id = slots[i]->id;
+    }
+  }
+
+  merged.clear();
+  for (size_t i = 0; i <= theirs.size(); i++) {
+    for (const TodoItem *item : after[i]) {
+      merged.push_back(*item);
+    }
+    if (i < theirs.size() && slots[i]) {
+      merged.push_back(*slots[i]);
+    }
+  }
+}
+
+// Redo our edits (base -> ours, described by changes) on theirs, the list
+// another process saved over base, when its journal records said exactly
+// what it did, so the base items it kept have their ids in theirs. Only
+// the changed items are looked at. The outcome is merge_lists()'s: their
+// order wins, except for items we moved or inserted, and items they
+// removed but we edited, which go after the item that precedes them in
+// ours; where both sides changed a record, ours wins. redo gets the
+// changes that turn theirs into merged.
+static void rebase_changes(const std::vector<TodoItem> &theirs,
+                           const std::vector<TodoItem> &ours,
+                           const ChangeSet &changes,
+                           std::vector<TodoItem> &merged, ChangeSet &redo) {
+  std::unordered_map<unsigned, size_t> in_theirs, in_ours;
+  for (size_t i = 0; i < theirs.size(); i++) {
+    in_theirs[theirs[i].id] = i;
+  }
+  for (size_t i = 0; i < ours.size(); i++) {
+    in_ours[ours[i].id] = i;
+  }
+  std::unordered_set<unsigned> relocated; // Inserted or moved by us
+  for (const ModelChange &change : changes.changes) {
+    if (change.kind == ModelChange::INSERT ||
+        change.kind == ModelChange::MOVE)
+      relocated.insert(change.item_id);
+  }
+
+  // Our version of each record of theirs, null where we take it out
+  std::vector<const TodoItem *> slots(theirs.size());
+  for (size_t i = 0; i < theirs.size(); i++) {
+    slots[i] = &theirs[i];
+  }
+  std::unordered_map<unsigned, ModelChange> pending; // Indices set below
+  std::vector<size_t> placed; // Items of ours that go in anew
+  redo.changes.clear();
+  for (const ModelChange &change : changes.changes) {
+    unsigned id = change.item_id;
+    if (pending.count(id))
+      continue;
+    std::unordered_map<unsigned, size_t>::const_iterator mine =
+        in_ours.find(id);
+    std::unordered_map<unsigned, size_t>::const_iterator slot =
+        in_theirs.find(id);
+    if (mine == in_ours.end()) {
+      if (slot != in_theirs.end() && slots[slot->second]) {
+        slots[slot->second] = nullptr;
+        redo.changes.push_back(
+            ModelChange(ModelChange::REMOVE, id, slot->second));
+      }
+      continue;
+    }
+    if (slot != in_theirs.end() && !relocated.count(id)) {
+      slots[slot->second] = &ours[mine->second];
+      pending.insert(
+          std::make_pair(id, ModelChange(ModelChange::UPDATE_TEXT, id, -1)));
+      continue;
+    }
+    if (slot != in_theirs.end()) {
+      slots[slot->second] = nullptr;
+      pending.insert(std::make_pair(
+          id, ModelChange(ModelChange::MOVE, id, -1, slot->second)));
+    } else {
+      pending.insert(
+          std::make_pair(id, ModelChange(ModelChange::INSERT, id, -1)));
+    }
+    placed.push_back(mine->second);
+  }
+
+  // Each goes after the nearest item before it in ours that keeps its slot
+  std::sort(placed.begin(), placed.end());
+  std::vector<std::vector<const TodoItem *> > after(theirs.size() + 1);
+  for (size_t i : placed) {
+    size_t anchor = 0;
+    for (size_t p = i; p-- > 0;) {
+      std::unordered_map<unsigned, size_t>::const_iterator slot =
+          in_theirs.find(ours[p].id);
+      if (slot != in_theirs.end() && slots[slot->second]) {
+        anchor = slot->second + 1;
+        break;
+      }
+    }
+    after[anchor].push_back(&ours[i]);
+  }
+
+  // Our changes are recorded at the positions their items end up in
+  merged.clear();
+  merged.reserve(theirs.size() + placed.size());
+  for (size_t i = 0; i <= theirs.size(); i++) {
+    for (const TodoItem *item : after[i]) {
+      redo.changes.push_back(pending.find(item->id)->second);
+      redo.changes.back().index = merged.size();
+      merged.push_back(*item);
+    }
+    if (i < theirs.size() && slots[i]) {
+      if (slots[i] != &theirs[i]) {
+        redo.changes.push_back(pending.find(slots[i]->id)->second);
+        redo.changes.back().index = merged.size();
+      }
+      merged.push_back(*slots[i]);
+    }
+  }
+}
+
+// "<file>.version": a counter every writer of the file bumps. A writer
+// prepares its write, then takes an fcntl lock on this file only to check
+// that the counter is still the one it last saw and swap the write in.
+//
+// "<file>.changes" keeps what the recent writes did, so that a writer who
+// lost the race can catch up on those alone: the first version it has
+// records for, then per version a "<version> <count>" line and that many
+// journal records (see JournalStorage). A write it can't describe, or one
+// that would take it past CHANGES_LIMIT, starts it again from the next
+// version.
+class FileVersion {
+public:
+  enum { CHANGES_LIMIT = 256 * 1024 };
+
+  FileVersion() : fd(-1), known(0), changes_first(0), changes_offset(0) {}
+  ~FileVersion() {
+#ifndef _WIN32
+    if (fd >= 0)
+      ::close(fd);
+#endif
+  }
+
+  void attach(const std::string &file) {
+    path = file + ".version";
+    changes_path = file + ".changes";
+  }
+  bool attached() const { return !path.empty(); }
+
+  // Call before reading the file: its contents are at least this new
+  void refresh() {
+    known = read_counter();
+    changes_offset = 0; // Where its records end is not known
+  }
+
+  // Whether nobody wrote since refresh() or our last write
+  bool unchanged() { return read_counter() == known; }
+
+  // Take the lock; returns false if someone wrote since refresh() or our
+  // last write. Always pair with unlock().
+  bool lock() {
+#ifndef _WIN32
+    if (fd < 0)
+      fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd >= 0) {
+      struct flock request;
+      memset(&request, 0, sizeof(request));
+      request.l_type = F_WRLCK;
+      request.l_whence = SEEK_SET;
+      while (fcntl(fd, F_SETLKW, &request) == -1 && errno == EINTR) {
+      }
+    }
+#endif
+    return read_counter() == known;
+  }
+
+  // records are the journal records of what we wrote, or null if it
+  // can't be told that way
+  void unlock(bool wrote, const std::string *records = nullptr) {
+    if (wrote) {
+      known = read_counter() + 1;
+      log_changes(records); // Before the counter: readers go by the counter
+      write_counter(known);
+    }
+#ifndef _WIN32
+    if (fd >= 0) {
+      struct flock request;
+      memset(&request, 0, sizeof(request));
+      request.l_type = F_UNLCK;
+      request.l_whence = SEEK_SET;
+      fcntl(fd, F_SETLK, &request);
+    }
+#endif
+  }
+
+  // After lock() failed: append to records what the writes since
+  // refresh() or our last write did, oldest first. Returns false if the
+  // log doesn't have all of them; the file must be read again then.
+  bool catch_up(std::string &records) {
+    unsigned long long latest = read_counter();
+    std::ifstream log(changes_path);
+    std::string line;
+    if (!std::getline(log, line))
+      return false;
+    unsigned long long first = strtoull(line.c_str(), nullptr, 10);
+    if (first == 0 || first > known + 1)
+      return false;
+    if (first == changes_first && changes_offset > 0) {
+      log.seekg(changes_offset); // Everything before it is known already
+    }
+
+    unsigned long long next = known + 1, version = 0;
+    long remaining = -1; // Records left in the block being read, -1 if none
+    std::string block;
+    std::streamoff end = changes_offset;
+    while (next <= latest && std::getline(log, line)) {
+      if (!line.empty() && isdigit((unsigned char)line[0])) {
+        // A block cut short before this one was never committed
+        char *rest;
+        version = strtoull(line.c_str(), &rest, 10);
+        remaining = strtol(rest, nullptr, 10);
+        block.clear();
+      } else if (remaining > 0) {
+        block += line + "\n";
+        remaining--;
+      }
+      if (remaining != 0)
+        continue;
+      remaining = -1;
+      if (version > next)
+        return false; // Its records are gone
+      if (version == next) {
+        records += block;
+        next++;
+        end = log.tellg();
+      }
+    }
+    if (next <= latest)
+      return false;
+    known = latest;
+    changes_first = first;
+    changes_offset = end;
+    return true;
+  }
+
+private:
+  void log_changes(const std::string *records) {
+    std::string first_line;
+    std::ifstream in(changes_path);
+    std::getline(in, first_line);
+    in.close();
+    unsigned long long first = strtoull(first_line.c_str(), nullptr, 10);
+    long long size = 0, stamp;
+    if (!records || first == 0 || first > known ||
+        !file_signature(changes_path, size, stamp) ||
+        size + (long long)records->size() > CHANGES_LIMIT) {
+      std::ofstream out(changes_path, std::ios::trunc);
+      out << known + 1 << "\n";
+      changes_first = known + 1;
+      changes_offset = out.tellp();
+      return;
+    }
+    std::string block = std::to_string(known) + " " +
+                        std::to_string(std::count(records->begin(),
+                                                  records->end(), '\n')) +
+                        "\n" + *records;
+    std::ofstream out(changes_path, std::ios::app);
+    out.write(block.data(), block.size());
+    changes_first = first;
+    changes_offset = size + block.size();
+  }
+
+  unsigned long long read_counter() {
+    char buffer[32] = {0};
+#ifndef _WIN32
+    if (fd >= 0) {
+      ssize_t got = pread(fd, buffer, sizeof(buffer) - 1, 0);
+      return got > 0 ? strtoull(buffer, nullptr, 10) : 0;
+    }
+#endif
+    std::ifstream file(path);
+    file.read(buffer, sizeof(buffer) - 1);
+    return strtoull(buffer, nullptr, 10);
+  }
+
+  void write_counter(unsigned long long value) {
+    std::string text = std::to_string(value) + "\n";
+#ifndef _WIN32
+    if (fd >= 0) {
+      if (pwrite(fd, text.data(), text.size(), 0) == (ssize_t)text.size()) {
+        if (ftruncate(fd, text.size()) != 0) {
+          // A longer stale tail only follows the newline
+        }
+      }
+      return;
+    }
+#endif
+    std::ofstream file(path, std::ios::trunc);
+    file << text;
+  }
+
+  std::string path;
+  int fd;
+  unsigned long long known;
+  std::string changes_path;
+  unsigned long long changes_first; // First version of the log we read
+  std::streamoff changes_offset;    // End of the records we know, or 0
+};
+
+// Temporary name for a file being replaced, unique to this process
+static std::string temp_path(const std::string &path) {
+  return path + "." + std::to_string((long)getpid()) + ".tmp";
+}
+
+// Move a finished temporary file over path
+static bool replace_file(const std::string &temp, const std::string &path) {
+#ifdef _WIN32
+  remove(path.c_str());
+#endif
+  return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+// Apply one journal record, "<op>|<index>[|<item line>]" (see
+// JournalStorage). Returns false for a torn or invalid record.
+static bool replay_journal_record(const std::string &record,
+                                  std::vector<TodoItem> &items) {
+  if (record.size() < 3 || record[1] != '|')
+    return false;
+  size_t end = record.find('|', 2);
+  int index = atoi(record.substr(2, end - 2).c_str());
+  bool completed = false;
+  std::string text, notes_hash;
+  if (record[0] == 'R') {
+    if (index < 0 || index >= (int)items.size())
+      return false;
+    items.erase(items.begin() + index);
+    return true;
+  }
+  if (end == std::string::npos ||
+      !parse_item_line(record.substr(end + 1), completed, text, notes_hash))
+    return false;
+  if (record[0] == 'I') {
+    if (index < 0 || index > (int)items.size())
+      return false;
+    items.insert(items.begin() + index, TodoItem(text));
+  } else if (record[0] == 'S') {
+    if (index < 0 || index >= (int)items.size())
+      return false;
+    items[index].set_text(text);
+  } else {
+    return false;
+  }
+  items[index].completed = completed;
+  items[index].notes_hash = notes_hash;
+  return true;
+}
+
+// Journal records for ops that turned the stored list into items
+static std::string journal_records(const std::vector<TodoItem> &items,
+                                   const std::vector<StorageOp> &ops) {
+  std::string records;
+  for (const StorageOp &op : ops) {
+    switch (op.kind) {
+    case StorageOp::INSERT:
+      records += "I|" + std::to_string(op.index) + "|" +
+                 format_item_line(items[op.index]);
+      break;
+    case StorageOp::REMOVE:
+      records += "R|" + std::to_string(op.index) + "\n";
+      break;
+    case StorageOp::SET:
+      records += "S|" + std::to_string(op.index) + "|" +
+                 format_item_line(items[op.index]);
+      break;
+    }
+  }
+  return records;
+}
+
+// Which items a windowed read counts (StorageBackend::fetch_window()). The
+// list view shows the open items first, then the completed ones.
+enum ItemSubset { ALL_ITEMS, OPEN_ITEMS, COMPLETED_ITEMS };
+
+// Where the list is persisted. Backends get the ChangeSet behind every save
+// so they can write incrementally; a null change set asks for a full write.
+//
+// Saves are safe against other processes writing the same files (see
+// FileVersion): the backend prepares its write outside the lock and only
+// publishes it under the lock. If another process saved in between, the
+// records it left in the change log are applied to the list as we last
+// stored it, our changes are redone on top, and only those are written.
+// Where the log can't tell (a full write, an encrypted file) the list on
+// disk is re-read, merged with our edits and saved in full.
+class StorageBackend {
+public:
+  StorageBackend() : written(0), has_merged(false) {}
+  virtual ~StorageBackend() {}
+
+  virtual const char *name() const = 0;
+
+  // Path shown in error messages
+  virtual std::string path() const = 0;
+
+  // Whether item text must not be written anywhere else in plain form
+  virtual bool confidential() const { return false; }
+
+  // Replace items with the stored list. Returns false if nothing is stored
+  // (normal on first run); error is set if reading failed.
+  bool load(std::vector<TodoItem> &items, std::string &error) {
+    if (shared()) {
+      version.attach(path());
+      version.refresh();
+    }
+    bool loaded = read(items, error);
+    remember(items);
+    return loaded;
+  }
+
+  // Read the stored list a window at a time instead, where the backend can
+  // reach an item without reading those before it. open_window() tells how
+  // many items are stored and how many of them are open, fetch_window()
+  // appends items [first, first + count) of subset to out, and
+  // load_window() takes the whole list read that way as loaded. It returns
+  // false if another process saved since open_window(); load() the list
+  // then.
+  bool open_window(unsigned &count, unsigned &open) {
+    if (shared()) {
+      version.attach(path());
+      version.refresh();
+    }
+    return open_stored(count, open);
+  }
+
+  virtual void fetch_window(unsigned, unsigned, ItemSubset,
+                            std::vector<TodoItem> &) {}
+
+  bool load_window(const std::vector<TodoItem> &items) {
+    if ((shared() && !version.unchanged()) || !follow(items))
+      return false;
+    remember(items);
+    return true;
+  }
+
+  bool save(const std::vector<TodoItem> &items, const ChangeSet *changes,
+            std::string &error) {
+    if (!shared()) {
+      return prepare(items, changes, error) && publish(error);
+    }
+    if (!version.attached()) {
+      version.attach(path());
+    }
+
+    const std::vector<TodoItem> *list = &items;
+    ChangeSet rebased; // Our changes, redone on another process's save
+    for (int attempt = 0; attempt < 3; attempt++) {
+      if (!prepare(*list, changes, error))
+        return false;
+      if (version.lock()) {
+        bool published = publish(error);
+        // Item text goes to the change log only if the file is plain text
+        std::string records;
+        bool recorded = published && changes && !confidential() &&
+                        record(*list, *changes, records);
+        version.unlock(published, recorded ? &records : nullptr);
+        if (published && !recorded) {
+          remember(*list);
+        }
+        return published;
+      }
+      version.unlock(false);
+      discard();
+
+      // Another process saved since we last read the list
+      std::vector<TodoItem> result;
+      std::string records;
+      if (changes && version.catch_up(records) && replay(records)) {
+        ChangeSet redo;
+        rebase_changes(base, *list, *changes, result, redo);
+        rebased.changes.swap(redo.changes);
+        changes = follow(base) ? &rebased : nullptr;
+      } else {
+        std::vector<TodoItem> theirs;
+        version.refresh();
+        read(theirs, error);
+        if (!error.empty())
+          return false;
+        merge_lists(base, *list, theirs, changes, result);
+        base.swap(theirs);
+        changes = nullptr;
+      }
+      merged.swap(result);
+      base_order.reset(base);
+      has_merged = true;
+      list = &merged;
+    }
+    error = "Failed to save file: " + path() + " (changed by another program)";
+    return false;
+  }
+
+  // After a save that merged in another process's changes: the list as
+  // saved, to show instead of the one passed to save()
+  bool take_merged(std::vector<TodoItem> &items) {
+    if (!has_merged)
+      return false;
+    items.swap(merged);
+    merged.clear();
+    has_merged = false;
+    return true;
+  }
+
+  // Fingerprint of everything stored, to detect changes between runs
+  virtual bool signature(long long &size, long long &stamp) const {
+    return file_signature(path(), size, stamp);
+  }
+
+  unsigned long long bytes_written() const { return written; }
+
+protected:
+  virtual bool read(std::vector<TodoItem> &items, std::string &error) = 0;
+
+  // Get a save ready without touching what other processes read
+  virtual bool prepare(const std::vector<TodoItem> &items,
+                       const ChangeSet *changes, std::string &error) = 0;
+
+  // Make the prepared save visible; runs under the version lock, so keep it
+  // to a rename or a short append
+  virtual bool publish(std::string &error) = 0;
+
+  // Throw away a prepared save that lost to another process
+  virtual void discard() {}
+
+  // Open the stored list for fetch_window(); false if it can't be read
+  // that way
+  virtual bool open_stored(unsigned &, unsigned &) { return false; }
+
+  // stored is the list on disk, which we got from another process's change
+  // records or from fetch_window() rather than by read(). Returns true if
+  // the next prepare() can write changes on top of it; false to have it
+  // write the list in full.
+  virtual bool follow(const std::vector<TodoItem> &) { return false; }
+
+  // Whether other processes may write the same files
+  virtual bool shared() const { return true; }
+
+  unsigned long long written;
+
+private:
+  // Keep the list as stored, the starting point for merges
+  void remember(const std::vector<TodoItem> &items) {
+    if (!shared())
+      return;
+    base = items;
+    base_order.reset(items);
+  }
+
+  // Bring base up to date with a save of changes, and describe what they
+  // did to it as journal records. The removal of a moved item says where
+  // its insert puts it back: "R|<index>|@<new index>". Returns false if
+  // the changes don't account for the save; remember() the list then.
+  bool record(const std::vector<TodoItem> &items, const ChangeSet &changes,
+              std::string &records) {
+    if (!base_order.apply(items, changes, base_ops))
+      return false;
+    std::unordered_map<unsigned, int> inserted; // Item id -> new index
+    for (const StorageOp &op : base_ops) {
+      if (op.kind == StorageOp::INSERT)
+        inserted[items[op.index].id] = op.index;
+    }
+    records = journal_records(items, base_ops);
+    size_t pos = 0;
+    for (const StorageOp &op : base_ops) {
+      size_t end = records.find('\n', pos);
+      switch (op.kind) {
+      case StorageOp::INSERT:
+        base.insert(base.begin() + op.index, items[op.index]);
+        break;
+      case StorageOp::REMOVE: {
+        std::unordered_map<unsigned, int>::const_iterator back =
+            inserted.find(base[op.index].id);
+        if (back != inserted.end()) {
+          std::string to = "|@" + std::to_string(back->second);
+          records.insert(end, to);
+          end += to.size();
+        }
+        base.erase(base.begin() + op.index);
+        break;
+      }
+      case StorageOp::SET:
+        base[op.index] = items[op.index];
+        break;
+      }
+      pos = end + 1;
+    }
+    return true;
+  }
+
+  // Apply another process's journal records to base. They are checked
+  // first, so base is left as it was if any of them is invalid. A moved
+  // item keeps its id, so that rebase_changes() knows it.
+  bool replay(const std::string &records) {
+    long size = base.size();
+    std::istringstream in(records);
+    std::string line, text, notes_hash;
+    bool completed;
+    while (std::getline(in, line)) {
+      if (line.size() < 3 || line[1] != '|')
+        return false;
+      long index = atol(line.c_str() + 2);
+      size_t end = line.find('|', 2);
+      bool item = end != std::string::npos &&
+                  parse_item_line(line.substr(end + 1), completed, text,
+                                  notes_hash);
+      if (line[0] == 'R' && index >= 0 && index < size) {
+        size--;
+      } else if (line[0] == 'I' && item && index >= 0 && index <= size) {
+        size++;
+      } else if (!(line[0] == 'S' && item && index >= 0 && index < size)) {
+        return false;
+      }
+    }
+    in.clear();
+    in.seekg(0);
+    std::map<long, unsigned> moving; // New index -> id of a moved item
+    while (std::getline(in, line)) {
+      long index = atol(line.c_str() + 2);
+      size_t to = line.find("|@");
+      if (line[0] == 'R' && to != std::string::npos) {
+        moving[atol(line.c_str() + to + 2)] = base[index].id;
+      }
+      replay_journal_record(line, base);
+      std::map<long, unsigned>::iterator moved = moving.find(index);
+      if (line[0] == 'I' && moved != moving.end()) {
+        base[index].id = moved->second;
+        moving.erase(moved);
+      }
+    }
+    return true;
+  }
+
+  FileVersion version;
+  std::vector<TodoItem> base; // The list as of our last load or save
+  StoredOrder base_order;
+  std::vector<StorageOp> base_ops;
+  std::vector<TodoItem> merged;
+  bool has_merged;
+};
+
+// Replay a journal file onto items; returns the bytes of valid records
+static long long replay_journal(const std::string &path,
+                                std::vector<TodoItem> &items) {
+  long long bytes = 0;
+  std::ifstream journal(path);
+  std::string line;
+  while (journal.is_open() && std::getline(journal, line)) {
+    // A torn or invalid record ends the replay
+    if (!replay_journal_record(line, items))
+      break;
+    bytes += line.size() + 1;
+  }
+  return bytes;
+}
+
+// The original format: one "<color>|<completed>|<text>" line per item,
+// rewritten in full on every save
+class TextStorage : public StorageBackend {
+public:
+  explicit TextStorage(const std::string &file)
+      : file_path(file), temp_file(temp_path(file)) {}
+
+  const char *name() const override { return "text"; }
+  std::string path() const override { return file_path; }
+
+  static bool read_text_file(const std::string &path,
+                             std::vector<TodoItem> &items,
+                             std::string &error) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+      // File doesn't exist or can't be opened
+      // This is normal for first run, so don't show error
+      return false;
+    }
+
+    items.clear();
+    std::string line, text, notes_hash;
+    bool completed;
+    bool loaded_any = false;
+    while (std::getline(file, line)) {
+      if (!parse_item_line(line, completed, text, notes_hash))
+        continue;
+      items.push_back(TodoItem(text));
+      items.back().completed = completed;
+      items.back().notes_hash = notes_hash;
+      loaded_any = true;
+    }
+
+    // Check if read failed
+    if (file.fail() && !file.eof()) {
+      error = "Error reading file: " + path;
+    }
+
+    return loaded_any; // Return true if we loaded at least one item
+  }
+
+protected:
+  // A journal left by the journal backend is applied on load and folded
+  // into the file on the next save, so switching backends loses nothing
+  bool read(std::vector<TodoItem> &items, std::string &error) override {
+    items.clear();
+    bool loaded = read_text_file(file_path, items, error);
+    if (replay_journal(file_path + ".journal", items) > 0)
+      loaded = true;
+    return loaded && !items.empty();
+  }
+
+  bool prepare(const std::vector<TodoItem> &items, const ChangeSet *,
+               std::string &error) override {
+    return write_text_file(temp_file, items, error);
+  }
+
+  bool publish(std::string &error) override {
+    if (!replace_file(temp_file, file_path)) {
+      error = "Error saving file: " + file_path;
+      return false;
+    }
+    remove((file_path + ".journal").c_str());
+    return true;
+  }
+
+  void discard() override { remove(temp_file.c_str()); }
+
+  bool write_text_file(const std::string &path,
+                       const std::vector<TodoItem> &items,
+                       std::string &error) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+      error = "Failed to save file: " + path;
+      return false;
+    }
+
+    std::string buffer;
+    for (const auto &item : items) {
+      buffer += format_item_line(item);
+    }
+    file.write(buffer.data(), buffer.size());
+    file.close();
+    written += buffer.size();
+
+    // Check if write failed
+    if (file.fail()) {
+      error = "Error saving file: " + path;
+      return false;
+    }
+    return true;
+  }
+
+  std::string file_path;
+  std::string temp_file; // Prepared saves, renamed over file_path
+};
+
+// Compact binary snapshot: "CLRB", version, count, then per item a flags
+// byte (completed, has notes), a 32-bit length, the raw text and the notes
+// hash if any. Version 1 files have no notes. Rewritten in full.
+class BinarySnapshotStorage : public StorageBackend {
+public:
+  explicit BinarySnapshotStorage(const std::string &file)
+      : file_path(file), temp_file(temp_path(file)) {}
+
+  const char *name() const override { return "binary"; }
+  std::string path() const override { return file_path; }
+
+protected:
+  bool read(std::vector<TodoItem> &items, std::string &error) override {
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.is_open()) {
+      return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+    size_t version = data.size() < 12 ? 0 : get_u32(data, 4);
+    if (data.size() < 12 || data.compare(0, 4, "CLRB") != 0 ||
+        (version != 1 && version != 2)) {
+      error = "Error reading file: " + file_path;
+      return false;
+    }
+
+    items.clear();
+    size_t count = get_u32(data, 8);
+    size_t pos = 12;
+    for (size_t i = 0; i < count; i++) {
+      if (pos + 5 > data.size())
+        break;
+      unsigned flags = (unsigned char)data[pos];
+      bool completed = version == 1 ? flags != 0 : (flags & 1) != 0;
+      size_t notes = (version == 2 && (flags & 2)) ? 64 : 0;
+      size_t length = get_u32(data, pos + 1);
+      pos += 5;
+      if (pos + length + notes > data.size())
+        break;
+      items.push_back(TodoItem(data.substr(pos, length)));
+      items.back().completed = completed;
+      items.back().notes_hash = data.substr(pos + length, notes);
+      pos += length + notes;
+    }
+    if (items.size() != count) {
+      error = "Error reading file: " + file_path;
+    }
+    return !items.empty();
+  }
+
+  bool prepare(const std::vector<TodoItem> &items, const ChangeSet *,
+               std::string &error) override {
+    std::string data("CLRB");
+    put_u32(data, 2);
+    put_u32(data, items.size());
+    for (const TodoItem &item : items) {
+      data += (char)((item.completed ? 1 : 0) |
+                     (item.notes_hash.empty() ? 0 : 2));
+      put_u32(data, item.text.size());
+      data += item.text;
+      data += item.notes_hash;
+    }
+
+    std::ofstream file(temp_file, std::ios::binary);
+    if (!file.is_open()) {
+      error = "Failed to save file: " + temp_file;
+      return false;
+    }
+    file.write(data.data(), data.size());
+    file.close();
+    written += data.size();
+    if (file.fail()) {
+      error = "Error saving file: " + temp_file;
+      return false;
+    }
+    return true;
+  }
+
+  bool publish(std::string &error) override {
+    if (!replace_file(temp_file, file_path)) {
+      error = "Error saving file: " + file_path;
+      return false;
+    }
+    return true;
+  }
+
+  void discard() override { remove(temp_file.c_str()); }
+
+private:
+  static void put_u32(std::string &out, size_t value) {
+    for (int i = 0; i < 4; i++) {
+      out += (char)((value >> (i * 8)) & 0xff);
+    }
+  }
+
+  static size_t get_u32(const std::string &in, size_t pos) {
+    size_t value = 0;
+    for (int i = 0; i < 4; i++) {
+      value |= (size_t)(unsigned char)in[pos + i] << (i * 8);
+    }
+    return value;
+  }
+
+  std::string file_path;
+  std::string temp_file;
+};
+
+// The text format as a base file plus an append-only journal of positional
+// edits ("<file>.journal"). Saves append a few lines; the base is rewritten
+// (and the journal emptied) once the journal outgrows it.
+class JournalStorage : public TextStorage {
+public:
+  explicit JournalStorage(const std::string &file)
+      : TextStorage(file), journal_path(file + ".journal"), base_bytes(0),
+        journal_bytes(0), compacting(false) {}
+
+  const char *name() const override { return "journal"; }
+
+  bool signature(long long &size, long long &stamp) const override {
+    long long journal_size = 0, journal_stamp = 0;
+    if (!file_signature(file_path, size, stamp))
+      return false;
+    if (file_signature(journal_path, journal_size, journal_stamp)) {
+      size += journal_size;
+      stamp = mix_stamp(stamp, journal_stamp);
+    }
+    return true;
+  }
+
+protected:
+  bool read(std::vector<TodoItem> &items, std::string &error) override {
+    items.clear();
+    bool loaded = read_text_file(file_path, items, error);
+    long long size, stamp;
+    base_bytes = file_signature(file_path, size, stamp) ? size : 0;
+    journal_bytes = replay_journal(journal_path, items);
+
+    order.reset(items);
+    return loaded && !items.empty();
+  }
+
+  bool prepare(const std::vector<TodoItem> &items, const ChangeSet *changes,
+               std::string &error) override {
+    compacting = !changes || journal_bytes > base_bytes ||
+                 !order.apply(items, *changes, ops);
+    if (compacting) {
+      // Rewrite the base file; publish() empties the journal
+      order.reset(items);
+      if (!TextStorage::prepare(items, changes, error)) {
+        order.invalidate();
+        return false;
+      }
+      return true;
+    }
+
+    records = journal_records(items, ops);
+    return true;
+  }
+
+  bool publish(std::string &error) override {
+    if (compacting) {
+      if (!TextStorage::publish(error)) {
+        order.invalidate();
+        return false;
+      }
+      long long size, stamp;
+      base_bytes = file_signature(file_path, size, stamp) ? size : 0;
+      journal_bytes = 0;
+      return true;
+    }
+
+    std::ofstream journal(journal_path, std::ios::app);
+    if (!journal.is_open()) {
+      order.invalidate();
+      error = "Failed to save file: " + journal_path;
+      return false;
+    }
+    journal.write(records.data(), records.size());
+    journal.close();
+    written += records.size();
+    journal_bytes += records.size();
+    if (journal.fail()) {
+      order.invalidate(); // Next save rewrites the base
+      error = "Error saving file: " + journal_path;
+      return false;
+    }
+    return true;
+  }
+
+  void discard() override {
+    if (compacting) {
+      TextStorage::discard();
+    }
+    order.invalidate();
+  }
+
+  // Records go on the end of the other process's journal
+  bool follow(const std::vector<TodoItem> &stored) override {
+    long long size, stamp;
+    base_bytes = file_signature(file_path, size, stamp) ? size : 0;
+    journal_bytes = file_signature(journal_path, size, stamp) ? size : 0;
+    order.reset(stored);
+    return true;
+  }
+
+private:
+  std::string journal_path;
+  long long base_bytes;
+  long long journal_bytes;
+  StoredOrder order;
+  std::vector<StorageOp> ops;
+  bool compacting;     // The prepared save rewrites the base file
+  std::string records; // The prepared save's journal records
+};
+
+// Keeps the list in memory only; for tests and benchmarks
+class MemoryStorage : public StorageBackend {
+public:
+  const char *name() const override { return "memory"; }
+  std::string path() const override { return "(memory)"; }
+
+  bool signature(long long &, long long &) const override { return false; }
+
+protected:
+  bool read(std::vector<TodoItem> &items, std::string &) override {
+    items.clear();
+    for (const TodoItem &item : stored) {
+      items.push_back(TodoItem(item.text));
+      items.back().completed = item.completed;
+      items.back().notes_hash = item.notes_hash;
+    }
+    return !items.empty();
+  }
+
+  bool prepare(const std::vector<TodoItem> &items, const ChangeSet *,
+               std::string &) override {
+    stored = items;
+    return true;
+  }
+
+  bool publish(std::string &) override { return true; }
+
+  bool shared() const override { return false; }
+
+private:
+  std::vector<TodoItem> stored;
+};
+
+// Little-endian integers inside a page
+static void store_u16(unsigned char *p, unsigned value) {
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+}
+
+static void store_u32(unsigned char *p, unsigned value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (value >> (i * 8)) & 0xff;
+  }
+}
+
+static unsigned load_u16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+
+static unsigned load_u32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+// Flush a file all the way to disk
+static bool sync_file(FILE *file) {
+  if (fflush(file) != 0)
+    return false;
+#ifndef _WIN32
+  metrics.fsyncs.fetch_add(1, std::memory_order_relaxed);
+  return fsync(fileno(file)) == 0;
+#else
+  return true;
+#endif
+}
+
+// A file of fixed-size pages read through a small LRU buffer pool. Changes
+// stay in the pool until they are logged and committed: log() writes them
+// to a log of this process's own and flushes it, and commit() renames that
+// over "<file>.wal" before writing the pages in place, so a crash leaves
+// either all of them or none. The pages reach the disk in settle(), before
+// the next commit replaces the log that can restore them.
+class PageFile {
+public:
+  enum { PAGE_SIZE = 4096 };
+  typedef std::vector<unsigned char> Page;
+
+  explicit PageFile(size_t pool_pages)
+      : file(nullptr), capacity(pool_pages), pages(0), dirty_pages(0),
+        tick(0), written(0), logged_count(0), unsettled(false) {}
+  ~PageFile() { close(); }
+
+  bool open(const std::string &file_path, std::string &error) {
+    close();
+    path = file_path;
+    file = fopen(path.c_str(), "r+b");
+    if (!file) {
+      file = fopen(path.c_str(), "w+b");
+    }
+    if (!file) {
+      error = "Failed to open file: " + path;
+      return false;
+    }
+    if (!recover()) {
+      error = "Error reading file: " + path + ".wal";
+      close();
+      return false;
+    }
+    count_pages();
+    return true;
+  }
+
+  void close() {
+    if (file) {
+      fclose(file);
+      file = nullptr;
+    }
+    frames.clear();
+    pages = 0;
+    dirty_pages = 0;
+    drop_log();
+    unsettled = false; // The log stays to restore the pages if need be
+  }
+
+  bool is_open() const { return file != nullptr; }
+  unsigned page_count() const { return pages; }
+  unsigned long long bytes_written() const { return written; }
+
+  const Page &read(unsigned page_no) {
+    std::map<unsigned, Frame>::iterator it = frames.find(page_no);
+    if (it == frames.end()) {
+      evict();
+      Frame &frame = frames[page_no];
+      frame.data.assign(PAGE_SIZE, 0);
+      frame.dirty = false;
+      // A short read (past the end of the file) leaves the page zeroed
+      fseek(file, (long)page_no * PAGE_SIZE, SEEK_SET);
+      if (fread(&frame.data[0], 1, PAGE_SIZE, file) != PAGE_SIZE) {
+        clearerr(file);
+      }
+      it = frames.find(page_no);
+    }
+    it->second.used = ++tick;
+    return it->second.data;
+  }
+
+  void write(unsigned page_no, const Page &data) {
+    if (frames.find(page_no) == frames.end()) {
+      evict();
+    }
+    Frame &frame = frames[page_no];
+    if (!frame.dirty) {
+      dirty_pages++;
+    }
+    frame.data = data;
+    frame.dirty = true;
+    frame.used = ++tick;
+  }
+
+  // A new zeroed page at the end of the file
+  unsigned append() {
+    unsigned page_no = pages++;
+    write(page_no, Page(PAGE_SIZE, 0));
+    return page_no;
+  }
+
+  // Log the dirty pages: <page number, page> records, then "CMIT", count
+  // and checksum. Both fsyncs of a commit happen outside commit().
+  bool log(std::string &error) {
+    drop_log();
+    for (std::map<unsigned, Frame>::iterator it = frames.begin();
+         it != frames.end(); ++it) {
+      if (!it->second.dirty)
+        continue;
+      unsigned char number[4];
+      store_u32(number, it->first);
+      logged.append((const char *)number, 4);
+      logged.append((const char *)&it->second.data[0], PAGE_SIZE);
+      logged_count++;
+    }
+    if (logged_count == 0)
+      return true;
+    append_trailer(logged, logged_count);
+
+    std::string log_path = temp_path(path + ".wal");
+    FILE *wal = fopen(log_path.c_str(), "wb");
+    bool ok = wal &&
+              fwrite(logged.data(), 1, logged.size(), wal) == logged.size() &&
+              sync_file(wal);
+    if (wal)
+      fclose(wal);
+    if (!ok) {
+      drop_log();
+      error = "Error saving file: " + log_path;
+      return false;
+    }
+    return true;
+  }
+
+  // Make the logged pages the file's: a rename and page writes that go no
+  // further than the operating system
+  bool commit(std::string &error) {
+    if (logged_count == 0)
+      return true;
+    if (!replace_file(temp_path(path + ".wal"), path + ".wal")) {
+      drop_log();
+      error = "Error saving file: " + path + ".wal";
+      return false;
+    }
+    unsettled = true;
+    if (!apply_log(logged, logged_count)) {
+      // The log is in place, so the next open() finishes the job
+      error = "Error saving file: " + path;
+      return false;
+    }
+
+    for (std::map<unsigned, Frame>::iterator it = frames.begin();
+         it != frames.end(); ++it) {
+      it->second.dirty = false;
+    }
+    dirty_pages = 0;
+    written += logged.size() + (unsigned long long)logged_count * PAGE_SIZE;
+    logged.clear();
+    logged_count = 0;
+    return true;
+  }
+
+  // Flush the pages of the last commit to disk
+  bool settle() {
+    if (unsettled && sync_file(file))
+      unsettled = false;
+    return !unsettled;
+  }
+
+  // Drop uncommitted changes
+  void rollback() {
+    drop_log();
+    for (std::map<unsigned, Frame>::iterator it = frames.begin();
+         it != frames.end();) {
+      if (it->second.dirty) {
+        frames.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+    dirty_pages = 0;
+    count_pages();
+  }
+
+private:
+  struct Frame {
+    Page data;
+    bool dirty;
+    unsigned long long used;
+  };
+
+  // Forget a log that was not committed
+  void drop_log() {
+    if (logged_count > 0)
+      remove(temp_path(path + ".wal").c_str());
+    logged.clear();
+    logged_count = 0;
+  }
+
+  void count_pages() {
+    fseek(file, 0, SEEK_END);
+    pages = (unsigned)(ftell(file) / PAGE_SIZE);
+  }
+
+  // Make room for one more page. Dirty pages are never evicted, so the pool
+  // may grow past its capacity until the next commit.
+  void evict() {
+    while (frames.size() >= capacity && frames.size() > dirty_pages) {
+      std::map<unsigned, Frame>::iterator victim = frames.end();
+      for (std::map<unsigned, Frame>::iterator it = frames.begin();
+           it != frames.end(); ++it) {
+        if (!it->second.dirty &&
+            (victim == frames.end() || it->second.used < victim->second.used))
+          victim = it;
+      }
+      if (victim == frames.end())
+        return;
+      frames.erase(victim);
+    }
+  }
+
+  static unsigned checksum(const char *data, size_t size) {
+    unsigned hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+  static void append_trailer(std::string &log, unsigned count) {
+    unsigned char trailer[12];
+    memcpy(trailer, "CMIT", 4);
+    store_u32(trailer + 4, count);
+    store_u32(trailer + 8, checksum(log.data(), log.size()));
+    log.append((const char *)trailer, 12);
+  }
+
+  bool apply_log(const std::string &log, unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+      const char *record = log.data() + (size_t)i * (4 + PAGE_SIZE);
+      unsigned page_no = load_u32((const unsigned char *)record);
+      fseek(file, (long)page_no * PAGE_SIZE, SEEK_SET);
+      if (fwrite(record + 4, 1, PAGE_SIZE, file) != PAGE_SIZE)
+        return false;
+    }
+    return fflush(file) == 0;
+  }
+
+  // Whether the file already holds every page of the log
+  bool log_applied(const std::string &log, unsigned count) {
+    Page page(PAGE_SIZE);
+    for (unsigned i = 0; i < count; i++) {
+      const char *record = log.data() + (size_t)i * (4 + PAGE_SIZE);
+      fseek(file, (long)load_u32((const unsigned char *)record) * PAGE_SIZE,
+            SEEK_SET);
+      if (fread(&page[0], 1, PAGE_SIZE, file) != PAGE_SIZE) {
+        clearerr(file);
+        return false;
+      }
+      if (memcmp(&page[0], record + 4, PAGE_SIZE) != 0)
+        return false;
+    }
+    return true;
+  }
+
+  void truncate_log() {
+    FILE *wal = fopen((path + ".wal").c_str(), "wb");
+    if (wal)
+      fclose(wal);
+  }
+
+  // Finish the last commit if its pages didn't all reach the file. The log
+  // is kept: only the next commit replaces it, once settle() made these
+  // pages safe. A torn log (from older versions, which wrote it in place)
+  // belongs to a commit that never happened and is discarded.
+  bool recover() {
+    std::ifstream wal(path + ".wal", std::ios::binary);
+    if (!wal.is_open())
+      return true;
+    std::string log((std::istreambuf_iterator<char>(wal)),
+                    std::istreambuf_iterator<char>());
+    wal.close();
+    if (log.empty())
+      return true;
+
+    if (log.size() >= 12) {
+      const unsigned char *trailer =
+          (const unsigned char *)log.data() + log.size() - 12;
+      unsigned count = load_u32(trailer + 4);
+      if (memcmp(trailer, "CMIT", 4) == 0 &&
+          log.size() == (size_t)count * (4 + PAGE_SIZE) + 12 &&
+          load_u32(trailer + 8) == checksum(log.data(), log.size() - 12)) {
+        // Pages in the operating system's cache count: they reach the
+        // disk unless it goes down, and then they are no longer there
+        if (log_applied(log, count))
+          return true;
+        return apply_log(log, count) && sync_file(file);
+      }
+    }
+    truncate_log();
+    return true;
+  }
+
+  std::string path;
+  FILE *file;
+  size_t capacity;
+  unsigned pages;
+  size_t dirty_pages;
+  unsigned long long tick;
+  unsigned long long written;
+  std::map<unsigned, Frame> frames;
+  std::string logged;    // Written by log(), not committed yet
+  unsigned logged_count; // Pages in it
+  bool unsettled;        // Pages of the last commit not flushed yet
+};
+
+// Items in a B+tree of PageFile pages, keyed by list position: leaves hold
+// items in order and internal nodes hold the item count below each child,
+// so reaching position i reads one page per level. They count the open
+// items too, so the i-th open or completed item is reached the same way.
+// Opening reads only the header page.
+//
+// Page 0: "CLRT", version, root page, height, item count, free list head,
+// open item count.
+// Leaf: type 1, count, then per item a flags byte (completed, overflow,
+// has notes) and a 16-bit length with the text, or the first page and
+// length of an overflow chain for long texts, followed by the notes hash if
+// any. Internal: type 2, count, then a child page, subtree item count and
+// subtree open item count per child. Version 1 files have no notes;
+// version 1 and 2 files have no open counts and are only read.
+class PagedTree {
+public:
+  PagedTree()
+      : pool(64), bulk(nullptr), bulk_pages(0), format(VERSION), root(0),
+        height(0), item_count(0), free_head(0), open_count(0) {}
+
+  bool open(const std::string &path, std::string &error) {
+    if (!pool.open(path, error))
+      return false;
+    if (pool.page_count() == 0) {
+      // New file: a header and an empty root leaf
+      pool.append();
+      root = pool.append();
+      height = item_count = free_head = open_count = 0;
+      format = VERSION;
+      Node leaf;
+      put(root, encode(leaf));
+      write_header();
+      return pool.log(error) && pool.commit(error);
+    }
+    const PageFile::Page &header = pool.read(0);
+    if (memcmp(&header[0], "CLRT", 4) != 0 || load_u32(&header[4]) < 1 ||
+        load_u32(&header[4]) > VERSION) {
+      error = "Error reading file: " + path;
+      pool.close();
+      return false;
+    }
+    read_header();
+    return true;
+  }
+
+  void close() { pool.close(); }
+  bool is_open() const { return pool.is_open(); }
+  unsigned size() const { return item_count; }
+  unsigned long long bytes_written() const { return pool.bytes_written(); }
+
+  // Files older than this are read, but edits rebuild them
+  bool current() const { return format == VERSION; }
+
+  // Items not completed; only known for current() files
+  unsigned open_size() const { return open_count; }
+
+  // Append items [first, first + count) of subset to out: the first item
+  // of OPEN_ITEMS is the first open item. Only current() files count
+  // their open items.
+  void fetch(unsigned first, unsigned count, std::vector<TodoItem> &out,
+             ItemSubset subset = ALL_ITEMS) {
+    unsigned total = (subset == ALL_ITEMS)    ? item_count
+                     : (subset == OPEN_ITEMS) ? open_count
+                                              : item_count - open_count;
+    if (first >= total || (subset != ALL_ITEMS && !current()))
+      return;
+    count = std::min(count, total - first);
+    fetch_range(root, height, first, count, subset, out);
+  }
+
+  void insert(unsigned index, const TodoItem &item) {
+    std::vector<PathStep> path;
+    unsigned pos;
+    unsigned leaf_page = descend(std::min(index, item_count), true, path, pos);
+    Node leaf = decode(leaf_page);
+    pos = std::min<unsigned>(pos, leaf.entries.size());
+    leaf.entries.insert(leaf.entries.begin() + pos, make_entry(item));
+    item_count++;
+    open_count += item.completed ? 0 : 1;
+    store(path, leaf, leaf_page);
+  }
+
+  void remove(unsigned index) {
+    if (index >= item_count)
+      return;
+    std::vector<PathStep> path;
+    unsigned pos;
+    unsigned leaf_page = descend(index, false, path, pos);
+    Node leaf = decode(leaf_page);
+    if (pos >= leaf.entries.size())
+      return;
+    free_entry(leaf.entries[pos]);
+    open_count -= leaf.entries[pos].completed ? 0 : 1;
+    leaf.entries.erase(leaf.entries.begin() + pos);
+    item_count--;
+    store(path, leaf, leaf_page);
+  }
+
+  void set(unsigned index, const TodoItem &item) {
+    if (index >= item_count)
+      return;
+    std::vector<PathStep> path;
+    unsigned pos;
+    unsigned leaf_page = descend(index, false, path, pos);
+    Node leaf = decode(leaf_page);
+    if (pos >= leaf.entries.size())
+      return;
+    free_entry(leaf.entries[pos]);
+    open_count += (leaf.entries[pos].completed ? 1 : 0) -
+                  (item.completed ? 1 : 0);
+    leaf.entries[pos] = make_entry(item);
+    store(path, leaf, leaf_page);
+  }
+
+  // Outside the version lock: the header and every changed page go to the
+  // log and are flushed to disk
+  bool prepare_commit(std::string &error) {
+    write_header();
+    return pool.log(error);
+  }
+
+  // Under the lock; see PageFile::commit()
+  bool commit(std::string &error) { return pool.commit(error); }
+
+  // Flush the last commit's pages, before the next one replaces its log
+  bool settle() { return pool.settle(); }
+
+  void rollback() {
+    pool.rollback();
+    if (pool.page_count() > 0) {
+      read_header();
+    }
+  }
+
+  // Write items to path as a new, densely packed tree. The pages go
+  // straight to the file; callers rename it into place.
+  static bool build(const std::string &path, const std::vector<TodoItem> &items,
+                    std::string &error) {
+    PagedTree tree;
+    tree.bulk = fopen(path.c_str(), "wb");
+    if (!tree.bulk) {
+      error = "Failed to save file: " + path;
+      return false;
+    }
+    tree.bulk_pages = 1; // Page 0 is the header, written last
+
+    // Fill leaves in order, then stack internal levels on top. level holds
+    // the nodes of one level as the children of a node above them.
+    Node level, leaf;
+    level.leaf = false;
+    for (const TodoItem &item : items) {
+      Entry entry = tree.make_entry(item);
+      if (!leaf.entries.empty() &&
+          leaf.encoded_size() + entry_size(entry) > PageFile::PAGE_SIZE) {
+        tree.add_child(level, leaf);
+        leaf.entries.clear();
+      }
+      leaf.entries.push_back(entry);
+    }
+    tree.add_child(level, leaf);
+
+    tree.height = 0;
+    while (level.children.size() > 1) {
+      Node parents;
+      parents.leaf = false;
+      for (size_t i = 0; i < level.children.size(); i += MAX_CHILDREN) {
+        Node node;
+        node.leaf = false;
+        size_t end = std::min<size_t>(level.children.size(), i + MAX_CHILDREN);
+        node.children.assign(level.children.begin() + i,
+                             level.children.begin() + end);
+        node.counts.assign(level.counts.begin() + i,
+                           level.counts.begin() + end);
+        node.opens.assign(level.opens.begin() + i, level.opens.begin() + end);
+        tree.add_child(parents, node);
+      }
+      level = parents;
+      tree.height++;
+    }
+    tree.root = level.children[0];
+    tree.item_count = level.counts[0];
+    tree.open_count = level.opens[0];
+    tree.write_header();
+
+    bool ok = !ferror(tree.bulk) && sync_file(tree.bulk);
+    fclose(tree.bulk);
+    tree.bulk = nullptr;
+    if (!ok) {
+      error = "Error saving file: " + path;
+    }
+    return ok;
+  }
+
+private:
+  enum {
+    VERSION = 3,
+    INLINE_TEXT = 1024, // Longer texts go to overflow pages
+    MAX_CHILDREN = (PageFile::PAGE_SIZE - 4) / 12,
+    OVERFLOW_DATA = PageFile::PAGE_SIZE - 8
+  };
+
+  struct Entry {
+    bool completed;
+    std::string text;  // Inline text
+    unsigned overflow; // First overflow page, 0 for inline text
+    unsigned length;   // Text length
+    std::string notes_hash;
+  };
+
+  struct Node {
+    bool leaf;
+    std::vector<Entry> entries;     // Leaf
+    std::vector<unsigned> children; // Internal
+    std::vector<unsigned> counts;   // Items below each child
+    std::vector<unsigned> opens;    // Open items below each child
+
+    Node() : leaf(true) {}
+
+    unsigned total() const {
+      if (leaf)
+        return entries.size();
+      unsigned sum = 0;
+      for (unsigned count : counts) {
+        sum += count;
+      }
+      return sum;
+    }
+
+    unsigned open_total() const {
+      unsigned sum = 0;
+      if (leaf) {
+        for (const Entry &entry : entries) {
+          sum += entry.completed ? 0 : 1;
+        }
+        return sum;
+      }
+      for (unsigned open : opens) {
+        sum += open;
+      }
+      return sum;
+    }
+
+    // Items of subset below child i
+    unsigned below(size_t i, ItemSubset subset) const {
+      return (subset == ALL_ITEMS)    ? counts[i]
+             : (subset == OPEN_ITEMS) ? opens[i]
+                                      : counts[i] - opens[i];
+    }
+
+    bool empty() const { return leaf ? entries.empty() : children.empty(); }
+
+    size_t encoded_size() const {
+      if (!leaf)
+        return 4 + 12 * children.size();
+      size_t size = 4;
+      for (const Entry &entry : entries) {
+        size += entry_size(entry);
+      }
+      return size;
+    }
+  };
+
+  // An internal node passed on the way down, and the child taken
+  struct PathStep {
+    unsigned page;
+    size_t slot;
+
+    PathStep(unsigned p, size_t s) : page(p), slot(s) {}
+  };
+
+  static size_t entry_size(const Entry &entry) {
+    return (entry.overflow ? 11 : 3 + entry.text.size()) +
+           entry.notes_hash.size();
+  }
+
+  static PageFile::Page encode(const Node &node) {
+    PageFile::Page page(PageFile::PAGE_SIZE, 0);
+    unsigned char *p = &page[0];
+    p[0] = node.leaf ? 1 : 2;
+    if (!node.leaf) {
+      store_u16(p + 2, node.children.size());
+      for (size_t i = 0; i < node.children.size(); i++) {
+        store_u32(p + 4 + i * 12, node.children[i]);
+        store_u32(p + 8 + i * 12, node.counts[i]);
+        store_u32(p + 12 + i * 12, node.opens[i]);
+      }
+      return page;
+    }
+    store_u16(p + 2, node.entries.size());
+    size_t pos = 4;
+    for (const Entry &entry : node.entries) {
+      p[pos] = (entry.completed ? 1 : 0) | (entry.overflow ? 2 : 0) |
+               (entry.notes_hash.empty() ? 0 : 4);
+      size_t notes = pos + entry_size(entry) - entry.notes_hash.size();
+      if (entry.overflow) {
+        store_u16(p + pos + 1, 0);
+        store_u32(p + pos + 3, entry.overflow);
+        store_u32(p + pos + 7, entry.length);
+      } else {
+        store_u16(p + pos + 1, entry.text.size());
+        memcpy(p + pos + 3, entry.text.data(), entry.text.size());
+      }
+      memcpy(p + notes, entry.notes_hash.data(), entry.notes_hash.size());
+      pos += entry_size(entry);
+    }
+    return page;
+  }
+
+  Node decode(unsigned page_no) {
+    const PageFile::Page &page = read(page_no);
+    const unsigned char *p = &page[0];
+    Node node;
+    node.leaf = (p[0] != 2);
+    unsigned count = load_u16(p + 2);
+    if (!node.leaf) {
+      // Older files have no open counts; they are never written back
+      unsigned stride = current() ? 12 : 8;
+      count = std::min<unsigned>(count, (PageFile::PAGE_SIZE - 4) / stride);
+      for (unsigned i = 0; i < count; i++) {
+        node.children.push_back(load_u32(p + 4 + i * stride));
+        node.counts.push_back(load_u32(p + 8 + i * stride));
+        node.opens.push_back(current() ? load_u32(p + 12 + i * stride) : 0);
+      }
+      return node;
+    }
+    // Stop at a record that would run off the page
+    size_t pos = 4;
+    for (unsigned i = 0; i < count && pos + 3 <= page.size(); i++) {
+      Entry entry;
+      entry.completed = (p[pos] & 1) != 0;
+      entry.overflow = 0;
+      if (p[pos] & 2) {
+        if (pos + 11 > page.size())
+          break;
+        entry.overflow = load_u32(p + pos + 3);
+        entry.length = load_u32(p + pos + 7);
+      } else {
+        entry.length = load_u16(p + pos + 1);
+        if (pos + 3 + entry.length > page.size())
+          break;
+        entry.text.assign((const char *)p + pos + 3, entry.length);
+      }
+      if (p[pos] & 4) {
+        size_t notes = pos + entry_size(entry);
+        if (notes + 64 > page.size())
+          break;
+        entry.notes_hash.assign((const char *)p + notes, 64);
+      }
+      node.entries.push_back(entry);
+      pos += entry_size(entry);
+    }
+    return node;
+  }
+
+  const PageFile::Page &read(unsigned page_no) { return pool.read(page_no); }
+
+  void put(unsigned page_no, const PageFile::Page &page) {
+    if (bulk) {
+      fseek(bulk, (long)page_no * PageFile::PAGE_SIZE, SEEK_SET);
+      fwrite(&page[0], 1, page.size(), bulk);
+    } else {
+      pool.write(page_no, page);
+    }
+  }
+
+  unsigned allocate() {
+    if (bulk)
+      return bulk_pages++;
+    if (free_head) {
+      unsigned page_no = free_head;
+      free_head = load_u32(&read(page_no)[4]);
+      return page_no;
+    }
+    return pool.append();
+  }
+
+  void release(unsigned page_no) {
+    PageFile::Page page(PageFile::PAGE_SIZE, 0);
+    store_u32(&page[4], free_head);
+    put(page_no, page);
+    free_head = page_no;
+  }
+
+  void read_header() {
+    const PageFile::Page &header = pool.read(0);
+    format = load_u32(&header[4]);
+    root = load_u32(&header[8]);
+    height = load_u32(&header[12]);
+    item_count = load_u32(&header[16]);
+    free_head = load_u32(&header[20]);
+    open_count = current() ? load_u32(&header[24]) : 0;
+  }
+
+  void write_header() {
+    PageFile::Page header(PageFile::PAGE_SIZE, 0);
+    memcpy(&header[0], "CLRT", 4);
+    store_u32(&header[4], VERSION);
+    store_u32(&header[8], root);
+    store_u32(&header[12], height);
+    store_u32(&header[16], item_count);
+    store_u32(&header[20], free_head);
+    store_u32(&header[24], open_count);
+    put(0, header);
+  }
+
+  // Write node to a new page and add it as the last child of parent
+  void add_child(Node &parent, const Node &node) {
+    parent.children.push_back(allocate());
+    parent.counts.push_back(node.total());
+    parent.opens.push_back(node.open_total());
+    put(parent.children.back(), encode(node));
+  }
+
+  Entry make_entry(const TodoItem &item) {
+    Entry entry;
+    entry.completed = item.completed;
+    entry.length = item.text.size();
+    entry.overflow = 0;
+    entry.notes_hash = item.notes_hash;
+    if (item.text.size() <= INLINE_TEXT) {
+      entry.text = item.text;
+      return entry;
+    }
+
+    // Overflow page: type 3, used bytes, next page, then text
+    std::vector<unsigned> chain;
+    for (size_t done = 0; done < item.text.size(); done += OVERFLOW_DATA) {
+      chain.push_back(allocate());
+    }
+    for (size_t i = 0; i < chain.size(); i++) {
+      size_t start = i * OVERFLOW_DATA;
+      size_t used = std::min<size_t>(OVERFLOW_DATA, item.text.size() - start);
+      PageFile::Page page(PageFile::PAGE_SIZE, 0);
+      page[0] = 3;
+      store_u16(&page[2], used);
+      store_u32(&page[4], i + 1 < chain.size() ? chain[i + 1] : 0);
+      memcpy(&page[8], item.text.data() + start, used);
+      put(chain[i], page);
+    }
+    entry.overflow = chain[0];
+    return entry;
+  }
+
+  std::string entry_text(const Entry &entry) {
+    if (!entry.overflow)
+      return entry.text;
+    std::string text;
+    for (unsigned page_no = entry.overflow;
+         page_no && text.size() < entry.length;) {
+      const PageFile::Page &page = read(page_no);
+      size_t used = std::min<size_t>(load_u16(&page[2]), OVERFLOW_DATA);
+      text.append((const char *)&page[8], used);
+      page_no = load_u32(&page[4]);
+    }
+    return text;
+  }
+
+  void free_entry(const Entry &entry) {
+    size_t remaining = entry.overflow ? entry.length : 0;
+    for (unsigned page_no = entry.overflow; page_no && remaining > 0;) {
+      unsigned next = load_u32(&read(page_no)[4]);
+      release(page_no);
+      remaining -= std::min<size_t>(remaining, OVERFLOW_DATA);
+      page_no = next;
+    }
+  }
+
+  // Find the leaf holding position index (or, for inserts, where it goes),
+  // recording the internal nodes passed
+  unsigned descend(unsigned index, bool for_insert,
+                   std::vector<PathStep> &path, unsigned &pos) {
+    unsigned page_no = root;
+    for (unsigned level = height; level > 0; level--) {
+      Node node = decode(page_no);
+      if (node.children.empty())
+        break;
+      size_t slot = 0;
+      while (slot + 1 < node.children.size() &&
+             (for_insert ? index > node.counts[slot]
+                         : index >= node.counts[slot])) {
+        index -= node.counts[slot];
+        slot++;
+      }
+      path.push_back(PathStep(page_no, slot));
+      page_no = node.children[slot];
+    }
+    pos = index;
+    return page_no;
+  }
+
+  // Write a changed node back, splitting it if it no longer fits and
+  // dropping it if it is empty, then fix up the counts of its ancestors
+  void store(std::vector<PathStep> &path, Node node, unsigned page_no) {
+    for (;;) {
+      bool empty = node.empty();
+      std::vector<Node> pieces;
+      if (empty && !path.empty()) {
+        release(page_no);
+      } else {
+        if (empty && !node.leaf) {
+          // The list is empty; the root becomes an empty leaf again
+          node.leaf = true;
+          height = 0;
+        }
+        split(node, pieces);
+      }
+      std::vector<unsigned> pages;
+      for (size_t i = 0; i < pieces.size(); i++) {
+        pages.push_back(i == 0 ? page_no : allocate());
+        put(pages[i], encode(pieces[i]));
+      }
+
+      if (path.empty()) {
+        if (pieces.size() > 1) {
+          Node top;
+          top.leaf = false;
+          for (size_t i = 0; i < pieces.size(); i++) {
+            top.children.push_back(pages[i]);
+            top.counts.push_back(pieces[i].total());
+            top.opens.push_back(pieces[i].open_total());
+          }
+          root = allocate();
+          put(root, encode(top));
+          height++;
+        }
+        // Drop roots left with a single child
+        while (height > 0) {
+          Node top = decode(root);
+          if (top.children.size() != 1)
+            break;
+          release(root);
+          root = top.children[0];
+          height--;
+        }
+        return;
+      }
+
+      PathStep step = path.back();
+      path.pop_back();
+      Node parent = decode(step.page);
+      if (empty) {
+        parent.children.erase(parent.children.begin() + step.slot);
+        parent.counts.erase(parent.counts.begin() + step.slot);
+        parent.opens.erase(parent.opens.begin() + step.slot);
+      } else {
+        bool underfull = pieces.size() == 1 &&
+                         pieces[0].encoded_size() < PageFile::PAGE_SIZE / 4;
+        if (pieces.size() == 1 && !underfull &&
+            parent.counts[step.slot] == pieces[0].total() &&
+            parent.opens[step.slot] == pieces[0].open_total())
+          return; // Nothing above changes
+        parent.counts[step.slot] = pieces[0].total();
+        parent.opens[step.slot] = pieces[0].open_total();
+        for (size_t i = 1; i < pieces.size(); i++) {
+          parent.children.insert(parent.children.begin() + step.slot + i,
+                                 pages[i]);
+          parent.counts.insert(parent.counts.begin() + step.slot + i,
+                               pieces[i].total());
+          parent.opens.insert(parent.opens.begin() + step.slot + i,
+                              pieces[i].open_total());
+        }
+        if (underfull) {
+          merge_with_neighbour(parent, step.slot, pieces[0]);
+        }
+      }
+      node = parent;
+      page_no = step.page;
+    }
+  }
+
+  // Fold a node that is under a quarter full (child slot of parent) into
+  // a neighbour when both fit in one page, so that deletes do not leave
+  // sparse pages behind
+  void merge_with_neighbour(Node &parent, size_t slot, const Node &node) {
+    if (parent.children.size() < 2)
+      return;
+    size_t left = (slot + 1 < parent.children.size()) ? slot : slot - 1;
+    Node merged = (left == slot) ? node : decode(parent.children[left]);
+    Node right = (left == slot) ? decode(parent.children[left + 1]) : node;
+    if (merged.leaf) {
+      merged.entries.insert(merged.entries.end(), right.entries.begin(),
+                            right.entries.end());
+    } else {
+      merged.children.insert(merged.children.end(), right.children.begin(),
+                             right.children.end());
+      merged.counts.insert(merged.counts.end(), right.counts.begin(),
+                           right.counts.end());
+      merged.opens.insert(merged.opens.end(), right.opens.begin(),
+                          right.opens.end());
+    }
+    if (merged.encoded_size() > PageFile::PAGE_SIZE)
+      return;
+    put(parent.children[left], encode(merged));
+    release(parent.children[left + 1]);
+    parent.counts[left] = merged.total();
+    parent.opens[left] = merged.open_total();
+    parent.children.erase(parent.children.begin() + left + 1);
+    parent.counts.erase(parent.counts.begin() + left + 1);
+    parent.opens.erase(parent.opens.begin() + left + 1);
+  }
+
+  // One node if it fits in a page, otherwise two halves
+  static void split(const Node &node, std::vector<Node> &pieces) {
+    if (node.encoded_size() <= PageFile::PAGE_SIZE) {
+      pieces.push_back(node);
+      return;
+    }
+    pieces.resize(2);
+    pieces[0].leaf = pieces[1].leaf = node.leaf;
+    if (!node.leaf) {
+      size_t half = node.children.size() / 2;
+      pieces[0].children.assign(node.children.begin(),
+                                node.children.begin() + half);
+      pieces[0].counts.assign(node.counts.begin(), node.counts.begin() + half);
+      pieces[0].opens.assign(node.opens.begin(), node.opens.begin() + half);
+      pieces[1].children.assign(node.children.begin() + half,
+                                node.children.end());
+      pieces[1].counts.assign(node.counts.begin() + half, node.counts.end());
+      pieces[1].opens.assign(node.opens.begin() + half, node.opens.end());
+      return;
+    }
+    size_t half = node.encoded_size() / 2, size = 4, i = 0;
+    while (i + 1 < node.entries.size() && size < half) {
+      size += entry_size(node.entries[i++]);
+    }
+    pieces[0].entries.assign(node.entries.begin(), node.entries.begin() + i);
+    pieces[1].entries.assign(node.entries.begin() + i, node.entries.end());
+  }
+
+  void fetch_range(unsigned page_no, unsigned level, unsigned first,
+                   unsigned count, ItemSubset subset,
+                   std::vector<TodoItem> &out) {
+    Node node = decode(page_no);
+    if (level == 0) {
+      for (size_t i = 0; i < node.entries.size() && count > 0; i++) {
+        const Entry &entry = node.entries[i];
+        if ((subset == OPEN_ITEMS && entry.completed) ||
+            (subset == COMPLETED_ITEMS && !entry.completed))
+          continue;
+        if (first > 0) {
+          first--;
+          continue;
+        }
+        out.push_back(TodoItem(entry_text(entry)));
+        out.back().completed = entry.completed;
+        out.back().notes_hash = entry.notes_hash;
+        count--;
+      }
+      return;
+    }
+    for (size_t i = 0; i < node.children.size() && count > 0; i++) {
+      unsigned below = node.below(i, subset);
+      if (first >= below) {
+        first -= below;
+        continue;
+      }
+      unsigned take = std::min(count, below - first);
+      fetch_range(node.children[i], level - 1, first, take, subset, out);
+      count -= take;
+      first = 0;
+    }
+  }
+
+  PageFile pool;
+  FILE *bulk; // Set while build() writes pages directly
+  unsigned bulk_pages;
+  unsigned format; // Version of the open file
+  unsigned root;
+  unsigned height; // Internal levels above the leaves
+  unsigned item_count;
+  unsigned free_head;  // First page of the free list, 0 if none
+  unsigned open_count; // Items not completed
+};
+
+// The list in a PagedTree file ("todos.db"). Edits touch only the pages on
+// the path to the changed items; anything else rebuilds the file. A
+// windowed read opens it by its header page and fetches a window of rows
+// through the tree, so the list view shows any part of the list without
+// loading it first.
+class PagedStorage : public StorageBackend {
+public:
+  explicit PagedStorage(const std::string &file)
+      : file_path(file), temp_file(temp_path(file)), rebuilding(false) {}
+
+  const char *name() const override { return "paged"; }
+  std::string path() const override { return file_path; }
+
+  void fetch_window(unsigned first, unsigned count, ItemSubset subset,
+                    std::vector<TodoItem> &out) override {
+    if (tree.is_open()) {
+      tree.fetch(first, count, out, subset);
+    }
+  }
+
+  bool signature(long long &size, long long &stamp) const override {
+    long long wal_size = 0, wal_stamp = 0;
+    if (!file_signature(file_path, size, stamp))
+      return false;
+    if (file_signature(file_path + ".wal", wal_size, wal_stamp)) {
+      size += wal_size;
+      stamp = mix_stamp(stamp, wal_stamp);
+    }
+    return true;
+  }
+
+protected:
+  bool read(std::vector<TodoItem> &items, std::string &error) override {
+    items.clear();
+    tree.close();
+    long long size, stamp;
+    if (!file_signature(file_path, size, stamp))
+      return false; // First run
+    if (!tree.open(file_path, error))
+      return false;
+    tree.fetch(0, tree.size(), items);
+    order.reset(items);
+    return !items.empty();
+  }
+
+  bool prepare(const std::vector<TodoItem> &items, const ChangeSet *changes,
+               std::string &error) override {
+    if (tree.is_open() && !tree.settle()) {
+      error = "Error saving file: " + file_path;
+      return false;
+    }
+    // Edits touching more than a few percent of the list are cheaper as a
+    // rebuild than page by page, and files of an older version are rebuilt
+    // too. Page edits are logged now, and publish() commits them.
+    rebuilding = !(changes && tree.is_open() && tree.current() &&
+                   order.apply(items, *changes, ops) &&
+                   ops.size() <= items.size() / 32 + 16);
+    if (!rebuilding) {
+      for (const StorageOp &op : ops) {
+        switch (op.kind) {
+        case StorageOp::INSERT:
+          tree.insert(op.index, items[op.index]);
+          break;
+        case StorageOp::REMOVE:
+          tree.remove(op.index);
+          break;
+        case StorageOp::SET:
+          tree.set(op.index, items[op.index]);
+          break;
+        }
+      }
+      if (!tree.prepare_commit(error)) {
+        tree.rollback();
+        order.invalidate();
+        return false;
+      }
+      return true;
+    }
+
+    // Build a new file beside the old one; publish() swaps it in
+    order.reset(items);
+    if (!PagedTree::build(temp_file, items, error)) {
+      remove(temp_file.c_str());
+      order.invalidate();
+      return false;
+    }
+    return true;
+  }
+
+  bool publish(std::string &error) override {
+    if (!rebuilding) {
+      // No fsync here: prepare() flushed the log, and the pages are
+      // flushed by the next prepare()
+      unsigned long long before = tree.bytes_written();
+      if (tree.commit(error)) {
+        written += tree.bytes_written() - before;
+        return true;
+      }
+      tree.rollback();
+      order.invalidate();
+      return false;
+    }
+
+    tree.close();
+    remove((file_path + ".wal").c_str());
+    if (!replace_file(temp_file, file_path)) {
+      order.invalidate();
+      error = "Error saving file: " + file_path;
+      return false;
+    }
+    long long size, stamp;
+    if (file_signature(file_path, size, stamp)) {
+      written += size;
+    }
+    if (!tree.open(file_path, error)) {
+      order.invalidate();
+      return false;
+    }
+    return true;
+  }
+
+  void discard() override {
+    if (rebuilding) {
+      remove(temp_file.c_str());
+    } else {
+      tree.rollback();
+    }
+    order.invalidate();
+  }
+
+  // Files without open counts can't be read a window at a time
+  bool open_stored(unsigned &count, unsigned &open) override {
+    std::string error;
+    tree.close();
+    long long size, stamp;
+    if (!file_signature(file_path, size, stamp) ||
+        !tree.open(file_path, error) || !tree.current()) {
+      tree.close();
+      return false;
+    }
+    count = tree.size();
+    open = tree.open_size();
+    return true;
+  }
+
+  // Opening reads the header page only
+  bool follow(const std::vector<TodoItem> &stored) override {
+    std::string error;
+    tree.close();
+    if (!tree.open(file_path, error) || !tree.current() ||
+        tree.size() != stored.size()) {
+      tree.close();
+      return false;
+    }
+    order.reset(stored);
+    return true;
+  }
+
+private:
+  std::string file_path;
+  std::string temp_file;
+  PagedTree tree;
+  StoredOrder order;
+  std::vector<StorageOp> ops;
+  bool rebuilding; // The prepared save replaces the whole file
+};
+
+// ChaCha20 stream cipher (RFC 8439). With SSE2, four 64-byte blocks are
+// computed at once, one state word of all four blocks per vector.
+class ChaCha20 {
+public:
+  ChaCha20(const unsigned char key[32], const unsigned char nonce[12],
+           unsigned counter) {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+      state[4 + i] = load_u32(key + i * 4);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; i++) {
+      state[13 + i] = load_u32(nonce + i * 4);
+    }
+  }
+
+  // XOR the keystream into data, continuing from the current block (a
+  // partial block's leftover keystream is not kept)
+  void apply(unsigned char *data, size_t size) {
+#if defined(__SSE2__)
+    for (; size >= 256; data += 256, size -= 256) {
+      blocks4(data);
+    }
+#endif
+    unsigned char stream[64];
+    while (size > 0) {
+      block(stream);
+      size_t n = std::min<size_t>(size, 64);
+      for (size_t i = 0; i < n; i++) {
+        data[i] ^= stream[i];
+      }
+      data += n;
+      size -= n;
+    }
+  }
+
+  // The next 64 bytes of keystream
+  void block(unsigned char out[64]) {
+    unsigned x[16];
+    memcpy(x, state, sizeof(x));
+    for (int round = 0; round < 10; round++) {
+      quarter_round(x, 0, 4, 8, 12);
+      quarter_round(x, 1, 5, 9, 13);
+      quarter_round(x, 2, 6, 10, 14);
+      quarter_round(x, 3, 7, 11, 15);
+      quarter_round(x, 0, 5, 10, 15);
+      quarter_round(x, 1, 6, 11, 12);
+      quarter_round(x, 2, 7, 8, 13);
+      quarter_round(x, 3, 4, 9, 14);
+    }
+    for (int i = 0; i < 16; i++) {
+      store_u32(out + i * 4, x[i] + state[i]);
+    }
+    state[12]++;
+  }
+
+private:
+  static unsigned rotate(unsigned v, int n) {
+    return (v << n) | (v >> (32 - n));
+  }
+
+  static void quarter_round(unsigned *x, int a, int b, int c, int d) {
+    x[a] += x[b];
+    x[d] = rotate(x[d] ^ x[a], 16);
+    x[c] += x[d];
+    x[b] = rotate(x[b] ^ x[c], 12);
+    x[a] += x[b];
+    x[d] = rotate(x[d] ^ x[a], 8);
+    x[c] += x[d];
+    x[b] = rotate(x[b] ^ x[c], 7);
+  }
+
+#if defined(__SSE2__)
+  static __m128i rotate4(__m128i v, int n) {
+    return _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n));
+  }
+
+  static void quarter_round4(__m128i *x, int a, int b, int c, int d) {
+    x[a] = _mm_add_epi32(x[a], x[b]);
+    x[d] = rotate4(_mm_xor_si128(x[d], x[a]), 16);
+    x[c] = _mm_add_epi32(x[c], x[d]);
+    x[b] = rotate4(_mm_xor_si128(x[b], x[c]), 12);
+    x[a] = _mm_add_epi32(x[a], x[b]);
+    x[d] = rotate4(_mm_xor_si128(x[d], x[a]), 8);
+    x[c] = _mm_add_epi32(x[c], x[d]);
+    x[b] = rotate4(_mm_xor_si128(x[b], x[c]), 7);
+  }
+
+  // XOR four blocks of keystream into data[0..255]
+  void blocks4(unsigned char *data) {
+    __m128i x[16], input[16];
+    for (int i = 0; i < 16; i++) {
+      input[i] = _mm_set1_epi32(state[i]);
+    }
+    input[12] = _mm_add_epi32(input[12], _mm_set_epi32(3, 2, 1, 0));
+    memcpy(x, input, sizeof(x));
+    for (int round = 0; round < 10; round++) {
+      quarter_round4(x, 0, 4, 8, 12);
+      quarter_round4(x, 1, 5, 9, 13);
+      quarter_round4(x, 2, 6, 10, 14);
+      quarter_round4(x, 3, 7, 11, 15);
+      quarter_round4(x, 0, 5, 10, 15);
+      quarter_round4(x, 1, 6, 11, 12);
+      quarter_round4(x, 2, 7, 8, 13);
+      quarter_round4(x, 3, 4, 9, 14);
+    }
+    // Transpose each group of four words from per-word to per-block order
+    for (int i = 0; i < 16; i += 4) {
+      __m128i a = _mm_add_epi32(x[i], input[i]);
+      __m128i b = _mm_add_epi32(x[i + 1], input[i + 1]);
+      __m128i c = _mm_add_epi32(x[i + 2], input[i + 2]);
+      __m128i d = _mm_add_epi32(x[i + 3], input[i + 3]);
+      __m128i ab_low = _mm_unpacklo_epi32(a, b);
+      __m128i cd_low = _mm_unpacklo_epi32(c, d);
+      __m128i ab_high = _mm_unpackhi_epi32(a, b);
+      __m128i cd_high = _mm_unpackhi_epi32(c, d);
+      __m128i words[4] = {_mm_unpacklo_epi64(ab_low, cd_low),
+                          _mm_unpackhi_epi64(ab_low, cd_low),
+                          _mm_unpacklo_epi64(ab_high, cd_high),
+                          _mm_unpackhi_epi64(ab_high, cd_high)};
+      for (int block = 0; block < 4; block++) {
+        __m128i *p = (__m128i *)(data + block * 64 + i * 4);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), words[block]));
+      }
+    }
+    state[12] += 4;
+  }
+#endif
+
+  unsigned state[16];
+};
+
+// Poly1305 one-time authenticator (RFC 8439), in 26-bit limbs
+class Poly1305 {
+public:
+  explicit Poly1305(const unsigned char key[32]) : leftover(0) {
+    r[0] = load_u32(key + 0) & 0x3ffffff;
+    r[1] = (load_u32(key + 3) >> 2) & 0x3ffff03;
+    r[2] = (load_u32(key + 6) >> 4) & 0x3ffc0ff;
+    r[3] = (load_u32(key + 9) >> 6) & 0x3f03fff;
+    r[4] = (load_u32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 5; i++) {
+      h[i] = 0;
+    }
+    for (int i = 0; i < 4; i++) {
+      pad[i] = load_u32(key + 16 + i * 4);
+    }
+  }
+
+  void update(const unsigned char *data, size_t size) {
+    if (leftover) {
+      size_t n = std::min(size, 16 - leftover);
+      memcpy(buffer + leftover, data, n);
+      leftover += n;
+      data += n;
+      size -= n;
+      if (leftover < 16)
+        return;
+      blocks(buffer, 16, 1 << 24);
+      leftover = 0;
+    }
+    size_t whole = size & ~(size_t)15;
+    blocks(data, whole, 1 << 24);
+    memcpy(buffer, data + whole, size - whole);
+    leftover = size - whole;
+  }
+
+  void finish(unsigned char tag[16]) {
+    if (leftover) {
+      buffer[leftover] = 1;
+      memset(buffer + leftover + 1, 0, 15 - leftover);
+      blocks(buffer, 16, 0);
+    }
+
+    // Fully carry h
+    const unsigned mask = 0x3ffffff;
+    unsigned c = h[1] >> 26;
+    h[1] &= mask;
+    for (int i = 2; i < 5; i++) {
+      h[i] += c;
+      c = h[i] >> 26;
+      h[i] &= mask;
+    }
+    h[0] += c * 5;
+    c = h[0] >> 26;
+    h[0] &= mask;
+    h[1] += c;
+
+    // h - p, used instead of h if h >= p
+    unsigned g[5];
+    g[0] = h[0] + 5;
+    c = g[0] >> 26;
+    g[0] &= mask;
+    for (int i = 1; i < 4; i++) {
+      g[i] = h[i] + c;
+      c = g[i] >> 26;
+      g[i] &= mask;
+    }
+    g[4] = h[4] + c - (1u << 26);
+    unsigned use_g = (g[4] >> 31) - 1;
+    for (int i = 0; i < 5; i++) {
+      h[i] = (h[i] & ~use_g) | (g[i] & use_g);
+    }
+
+    // (h + pad) mod 2^128
+    unsigned words[4] = {h[0] | (h[1] << 26), (h[1] >> 6) | (h[2] << 20),
+                         (h[2] >> 12) | (h[3] << 14),
+                         (h[3] >> 18) | (h[4] << 8)};
+    unsigned long long sum = 0;
+    for (int i = 0; i < 4; i++) {
+      sum = (unsigned long long)words[i] + pad[i] + (sum >> 32);
+      store_u32(tag + i * 4, (unsigned)sum);
+    }
+  }
+
+private:
+  void blocks(const unsigned char *m, size_t size, unsigned hibit) {
+    const unsigned long long s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5,
+                             s4 = r[4] * 5;
+    const unsigned long long r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3],
+                             r4 = r[4];
+    for (; size >= 16; m += 16, size -= 16) {
+      unsigned long long h0 = h[0] + (load_u32(m + 0) & 0x3ffffff);
+      unsigned long long h1 = h[1] + ((load_u32(m + 3) >> 2) & 0x3ffffff);
+      unsigned long long h2 = h[2] + ((load_u32(m + 6) >> 4) & 0x3ffffff);
+      unsigned long long h3 = h[3] + ((load_u32(m + 9) >> 6) & 0x3ffffff);
+      unsigned long long h4 = h[4] + ((load_u32(m + 12) >> 8) | hibit);
+
+      unsigned long long d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+      unsigned long long d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+      unsigned long long d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+      unsigned long long d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+      unsigned long long d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+
+      unsigned long long c = d0 >> 26;
+      h[0] = d0 & 0x3ffffff;
+      d1 += c;
+      c = d1 >> 26;
+      h[1] = d1 & 0x3ffffff;
+      d2 += c;
+      c = d2 >> 26;
+      h[2] = d2 & 0x3ffffff;
+      d3 += c;
+      c = d3 >> 26;
+      h[3] = d3 & 0x3ffffff;
+      d4 += c;
+      c = d4 >> 26;
+      h[4] = d4 & 0x3ffffff;
+      h[0] += (unsigned)c * 5;
+      h[1] += h[0] >> 26;
+      h[0] &= 0x3ffffff;
+    }
+  }
+
+  unsigned r[5];
+  unsigned h[5];
+  unsigned pad[4];
+  unsigned char buffer[16];
+  size_t leftover;
+};
+
+// ChaCha20-Poly1305 tag (RFC 8439) over aad and ciphertext
+static void aead_tag(const unsigned char key[32], const unsigned char nonce[12],
+                     const unsigned char *aad, size_t aad_size,
+                     const unsigned char *cipher, size_t size,
+                     unsigned char tag[16]) {
+  unsigned char poly_key[64];
+  ChaCha20(key, nonce, 0).block(poly_key);
+  Poly1305 mac(poly_key);
+  static const unsigned char zeros[16] = {0};
+  mac.update(aad, aad_size);
+  mac.update(zeros, (16 - aad_size % 16) % 16);
+  mac.update(cipher, size);
+  mac.update(zeros, (16 - size % 16) % 16);
+  unsigned char lengths[16] = {0};
+  store_u32(lengths, aad_size);
+  store_u32(lengths + 8, size);
+  mac.update(lengths, 16);
+  mac.finish(tag);
+}
+
+// Encrypt data in place and compute its tag
+static void aead_seal(const unsigned char key[32],
+                      const unsigned char nonce[12], const unsigned char *aad,
+                      size_t aad_size, unsigned char *data, size_t size,
+                      unsigned char tag[16]) {
+  ChaCha20(key, nonce, 1).apply(data, size);
+  aead_tag(key, nonce, aad, aad_size, data, size, tag);
+}
+
+// Check the tag and decrypt data in place; false if it doesn't match
+static bool aead_open(const unsigned char key[32],
+                      const unsigned char nonce[12], const unsigned char *aad,
+                      size_t aad_size, unsigned char *data, size_t size,
+                      const unsigned char tag[16]) {
+  unsigned char expected[16];
+  aead_tag(key, nonce, aad, aad_size, data, size, expected);
+  unsigned char difference = 0;
+  for (int i = 0; i < 16; i++) {
+    difference |= expected[i] ^ tag[i];
+  }
+  if (difference)
+    return false;
+  ChaCha20(key, nonce, 1).apply(data, size);
+  return true;
+}
+
+// Random bytes for keys and nonces
+static bool random_bytes(unsigned char *out, size_t size) {
+#ifdef _WIN32
+  for (size_t i = 0; i < size; i += 4) {
+    unsigned value;
+    if (rand_s(&value) != 0)
+      return false;
+    memcpy(out + i, &value, std::min<size_t>(4, size - i));
+  }
+  return true;
+#else
+  FILE *source = fopen("/dev/urandom", "rb");
+  if (!source)
+    return false;
+  bool ok = fread(out, 1, size, source) == size;
+  fclose(source);
+  return ok;
+#endif
+}
+
+// Read a 256-bit key stored as 64 hex digits, creating a random one first
+// if the file doesn't exist and create is set
+static bool load_key_file(const std::string &path, bool create,
+                          unsigned char key[32], std::string &error) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    if (!create) {
+      error = "Missing key file: " + path;
+      return false;
+    }
+    if (!random_bytes(key, 32)) {
+      error = "Failed to generate a key";
+      return false;
+    }
+    std::string hex;
+    for (int i = 0; i < 32; i++) {
+      char digits[3];
+      snprintf(digits, sizeof(digits), "%02x", key[i]);
+      hex += digits;
+    }
+    hex += "\n";
+#ifndef _WIN32
+    // Readable by the owner only; fails if another process created it first
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+      if (errno == EEXIST)
+        return load_key_file(path, false, key, error);
+      error = "Failed to save file: " + path;
+      return false;
+    }
+    bool ok = write(fd, hex.data(), hex.size()) == (ssize_t)hex.size();
+    metrics.fsyncs.fetch_add(1, std::memory_order_relaxed);
+    ok = (fsync(fd) == 0) && ok;
+    close(fd);
+#else
+    std::ofstream out(path);
+    out << hex;
+    out.close();
+    bool ok = !out.fail();
+#endif
+    if (!ok) {
+      error = "Error saving file: " + path;
+    }
+    return ok;
+  }
+
+  std::string hex;
+  file >> hex;
+  if (hex.size() != 64 ||
+      hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+    error = "Error reading file: " + path;
+    return false;
+  }
+  for (int i = 0; i < 32; i++) {
+    key[i] = (unsigned char)strtoul(hex.substr(i * 2, 2).c_str(), nullptr, 16);
+  }
+  return true;
+}
+
+// The directory a file is in, as an absolute path without links, or ""
+// if that directory doesn't exist
+static std::string resolved_directory(const std::string &path) {
+  size_t slash = path.find_last_of("/\\");
+  std::string dir =
+      (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+#ifdef _WIN32
+  char full[_MAX_PATH];
+  return _fullpath(full, dir.c_str(), sizeof(full)) ? full : "";
+#else
+  char *real = realpath(dir.c_str(), nullptr);
+  if (!real)
+    return "";
+  std::string resolved = real;
+  free(real);
+  return resolved;
+#endif
+}
+
+// The text format encrypted with ChaCha20-Poly1305 in independently
+// authenticated blocks ("todos.enc"), keyed by a separate key file:
+//
+//   header: "CLRE", version, key check (16 bytes of keystream for the
+//           all-zero nonce, to tell a wrong key from a damaged file),
+//           block count, nonce, tag over all of them. The count makes a
+//           file cut short at a block boundary show as damaged.
+//   block:  kind (1 = item lines, 2 = journal records), plaintext length,
+//           nonce, ciphertext, tag. The kind, length and block number are
+//           authenticated, so blocks can't be reordered.
+//
+// Item blocks hold whole item lines of about BLOCK_TEXT bytes; journal
+// blocks hold JournalStorage records. A save appends one journal block,
+// syncs it, then counts it in the header and syncs again; blocks past the
+// count were never committed and are ignored. Once the journal outgrows
+// the items, the file is rewritten: item blocks before the first changed
+// item are copied as they are and only the rest are encrypted again.
+// Version 1 files have no count; they are read and rewritten as version 2
+// on the first save.
+//
+// The key must be given (--key-file) and kept out of the data file's
+// directory: a key beside the file it unlocks protects nothing once that
+// directory is copied or synced elsewhere.
+class EncryptedStorage : public StorageBackend {
+public:
+  EncryptedStorage(const std::string &file, const std::string &key)
+      : file_path(file), key_path(key), temp_file(temp_path(file)),
+        have_key(false), version(0), valid_size(0), item_bytes(0),
+        journal_bytes(0), dirty_from(~0u), appending(false),
+        pending_dirty(~0u), nonce_counter(0) {
+    if (key_path.empty()) {
+      key_error = "No key file for " + file_path + " (use --key-file)";
+    } else {
+      std::string key_dir = resolved_directory(key_path);
+      if (!key_dir.empty() && key_dir == resolved_directory(file_path)) {
+        key_error = "Key file " + key_path + " must not be in the directory "
+                    "of " + file_path;
+      }
+    }
+  }
+
+  const char *name() const override { return "encrypted"; }
+  std::string path() const override { return file_path; }
+  bool confidential() const override { return true; }
+
+protected:
+  bool read(std::vector<TodoItem> &items, std::string &error) override {
+    items.clear();
+    blocks.clear();
+    valid_size = item_bytes = journal_bytes = 0;
+    dirty_from = ~0u;
+    version = 0;
+    order.invalidate();
+    if (!key_error.empty()) {
+      error = key_error;
+      return false;
+    }
+
+    std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+      return false; // First run
+    }
+    std::string data((size_t)file.tellg(), '\0');
+    file.seekg(0);
+    file.read(&data[0], data.size());
+    file.close();
+
+    // Never overwrite a file we can't read
+    if (!have_key && !load_key_file(key_path, false, key, error)) {
+      refused = error;
+      return false;
+    }
+    have_key = true;
+    unsigned char check[16];
+    key_check(check);
+    unsigned char *header = (unsigned char *)&data[0];
+    version = (data.size() >= 8) ? load_u32(header + 4) : 0;
+    size_t header_size = (version == 1) ? HEADER_SIZE_V1 : HEADER_SIZE;
+    if (data.size() < header_size || data.compare(0, 4, "CLRE") != 0 ||
+        (version != 1 && version != 2)) {
+      error = refused = "Error reading file: " + file_path;
+      return false;
+    }
+    if (memcmp(&data[8], check, 16) != 0) {
+      error = refused = "Wrong key for " + file_path + " in " + key_path;
+      return false;
+    }
+    size_t count = ~(size_t)0; // Version 1: as many as are intact
+    if (version == 2) {
+      if (!aead_open(key, header + 28, header, 28, header, 0, header + 40)) {
+        error = refused = "Error reading file: " + file_path + " (damaged)";
+        return false;
+      }
+      count = load_u32(header + 24);
+    }
+
+    size_t pos = header_size;
+    std::string line;
+    while (blocks.size() < count && pos + BLOCK_OVERHEAD <= data.size()) {
+      unsigned char *block = (unsigned char *)&data[pos];
+      size_t length = load_u32(block + 4);
+      if (length > data.size() - pos - BLOCK_OVERHEAD)
+        break; // Torn write at the end
+      unsigned char aad[16];
+      block_aad(block, blocks.size(), aad);
+      if (!aead_open(key, block + 8, aad, 16, block + 20, length,
+                     block + 20 + length)) {
+        if (version == 1 && pos + BLOCK_OVERHEAD + length == data.size())
+          break; // Torn write at the end
+        error = refused = "Error reading file: " + file_path + " (damaged)";
+        return false;
+      }
+
+      Block entry;
+      entry.offset = pos;
+      entry.size = BLOCK_OVERHEAD + length;
+      entry.first = items.size();
+      entry.journal = (block[0] == 2);
+      const char *text = (const char *)block + 20;
+      for (size_t start = 0; start < length;) {
+        size_t end = start;
+        while (end < length && text[end] != '\n')
+          end++;
+        line.assign(text + start, end - start);
+        start = end + 1;
+        if (entry.journal) {
+          if (!replay_journal_record(line, items))
+            break;
+          dirty_from = std::min(dirty_from, (unsigned)atoi(line.c_str() + 2));
+        } else {
+          bool completed;
+          std::string item_text, notes_hash;
+          if (!parse_item_line(line, completed, item_text, notes_hash))
+            continue;
+          items.push_back(TodoItem(item_text));
+          items.back().completed = completed;
+          items.back().notes_hash = notes_hash;
+        }
+      }
+      entry.count = entry.journal ? 0 : items.size() - entry.first;
+      (entry.journal ? journal_bytes : item_bytes) += entry.size;
+      blocks.push_back(entry);
+      pos += entry.size;
+      valid_size = pos;
+    }
+    if (version == 2 && blocks.size() < count) {
+      error = refused = "Error reading file: " + file_path + " (truncated)";
+      return false;
+    }
+
+    order.reset(items);
+    return !items.empty();
+  }
+
+  bool prepare(const std::vector<TodoItem> &items, const ChangeSet *changes,
+               std::string &error) override {
+    if (!key_error.empty()) {
+      error = key_error;
+      return false;
+    }
+    if (!refused.empty()) {
+      error = refused;
+      return false;
+    }
+    if (!have_key && !load_key_file(key_path, true, key, error))
+      return false;
+    have_key = true;
+    if (!random_bytes(nonce_prefix, sizeof(nonce_prefix))) {
+      error = "Failed to generate a nonce";
+      return false;
+    }
+    nonce_counter = 0;
+
+    unsigned from = 0; // First item whose block is encrypted again
+    if (changes && order.apply(items, *changes, ops)) {
+      unsigned lowest = dirty_from;
+      for (const StorageOp &op : ops) {
+        lowest = std::min(lowest, (unsigned)op.index);
+      }
+      long long size, stamp;
+      bool intact = file_signature(file_path, size, stamp) &&
+                    size == valid_size && valid_size > 0 && version == 2;
+      if (intact && journal_bytes <= item_bytes) {
+        if (!seal_header(blocks.size() + 1, pending_header)) {
+          error = "Failed to generate a nonce";
+          return false;
+        }
+        pending.clear();
+        seal_block(2, blocks.size(), journal_records(items, ops), pending);
+        appending = true;
+        pending_dirty = lowest;
+        return true;
+      }
+      if (intact)
+        from = lowest;
+    }
+    appending = false;
+
+    // Keep the item blocks that end before from
+    size_t keep = 0;
+    unsigned first = 0;
+    while (keep < blocks.size() && !blocks[keep].journal &&
+           blocks[keep].first + blocks[keep].count <= from) {
+      first += blocks[keep].count;
+      keep++;
+    }
+    std::string out;
+    if (keep > 0) {
+      out.resize(blocks[keep - 1].offset + blocks[keep - 1].size);
+      std::ifstream file(file_path, std::ios::binary);
+      if (!file.read(&out[0], out.size())) {
+        keep = 0;
+        first = 0;
+      }
+    }
+    if (keep == 0) {
+      out.assign(HEADER_SIZE, '\0'); // Sealed once the blocks are counted
+    }
+    pending_blocks.assign(blocks.begin(), blocks.begin() + keep);
+
+    std::string plain;
+    unsigned block_first = first;
+    for (size_t i = first; i <= items.size(); i++) {
+      std::string line = (i < items.size()) ? format_item_line(items[i]) : "";
+      if (!plain.empty() &&
+          (i == items.size() || plain.size() + line.size() > BLOCK_TEXT)) {
+        Block entry;
+        entry.offset = out.size();
+        entry.size = BLOCK_OVERHEAD + plain.size();
+        entry.first = block_first;
+        entry.count = i - block_first;
+        entry.journal = false;
+        seal_block(1, pending_blocks.size(), plain, out);
+        pending_blocks.push_back(entry);
+        block_first = i;
+        plain.clear();
+      }
+      plain += line;
+    }
+    if (!seal_header(pending_blocks.size(), (unsigned char *)&out[0])) {
+      error = "Failed to generate a nonce";
+      order.invalidate();
+      return false;
+    }
+
+    std::ofstream file(temp_file, std::ios::binary);
+    if (!file.is_open()) {
+      error = "Failed to save file: " + temp_file;
+      order.invalidate();
+      return false;
+    }
+    file.write(out.data(), out.size());
+    file.close();
+    written += out.size();
+    if (file.fail()) {
+      error = "Error saving file: " + temp_file;
+      order.invalidate();
+      return false;
+    }
+    pending_size = out.size();
+    order.reset(items);
+    return true;
+  }
+
+  bool publish(std::string &error) override {
+    if (appending) {
+      // The block is on disk before the header counts it
+      FILE *file = fopen(file_path.c_str(), "r+b");
+      bool ok = file && fseek(file, valid_size, SEEK_SET) == 0 &&
+                fwrite(pending.data(), 1, pending.size(), file) ==
+                    pending.size() &&
+                sync_file(file) && fseek(file, 0, SEEK_SET) == 0 &&
+                fwrite(pending_header, 1, HEADER_SIZE, file) == HEADER_SIZE &&
+                sync_file(file);
+      if (file)
+        fclose(file);
+      if (!ok) {
+        order.invalidate(); // The next save rewrites the file
+        error = "Error saving file: " + file_path;
+        return false;
+      }
+      Block entry;
+      entry.offset = valid_size;
+      entry.size = pending.size();
+      entry.first = entry.count = 0;
+      entry.journal = true;
+      blocks.push_back(entry);
+      valid_size += pending.size();
+      journal_bytes += pending.size();
+      written += pending.size() + HEADER_SIZE;
+      dirty_from = pending_dirty;
+      return true;
+    }
+
+    if (!replace_file(temp_file, file_path)) {
+      order.invalidate();
+      error = "Error saving file: " + file_path;
+      return false;
+    }
+    blocks.swap(pending_blocks);
+    version = 2;
+    valid_size = pending_size;
+    item_bytes = valid_size - HEADER_SIZE;
+    journal_bytes = 0;
+    dirty_from = ~0u;
+    return true;
+  }
+
+  void discard() override {
+    if (!appending) {
+      remove(temp_file.c_str());
+    }
+    order.invalidate();
+  }
+
+private:
+  enum {
+    HEADER_SIZE = 56,    // Magic, version, key check, count, nonce, tag
+    HEADER_SIZE_V1 = 24, // Magic, version, key check
+    BLOCK_OVERHEAD = 36, // Kind, length, nonce and tag
+    BLOCK_TEXT = 4096    // Plaintext per item block
+  };
+
+  struct Block {
+    long long offset;
+    long long size;
+    unsigned first; // First item (item blocks)
+    unsigned count;
+    bool journal;
+  };
+
+  void key_check(unsigned char out[16]) {
+    static const unsigned char zero_nonce[12] = {0};
+    unsigned char stream[64];
+    ChaCha20(key, zero_nonce, 0).block(stream);
+    memcpy(out, stream, 16);
+  }
+
+  // A version 2 header counting count blocks, with a fresh nonce
+  bool seal_header(size_t count, unsigned char header[HEADER_SIZE]) {
+    memcpy(header, "CLRE", 4);
+    store_u32(header + 4, 2);
+    key_check(header + 8);
+    store_u32(header + 24, count);
+    if (!random_bytes(header + 28, 12))
+      return false;
+    aead_tag(key, header + 28, header, 28, header, 0, header + 40);
+    return true;
+  }
+
+  // A block's kind and length, plus its number
+  static void block_aad(const unsigned char *block, size_t index,
+                        unsigned char aad[16]) {
+    memcpy(aad, block, 8);
+    store_u32(aad + 8, index);
+    store_u32(aad + 12, 0);
+  }
+
+  void seal_block(unsigned char kind, size_t index, const std::string &plain,
+                  std::string &out) {
+    unsigned char head[20] = {0};
+    head[0] = kind;
+    store_u32(head + 4, plain.size());
+    memcpy(head + 8, nonce_prefix, 8);
+    store_u32(head + 16, nonce_counter++);
+    unsigned char aad[16], tag[16];
+    block_aad(head, index, aad);
+
+    out.append((const char *)head, sizeof(head));
+    size_t at = out.size();
+    out.append(plain);
+    aead_seal(key, head + 8, aad, 16, (unsigned char *)&out[at], plain.size(),
+              tag);
+    out.append((const char *)tag, sizeof(tag));
+  }
+
+  std::string file_path;
+  std::string key_path;
+  std::string temp_file;
+  unsigned char key[32];
+  bool have_key;
+  std::string key_error; // The key is missing or beside the data file
+  unsigned version;      // Of the file as read, 0 if none
+  std::string refused; // Why saving would destroy data we couldn't read
+  std::vector<Block> blocks; // Item blocks, then journal blocks
+  long long valid_size;      // End of the last authentic block
+  long long item_bytes;
+  long long journal_bytes;
+  unsigned dirty_from; // Lowest item index the journal has touched
+  StoredOrder order;
+  std::vector<StorageOp> ops;
+
+  // The prepared save
+  bool appending; // A journal block, else a rewrite in temp_file
+  std::string pending;
+  unsigned char pending_header[HEADER_SIZE]; // Counting the journal block
+  std::vector<Block> pending_blocks;
+  long long pending_size;
+  unsigned pending_dirty;
+  unsigned char nonce_prefix[8]; // Random per save; blocks count up from it
+  unsigned nonce_counter;
+};
+
+static const char *const storage_backend_names[] = {
+    "text", "binary", "journal", "paged", "encrypted", "memory"};
+
+// Create a backend by name; base_path is the data file path without an
+// extension. key_file is where the encrypted backend keeps its key; it
+// has no default. Returns nullptr for an unknown name.
+static StorageBackend *
+create_storage_backend(const std::string &name, const std::string &base_path,
+                       const std::string &key_file = "") {
+  if (name == "text")
+    return new TextStorage(base_path + ".txt");
+  if (name == "binary")
+    return new BinarySnapshotStorage(base_path + ".bin");
+  if (name == "journal")
+    return new JournalStorage(base_path + ".txt");
+  if (name == "paged")
+    return new PagedStorage(base_path + ".db");
+  if (name == "encrypted")
+    return new EncryptedStorage(base_path + ".enc", key_file);
+  if (name == "memory")
+    return new MemoryStorage();
+  return nullptr;
+}
+
+#ifndef CLEAR_NO_MAIN // Command line tools, called from main() only
+// Run the same workloads against every backend in a scratch directory and
+// print latency and bytes written for each
+static int run_storage_benchmark(int item_count) {
+  std::string dir;
+#ifdef _WIN32
+  dir = "clear-bench";
+  CreateDirectoryA(dir.c_str(), NULL);
+#else
+  const char *tmp = getenv("TMPDIR");
+  std::string templ = std::string(tmp ? tmp : "/tmp") + "/clear-bench-XXXXXX";
+  std::vector<char> buffer(templ.begin(), templ.end());
+  buffer.push_back('\0');
+  if (!mkdtemp(&buffer[0])) {
+    fprintf(stderr, "Cannot create a scratch directory in %s\n",
+            tmp ? tmp : "/tmp");
+    return 1;
+  }
+  dir = &buffer[0];
+#endif
+
+  printf("Storage benchmark, %d items\n", item_count);
+  printf("  %-9s %-14s %10s %12s\n", "backend", "workload", "ms", "bytes");
+  for (const char *backend_name : storage_backend_names) {
+    StorageBackend *backend =
+        create_storage_backend(backend_name, dir + "/todos", dir + ".key");
+    std::vector<TodoItem> items;
+    for (int i = 0; i < item_count; i++) {
+      items.push_back(TodoItem("Benchmark task #" + std::to_string(i)));
+      items.back().completed = (i % 5 == 4);
+    }
+    std::string error;
+    backend->save(items, nullptr, error);
+
+    for (int workload = 0; workload < 4; workload++) {
+      ChangeSet changes;
+      unsigned long long bytes_before = backend->bytes_written();
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      const char *workload_name = "";
+      switch (workload) {
+      case 0:
+        workload_name = "startup";
+        backend->load(items, error);
+        break;
+      case 1: {
+        workload_name = "single toggle";
+        int index = item_count / 2;
+        items[index].completed = !items[index].completed;
+        changes.changes.push_back(
+            ModelChange(ModelChange::TOGGLE, items[index].id, index));
+        backend->save(items, &changes, error);
+        break;
+      }
+      case 2:
+        workload_name = "bulk edit";
+        for (int i = 0; i < item_count; i += 10) {
+          items[i].text += " (edited)";
+          changes.changes.push_back(
+              ModelChange(ModelChange::UPDATE_TEXT, items[i].id, i));
+        }
+        backend->save(items, &changes, error);
+        break;
+      case 3: {
+        workload_name = "reorder drag";
+        // Drag one item down 20 rows, one row at a time
+        int from = std::min(10, item_count - 1);
+        int to = std::min(from + 20, item_count - 1);
+        for (int i = from; i < to; i++) {
+          std::swap(items[i], items[i + 1]);
+          changes.changes.push_back(
+              ModelChange(ModelChange::MOVE, items[i + 1].id, i + 1, i));
+        }
+        changes.merge();
+        backend->save(items, &changes, error);
+        break;
+      }
+      }
+      double ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      printf("  %-9s %-14s %10.3f %12llu%s\n", backend->name(), workload_name,
+             ms, backend->bytes_written() - bytes_before,
+             error.empty() ? "" : "  (error)");
+      error.clear();
+    }
+    delete backend;
+  }
+
+  const char *files[] = {"todos.txt",         "todos.txt.journal",
+                         "todos.txt.version", "todos.bin",
+                         "todos.bin.version", "todos.db",
+                         "todos.db.wal",      "todos.db.version",
+                         "todos.enc",         "todos.enc.version",
+                         "todos.txt.changes", "todos.bin.changes",
+                         "todos.db.changes",  "todos.enc.changes"};
+  for (const char *file : files) {
+    remove((dir + "/" + file).c_str());
+  }
+  remove((dir + ".key").c_str());
+  rmdir(dir.c_str());
+  return 0;
+}
+
+// Copy a list between the text format and a paged file:
+// --import-paged <todos.txt> <todos.db>, --export-paged <todos.db> <todos.txt>
+static int convert_paged_file(bool import, const std::string &from,
+                              const std::string &to) {
+  StorageBackend *source, *target;
+  if (import) {
+    source = new TextStorage(from);
+    target = new PagedStorage(to);
+  } else {
+    source = new PagedStorage(from);
+    target = new TextStorage(to);
+  }
+
+  // The target is read first so the save goes through its version check
+  std::vector<TodoItem> items, replaced;
+  std::string error;
+  long long size, stamp;
+  if (!file_signature(from, size, stamp)) {
+    error = "Error reading file: " + from;
+  } else {
+    source->load(items, error);
+  }
+  if (error.empty()) {
+    target->load(replaced, error);
+    error.clear(); // Whatever was there is replaced
+    target->save(items, nullptr, error);
+  }
+  delete source;
+  delete target;
+
+  if (!error.empty()) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  printf("Converted %u items from %s to %s\n", (unsigned)items.size(),
+         from.c_str(), to.c_str());
+  return 0;
+}
+#endif // CLEAR_NO_MAIN
+
+// SHA-256 (FIPS 180-4), naming note blobs by their content
+class Sha256 {
+public:
+  Sha256() : length(0), used(0) {
+    static const unsigned initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                        0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                        0x1f83d9ab, 0x5be0cd19};
+    memcpy(state, initial, sizeof(state));
+  }
+
+  void update(const unsigned char *data, size_t size) {
+    length += size;
+    while (size > 0) {
+      size_t n = std::min(size, sizeof(buffer) - used);
+      memcpy(buffer + used, data, n);
+      used += n;
+      data += n;
+      size -= n;
+      if (used == sizeof(buffer)) {
+        block(buffer);
+        used = 0;
+      }
+    }
+  }
+
+  void finish(unsigned char out[32]) {
+    unsigned long long bits = length * 8;
+    unsigned char pad[72] = {0x80};
+    size_t pad_size = (used < 56 ? 56 : 120) - used;
+    for (int i = 0; i < 8; i++) {
+      pad[pad_size + i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    update(pad, pad_size + 8);
+    for (int i = 0; i < 8; i++) {
+      for (int j = 0; j < 4; j++) {
+        out[i * 4 + j] = (unsigned char)(state[i] >> (24 - j * 8));
+      }
+    }
+  }
+
+  // Hash of data as 64 lowercase hex digits
+  static std::string hex(const std::string &data) {
+    Sha256 sha;
+    sha.update((const unsigned char *)data.data(), data.size());
+    unsigned char digest[32];
+    sha.finish(digest);
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+    for (unsigned char byte : digest) {
+      result += digits[byte >> 4];
+      result += digits[byte & 15];
+    }
+    return result;
+  }
+
+private:
+  static unsigned rotr(unsigned x, int n) { return (x >> n) | (x << (32 - n)); }
+
+  void block(const unsigned char *p) {
+    static const unsigned k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    unsigned w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (unsigned)p[i * 4] << 24 | p[i * 4 + 1] << 16 |
+             p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+      unsigned s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      unsigned s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    unsigned v[8];
+    memcpy(v, state, sizeof(v));
+    for (int i = 0; i < 64; i++) {
+      unsigned s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+      unsigned ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+      unsigned t1 = v[7] + s1 + ch + k[i] + w[i];
+      unsigned s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+      unsigned maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+      memmove(v + 1, v, 7 * sizeof(unsigned));
+      v[4] += t1;
+      v[0] = t1 + s0 + maj;
+    }
+    for (int i = 0; i < 8; i++) {
+      state[i] += v[i];
+    }
+  }
+
+  unsigned state[8];
+  unsigned long long length;
+  unsigned char buffer[64];
+  size_t used;
+};
+
+// Data kept out of the list file: one file per distinct body, named by its
+// SHA-256 (plus a suffix such as ".png"). Items refer to it by name, so
+// loading and saving the list never reads or writes a body, and a body is
+// written once however many items or edits share it. Holds item notes
+// ("notes/") and image attachments ("attachments/").
+class BlobStore {
+public:
+  void attach(const std::string &dir) { directory = dir; }
+
+  // Store body (if not stored already) and return its name. An empty body
+  // is no blob at all.
+  bool put(const std::string &body, std::string &name, std::string &error,
+           const std::string &suffix = "") {
+    name.clear();
+    if (body.empty())
+      return true;
+    name = Sha256::hex(body) + suffix;
+    std::string path = blob_path(name);
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0)
+      return true;
+
+#ifdef _WIN32
+    CreateDirectoryA(directory.c_str(), NULL);
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+    std::string temp = temp_path(path);
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (!file) {
+      error = "Failed to save file: " + path;
+      return false;
+    }
+    bool ok = fwrite(body.data(), 1, body.size(), file) == body.size() &&
+              sync_file(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || !replace_file(temp, path)) {
+      ::remove(temp.c_str());
+      error = "Error saving file: " + path;
+      return false;
+    }
+    return true;
+  }
+
+  bool get(const std::string &name, std::string &body, std::string &error) {
+    body.clear();
+    if (name.empty())
+      return true;
+    std::string path = blob_path(name);
+    std::ifstream file(path, std::ios::binary);
+    if (file.is_open()) {
+      body.assign((std::istreambuf_iterator<char>(file)),
+                  std::istreambuf_iterator<char>());
+    }
+    if (!file.is_open() || file.bad() ||
+        Sha256::hex(body) != name.substr(0, 64)) {
+      error = "Error reading file: " + path;
+      body.clear();
+      return false;
+    }
+    return true;
+  }
+
+  std::string blob_path(const std::string &name) const {
+#ifdef _WIN32
+    return directory + "\\" + name;
+#else
+    return directory + "/" + name;
+#endif
+  }
+
+private:
+
+  std::string directory;
+};
+
+// A downscaled attachment (RGB) ready to draw. A width of 0 marks an image
+// that could not be decoded, so it isn't retried on every frame.
+struct Thumbnail {
+  int width;
+  int height;
+  std::vector<uchar> pixels;
+
+  Thumbnail() : width(0), height(0) {}
+};
+
+// Decoded thumbnails by blob name; the least recently drawn are dropped
+// once their pixels exceed the byte budget. Main thread only.
+class ThumbnailCache {
+public:
+  explicit ThumbnailCache(size_t budget_bytes)
+      : budget(budget_bytes), bytes(0) {}
+
+  const Thumbnail *get(const std::string &name) {
+    auto found = index.find(name);
+    if (found == index.end())
+      return nullptr;
+    entries.splice(entries.begin(), entries, found->second);
+    return &found->second->second;
+  }
+
+  void put(const std::string &name, Thumbnail &thumb) {
+    MemoryScope scope(MEM_ROW_IMAGES);
+    auto found = index.find(name);
+    if (found != index.end()) {
+      bytes -= found->second->second.pixels.size();
+      entries.erase(found->second);
+      index.erase(found);
+    }
+    bytes += thumb.pixels.size();
+    entries.push_front(std::make_pair(name, Thumbnail()));
+    entries.front().second.width = thumb.width;
+    entries.front().second.height = thumb.height;
+    entries.front().second.pixels.swap(thumb.pixels);
+    index[name] = entries.begin();
+    while (bytes > budget && entries.size() > 1) {
+      bytes -= entries.back().second.pixels.size();
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+
+private:
+  typedef std::list<std::pair<std::string, Thumbnail> > Entries;
+
+  size_t budget;
+  size_t bytes;
+  Entries entries; // Most recently used first
+  std::unordered_map<std::string, Entries::iterator> index;
+};
+
+// Decodes and downscales attachments on worker threads, so that draw()
+// only ever blits finished thumbnails. Each result is also written to
+// "<thumbs>/<name>-<size>.rgb", which later runs read instead of decoding.
+// Finished thumbnails are announced with Fl::awake(ready) and collected on
+// the main thread with take_ready().
+class ThumbnailLoader {
+public:
+  ThumbnailLoader() : size(0), ready(nullptr), ready_data(nullptr),
+                      stopping(false) {}
+  ~ThumbnailLoader() { stop(); }
+
+  void attach(const std::string &blob_directory,
+              const std::string &thumb_directory, int thumb_size,
+              Fl_Awake_Handler *ready_cb, void *data) {
+    blobs.attach(blob_directory);
+    thumbs = thumb_directory;
+    size = thumb_size;
+    ready = ready_cb;
+    ready_data = data;
+  }
+
+  // Queue name unless it is queued already. Main thread.
+  void request(const std::string &name) {
+    if (!pending.insert(name).second)
+      return;
+    if (workers.empty()) {
+      unsigned count = std::max(1u, std::min(2u,
+                                std::thread::hardware_concurrency()));
+      for (unsigned i = 0; i < count; i++) {
+        workers.push_back(std::thread(&ThumbnailLoader::run, this));
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(name);
+    wake.notify_one();
+  }
+
+  // Move the finished thumbnails into out. Main thread.
+  void take_ready(std::vector<std::pair<std::string, Thumbnail> > &out) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      out.swap(done);
+    }
+    for (const auto &result : out) {
+      pending.erase(result.first);
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    if (workers.empty())
+      return;
+    // The main thread holds the FLTK lock (main() takes it before the model
+    // exists); a worker may be waiting for it to finish a decode
+    Fl::unlock();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    Fl::lock();
+    workers.clear();
+  }
+
+private:
+  void run() {
+    MemoryScope scope(MEM_ROW_IMAGES);
+    for (;;) {
+      std::string name;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (stopping)
+          return;
+        name = jobs.back(); // Newest first: the rows on screen now
+        jobs.pop_back();
+      }
+      Thumbnail thumb;
+      if (!read_cached(name, thumb) && decode(name, thumb)) {
+        write_cached(name, thumb);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.push_back(std::make_pair(name, Thumbnail()));
+        done.back().second.width = thumb.width;
+        done.back().second.height = thumb.height;
+        done.back().second.pixels.swap(thumb.pixels);
+      }
+      Fl::awake(ready, ready_data);
+    }
+  }
+
+  std::string cache_path(const std::string &name) const {
+#ifdef _WIN32
+    return thumbs + "\\" + name + "-" + std::to_string(size) + ".rgb";
+#else
+    return thumbs + "/" + name + "-" + std::to_string(size) + ".rgb";
+#endif
+  }
+
+  // Cached thumbnail: "CLRI", 16-bit width and height, RGB pixels
+  bool read_cached(const std::string &name, Thumbnail &thumb) {
+    std::ifstream file(cache_path(name), std::ios::binary);
+    unsigned char header[8];
+    if (!file.read((char *)header, sizeof(header)) ||
+        memcmp(header, "CLRI", 4) != 0)
+      return false;
+    thumb.width = load_u16(header + 4);
+    thumb.height = load_u16(header + 6);
+    if (thumb.width <= 0 || thumb.width > size || thumb.height <= 0 ||
+        thumb.height > size)
+      return false;
+    thumb.pixels.resize(thumb.width * thumb.height * 3);
+    if (!file.read((char *)&thumb.pixels[0], thumb.pixels.size())) {
+      thumb.width = 0;
+      thumb.pixels.clear();
+      return false;
+    }
+    return true;
+  }
+
+  void write_cached(const std::string &name, const Thumbnail &thumb) {
+#ifdef _WIN32
+    CreateDirectoryA(thumbs.c_str(), NULL);
+#else
+    mkdir(thumbs.c_str(), 0755);
+#endif
+    std::string path = cache_path(name);
+    std::string temp = temp_path(path);
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (!file)
+      return; // Only costs a decode next run
+    unsigned char header[8];
+    memcpy(header, "CLRI", 4);
+    store_u16(header + 4, thumb.width);
+    store_u16(header + 6, thumb.height);
+    bool ok = fwrite(header, 1, 8, file) == 8 &&
+              fwrite(&thumb.pixels[0], 1, thumb.pixels.size(), file) ==
+                  thumb.pixels.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || !replace_file(temp, path)) {
+      ::remove(temp.c_str());
+    }
+  }
+
+  // Decode the attachment and box-filter it down to fit size x size,
+  // blending any alpha over white
+  // The file is read without the FLTK lock. FLTK calls from a worker must
+  // hold it, so the image classes decode under it; the downscale does not
+  // need it.
+  bool decode(const std::string &name, Thumbnail &thumb) {
+    std::string suffix = name.substr(name.rfind('.'));
+    std::string body, error;
+    if (!blobs.get(name, body, error) || body.empty())
+      return false;
+    const uchar *bytes = (const uchar *)body.data();
+    Fl_RGB_Image *image = nullptr;
+    Fl::lock();
+    if (suffix == ".png") {
+      image = new Fl_PNG_Image(nullptr, bytes, (int)body.size());
+    } else if (suffix == ".jpg" || suffix == ".jpeg") {
+      image = new Fl_JPEG_Image(nullptr, bytes);
+    }
+    Fl::unlock();
+    if (!image || image->w() <= 0 || image->h() <= 0 || image->d() < 1 ||
+        !image->data() || !image->data()[0]) {
+      release(image);
+      return false;
+    }
+
+    int w = image->w(), h = image->h(), d = image->d();
+    int line = image->ld() ? image->ld() : w * d;
+    const uchar *source = (const uchar *)image->data()[0];
+    double scale = std::min(1.0, std::min((double)size / w, (double)size / h));
+    thumb.width = std::max(1, (int)(w * scale));
+    thumb.height = std::max(1, (int)(h * scale));
+    thumb.pixels.resize(thumb.width * thumb.height * 3);
+    uchar *out = &thumb.pixels[0];
+    for (int ty = 0; ty < thumb.height; ty++) {
+      int y0 = ty * h / thumb.height;
+      int y1 = std::max(y0 + 1, (ty + 1) * h / thumb.height);
+      for (int tx = 0; tx < thumb.width; tx++) {
+        int x0 = tx * w / thumb.width;
+        int x1 = std::max(x0 + 1, (tx + 1) * w / thumb.width);
+        unsigned sum[3] = {0, 0, 0};
+        for (int y = y0; y < y1; y++) {
+          const uchar *p = source + y * line + x0 * d;
+          for (int x = x0; x < x1; x++, p += d) {
+            unsigned alpha = (d == 2 || d == 4) ? p[d - 1] : 255;
+            for (int c = 0; c < 3; c++) {
+              unsigned value = d < 3 ? p[0] : p[c];
+              sum[c] += (value * alpha + 255 * (255 - alpha)) / 255;
+            }
+          }
+        }
+        unsigned count = (y1 - y0) * (x1 - x0);
+        for (int c = 0; c < 3; c++) {
+          *out++ = (uchar)(sum[c] / count);
+        }
+      }
+    }
+    release(image);
+    return true;
+  }
+
+  static void release(Fl_RGB_Image *image) {
+    Fl::lock();
+    delete image;
+    Fl::unlock();
+  }
+
+  BlobStore blobs;
+  std::string thumbs;
+  int size;
+  Fl_Awake_Handler *ready;
+  void *ready_data;
+
+  std::set<std::string> pending; // Queued or being decoded (main thread)
+  std::vector<std::thread> workers;
+  std::mutex mutex; // Guards jobs, done and stopping
+  std::condition_variable wake;
+  std::vector<std::string> jobs;
+  std::vector<std::pair<std::string, Thumbnail> > done;
+  bool stopping;
+};
+
+// Recently deleted items, kept in a fixed-size ring file ("trash.bin") so
+// the trash never grows. Deleting writes the item's slots and the header
+// and nothing else; the oldest entries are overwritten.
+//
+// Header: "CLRD", version, slot count, next slot, last sequence number.
+// Slot: sequence number (0 = free), part number, part count, then for the
+// first part the deletion time, item id, position, hashes of the items
+// before and after it, completed flag and text length; the text follows,
+// continuing into the entry's next slots.
+class TrashRing {
+public:
+  struct Entry {
+    unsigned long long sequence;
+    long long deleted_at; // time(), seconds
+    unsigned item_id;     // Only meaningful in the session that deleted it
+    unsigned position;    // Index when deleted
+    unsigned before;      // item_hash() of the neighbours, 0 if none
+    unsigned after;
+    bool completed;
+    std::string text;
+    unsigned slot; // First slot, for take()
+  };
+
+  TrashRing() : file(nullptr), next(0), sequence(0) {}
+  ~TrashRing() {
+    if (file)
+      fclose(file);
+  }
+
+  bool is_open() const { return file != nullptr; }
+
+  bool open(const std::string &path, std::string &error) {
+    file = fopen(path.c_str(), "r+b");
+    if (file) {
+      unsigned char header[HEADER_SIZE];
+      if (fread(header, 1, HEADER_SIZE, file) == HEADER_SIZE &&
+          memcmp(header, "CLRD", 4) == 0 && load_u32(header + 4) == 1 &&
+          load_u32(header + 8) == SLOTS) {
+        next = load_u32(header + 12) % SLOTS;
+        sequence = load_u32(header + 16) |
+                   (unsigned long long)load_u32(header + 20) << 32;
+        return true;
+      }
+      fclose(file); // Unknown layout: start over
+    }
+
+    file = fopen(path.c_str(), "w+b");
+    if (!file) {
+      error = "Failed to open file: " + path;
+      return false;
+    }
+    next = 0;
+    sequence = 0;
+    std::vector<unsigned char> empty(HEADER_SIZE + SLOTS * SLOT_SIZE, 0);
+    if (fwrite(&empty[0], 1, empty.size(), file) != empty.size() ||
+        !write_header()) {
+      error = "Error saving file: " + path;
+      fclose(file);
+      file = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  // Hash of an item's stored form, to recognise its neighbours later
+  static unsigned item_hash(const TodoItem &item) {
+    std::string line = format_item_line(item);
+    unsigned hash = 2166136261u; // FNV-1a
+    for (char c : line) {
+      hash = (hash ^ (unsigned char)c) * 16777619u;
+    }
+    return hash | 1; // Never 0, which means "no neighbour"
+  }
+
+  bool push(Entry entry, std::string &error) {
+    if (entry.text.size() > MAX_TEXT) {
+      entry.text.resize(MAX_TEXT); // Longer than the whole ring allows
+    }
+    entry.sequence = ++sequence;
+    unsigned parts = 1;
+    if (entry.text.size() > FIRST_TEXT) {
+      parts += (entry.text.size() - FIRST_TEXT + MORE_TEXT - 1) / MORE_TEXT;
+    }
+
+    size_t done = 0;
+    for (unsigned part = 0; part < parts; part++) {
+      unsigned char slot[SLOT_SIZE] = {0};
+      store_u32(slot, (unsigned)entry.sequence);
+      store_u32(slot + 4, (unsigned)(entry.sequence >> 32));
+      store_u16(slot + 8, part);
+      store_u16(slot + 10, parts);
+      size_t offset = 12;
+      if (part == 0) {
+        unsigned long long deleted_at = entry.deleted_at;
+        store_u32(slot + 12, (unsigned)deleted_at);
+        store_u32(slot + 16, (unsigned)(deleted_at >> 32));
+        store_u32(slot + 20, entry.item_id);
+        store_u32(slot + 24, entry.position);
+        store_u32(slot + 28, entry.before);
+        store_u32(slot + 32, entry.after);
+        slot[36] = entry.completed ? 1 : 0;
+        store_u32(slot + 40, entry.text.size());
+        offset = 44;
+      }
+      size_t chunk = std::min(entry.text.size() - done, SLOT_SIZE - offset);
+      memcpy(slot + offset, entry.text.data() + done, chunk);
+      done += chunk;
+      if (!write_slot((next + part) % SLOTS, slot, SLOT_SIZE)) {
+        error = "Error saving deleted item";
+        return false;
+      }
+    }
+    next = (next + parts) % SLOTS;
+    if (!write_header()) {
+      error = "Error saving deleted item";
+      return false;
+    }
+    return true;
+  }
+
+  // All entries, newest first
+  void entries(std::vector<Entry> &out) {
+    out.clear();
+    std::vector<unsigned char> slots(SLOTS * SLOT_SIZE);
+    fseek(file, HEADER_SIZE, SEEK_SET);
+    if (fread(&slots[0], 1, slots.size(), file) != slots.size())
+      return;
+    for (unsigned slot = 0; slot < SLOTS; slot++) {
+      Entry entry;
+      if (decode(slots, slot, entry))
+        out.push_back(entry);
+    }
+    std::sort(out.begin(), out.end(), [](const Entry &a, const Entry &b) {
+      return a.sequence > b.sequence;
+    });
+  }
+
+  // Remove the entry starting at slot and return it
+  bool take(unsigned slot, Entry &entry, std::string &error) {
+    std::vector<unsigned char> slots(SLOTS * SLOT_SIZE);
+    fseek(file, HEADER_SIZE, SEEK_SET);
+    if (slot >= SLOTS ||
+        fread(&slots[0], 1, slots.size(), file) != slots.size() ||
+        !decode(slots, slot, entry)) {
+      error = "Deleted item is no longer in the trash";
+      return false;
+    }
+    unsigned char free_slot[8] = {0};
+    if (!write_slot(slot, free_slot, sizeof(free_slot))) {
+      error = "Error saving deleted item";
+      return false;
+    }
+    return true;
+  }
+
+private:
+  enum {
+    HEADER_SIZE = 32,
+    SLOTS = 256,
+    SLOT_SIZE = 512,
+    FIRST_TEXT = SLOT_SIZE - 44, // Text in an entry's first slot
+    MORE_TEXT = SLOT_SIZE - 12,  // Text in each further slot
+    MAX_TEXT = FIRST_TEXT + MORE_TEXT * 15 // 16 slots per entry at most
+  };
+
+  bool decode(const std::vector<unsigned char> &slots, unsigned slot,
+              Entry &entry) {
+    const unsigned char *first = &slots[slot * SLOT_SIZE];
+    entry.sequence =
+        load_u32(first) | (unsigned long long)load_u32(first + 4) << 32;
+    unsigned parts = load_u16(first + 10);
+    if (entry.sequence == 0 || load_u16(first + 8) != 0 || parts == 0 ||
+        parts > 16)
+      return false;
+    entry.deleted_at = (long long)(load_u32(first + 12) |
+                                   (unsigned long long)load_u32(first + 16)
+                                       << 32);
+    entry.item_id = load_u32(first + 20);
+    entry.position = load_u32(first + 24);
+    entry.before = load_u32(first + 28);
+    entry.after = load_u32(first + 32);
+    entry.completed = first[36] != 0;
+    size_t length = std::min<size_t>(load_u32(first + 40), MAX_TEXT);
+    entry.slot = slot;
+
+    // Every part must still belong to this entry (not overwritten since)
+    entry.text.clear();
+    for (unsigned part = 0; part < parts; part++) {
+      const unsigned char *p = &slots[((slot + part) % SLOTS) * SLOT_SIZE];
+      if ((load_u32(p) | (unsigned long long)load_u32(p + 4) << 32) !=
+              entry.sequence ||
+          load_u16(p + 8) != part)
+        return false;
+      size_t offset = (part == 0) ? 44 : 12;
+      size_t chunk = std::min(length - entry.text.size(), SLOT_SIZE - offset);
+      entry.text.append((const char *)p + offset, chunk);
+    }
+    return entry.text.size() == length;
+  }
+
+  bool write_slot(unsigned slot, const unsigned char *data, size_t size) {
+    return fseek(file, HEADER_SIZE + (long)slot * SLOT_SIZE, SEEK_SET) == 0 &&
+           fwrite(data, 1, size, file) == size && fflush(file) == 0;
+  }
+
+  bool write_header() {
+    unsigned char header[HEADER_SIZE] = {0};
+    memcpy(header, "CLRD", 4);
+    store_u32(header + 4, 1);
+    store_u32(header + 8, SLOTS);
+    store_u32(header + 12, next);
+    store_u32(header + 16, (unsigned)sequence);
+    store_u32(header + 20, (unsigned)(sequence >> 32));
+    return fseek(file, 0, SEEK_SET) == 0 &&
+           fwrite(header, 1, HEADER_SIZE, file) == HEADER_SIZE &&
+           fflush(file) == 0;
+  }
+
+  FILE *file;
+  unsigned next; // Slot the next entry starts at
+  unsigned long long sequence;
+};
+
+// Due dates: a "due:YYYY-MM-DD" word in an item's text. Days are counted
+// from 1970-01-01 (proleptic Gregorian calendar).
+static const long NO_DUE_DAY = -1000000000L;
+
+static long days_from_civil(int year, int month, int day) {
+  year -= month <= 2;
+  long era = (year >= 0 ? year : year - 399) / 400;
+  int year_of_era = year - era * 400;
+  int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+                   day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+static void civil_from_days(long days, int &year, int &month, int &day) {
+  days += 719468;
+  long era = (days >= 0 ? days : days - 146096) / 146097;
+  int day_of_era = days - era * 146097;
+  int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                     day_of_era / 146096) /
+                    365;
+  int day_of_year =
+      day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  int mp = (5 * day_of_year + 2) / 153;
+  day = day_of_year - (153 * mp + 2) / 5 + 1;
+  month = mp < 10 ? mp + 3 : mp - 9;
+  year = year_of_era + era * 400 + (month <= 2);
+}
+
+// 0 = Monday
+static int weekday_of(long days) { return (int)(((days % 7) + 7 + 3) % 7); }
+
+static long today_day() {
+  time_t now = time(nullptr);
+  struct tm local = *localtime(&now);
+  return days_from_civil(local.tm_year + 1900, local.tm_mon + 1,
+                         local.tm_mday);
+}
+
+static std::string format_day(long days) {
+  int year, month, day;
+  civil_from_days(days, year, month, day);
+  char text[16];
+  snprintf(text, sizeof(text), "%04d-%02d-%02d", year, month, day);
+  return text;
+}
+
+// Position of the "due:" word in text, or npos
+static size_t find_due_word(const std::string &text) {
+  size_t pos = 0;
+  while ((pos = text.find("due:", pos)) != std::string::npos) {
+    if ((pos == 0 || text[pos - 1] == ' ') &&
+        (pos + 14 == text.size() ||
+         (pos + 14 < text.size() && text[pos + 14] == ' ')))
+      return pos;
+    pos++;
+  }
+  return std::string::npos;
+}
+
+static long item_due_day(const std::string &text) {
+  size_t pos = find_due_word(text);
+  if (pos == std::string::npos)
+    return NO_DUE_DAY;
+  int year, month, day;
+  char dash1, dash2;
+  std::istringstream in(text.substr(pos + 4, 10));
+  if (!(in >> year >> dash1 >> month >> dash2 >> day) || dash1 != '-' ||
+      dash2 != '-' || month < 1 || month > 12 || day < 1 || day > 31)
+    return NO_DUE_DAY;
+  long days = days_from_civil(year, month, day);
+  int y, m, d;
+  civil_from_days(days, y, m, d);
+  return (m == month && d == day) ? days : NO_DUE_DAY; // e.g. 02-30
+}
+
+// text with its due date set to days
+static std::string replace_due_day(const std::string &text, long days) {
+  std::string word = "due:" + format_day(days);
+  size_t pos = find_due_word(text);
+  if (pos != std::string::npos) {
+    return text.substr(0, pos) + word + text.substr(pos + 14);
+  }
+  return text.empty() ? word : text + " " + word;
+}
+
+// Recurring items start with a rule, "every <period>: <text>", where the
+// period is day, week, month or a weekday ("monday" or "mon"). Only the
+// open instance carries the rule and its due date; the next instance is
+// made when it is completed or when the next date arrives (see
+// TodoModel::advance_recurrences), so nothing is expanded ahead of time.
+// Rules 0-6 are weekdays (0 = Monday, as weekday_of).
+enum { RECUR_NONE = -1, RECUR_DAY = 7, RECUR_WEEK, RECUR_MONTH };
+
+// Rule of text, and in rule_length the length of the "every ...: " prefix
+static int recurrence_rule(const std::string &text,
+                           size_t *rule_length = nullptr) {
+  static const char *weekdays[] = {"monday", "tuesday",  "wednesday",
+                                   "thursday", "friday", "saturday",
+                                   "sunday"};
+  if (text.compare(0, 6, "every ") != 0)
+    return RECUR_NONE;
+  size_t colon = text.find(':', 6);
+  if (colon == std::string::npos)
+    return RECUR_NONE;
+  std::string period;
+  for (size_t i = 6; i < colon; i++) {
+    period += (char)tolower((unsigned char)text[i]);
+  }
+  int rule = RECUR_NONE;
+  if (period == "day") {
+    rule = RECUR_DAY;
+  } else if (period == "week") {
+    rule = RECUR_WEEK;
+  } else if (period == "month") {
+    rule = RECUR_MONTH;
+  }
+  for (int i = 0; i < 7 && rule == RECUR_NONE; i++) {
+    if (period == weekdays[i] || period == std::string(weekdays[i], 3))
+      rule = i;
+  }
+  if (rule != RECUR_NONE && rule_length) {
+    *rule_length = text.find_first_not_of(' ', colon + 1);
+    if (*rule_length == std::string::npos)
+      *rule_length = text.size();
+  }
+  return rule;
+}
+
+// First day after the given one that rule falls on
+static long next_occurrence(int rule, long after) {
+  if (rule == RECUR_DAY)
+    return after + 1;
+  if (rule == RECUR_WEEK)
+    return after + 7;
+  if (rule == RECUR_MONTH) {
+    int year, month, day;
+    civil_from_days(after, year, month, day);
+    year += month / 12;
+    month = month % 12 + 1;
+    long first = days_from_civil(year, month, 1);
+    long last = days_from_civil(year + month / 12, month % 12 + 1, 1) - 1;
+    return std::min(first + day - 1, last); // Jan 31 -> Feb 28
+  }
+  return after + 1 + (rule - weekday_of(after + 1) + 7) % 7;
+}
+
+// Local midnight at the start of day
+static time_t day_start(long days) {
+  struct tm local;
+  memset(&local, 0, sizeof(local));
+  civil_from_days(days, local.tm_year, local.tm_mon, local.tm_mday);
+  local.tm_year -= 1900;
+  local.tm_mon -= 1;
+  local.tm_isdst = -1;
+  return mktime(&local);
+}
+
+// Time-to-first-frame phases, reported on stderr with --startup-profile.
+// Times are measured from static initialization, the earliest point the
+// program controls.
+struct StartupProfile {
+  bool enabled;
+  bool reported;
+  std::chrono::steady_clock::time_point start;
+  std::vector<std::pair<std::string, double> > phases; // name, ms since start
+
+  StartupProfile()
+      : enabled(false), reported(false),
+        start(std::chrono::steady_clock::now()) {}
+
+  void mark(const std::string &phase) {
+    if (!enabled || reported)
+      return;
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    phases.push_back(std::make_pair(phase, ms));
+  }
+
+  // Print all phases up to and including the first frame
+  void report(size_t item_count) {
+    if (!enabled || reported)
+      return;
+    reported = true;
+    fprintf(stderr, "Startup profile (%zu items):\n", item_count);
+    double previous = 0;
+    for (const auto &phase : phases) {
+      fprintf(stderr, "  %-28s %8.2f ms  (+%.2f ms)\n", phase.first.c_str(),
+              phase.second, phase.second - previous);
+      previous = phase.second;
+    }
+    double total = phases.empty() ? 0 : phases.back().second;
+    fprintf(stderr, "  time to first frame: %.2f ms (target 50 ms: %s)\n",
+            total, total <= 50.0 ? "met" : "missed");
+    fprintf(stderr, "  deferred past first frame: Fl_Input, sample-item "
+                    "save, glyph atlas\n");
+  }
+};
+
+static StartupProfile startup_profile;
+
+// Run work over [0, count) in one range per hardware thread (at most 8),
+// the first range on the calling thread. Returns when all are done.
+static void parallel_for(size_t count,
+                         const std::function<void(size_t, size_t)> &work) {
+  size_t threads =
+      std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+  threads = std::min(threads, count / 2048 + 1); // Small lists run inline
+  size_t step = (count + threads - 1) / threads;
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; i++) {
+    pool.push_back(std::thread(work, std::min(count, i * step),
+                               std::min(count, (i + 1) * step)));
+  }
+  work(0, std::min(count, step));
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+}
+
+// Find and replace in item text, literally or with an ECMAScript regex.
+// const methods may run on several threads at once.
+class TextReplacer {
+public:
+  TextReplacer() : use_regex(false) {}
+
+  // Returns false (with error set) for an invalid regex
+  bool compile(const std::string &find, const std::string &replace,
+               bool regex, std::string &error) {
+    pattern = find;
+    replacement = replace;
+    use_regex = regex && !find.empty();
+    if (use_regex) {
+      try {
+        expression = std::regex(find, std::regex::ECMAScript);
+      } catch (const std::regex_error &) {
+        error = "Invalid pattern";
+        pattern.clear();
+        use_regex = false;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Matches in text; with out, also text with all of them replaced
+  size_t apply(const std::string &text, std::string *out) const {
+    if (pattern.empty())
+      return 0;
+    size_t matches = 0;
+    if (use_regex) {
+      matches = std::distance(
+          std::sregex_iterator(text.begin(), text.end(), expression),
+          std::sregex_iterator());
+      if (out && matches)
+        *out = std::regex_replace(text, expression, replacement);
+      return matches;
+    }
+    size_t from = 0, pos;
+    while ((pos = text.find(pattern, from)) != std::string::npos) {
+      if (out) {
+        out->append(text, from, pos - from);
+        *out += replacement;
+      }
+      from = pos + pattern.size();
+      matches++;
+    }
+    if (out && matches)
+      out->append(text, from, std::string::npos);
+    return matches;
+  }
+
+private:
+  std::string pattern;
+  std::string replacement;
+  bool use_regex;
+  std::regex expression;
+};
+
+// Runs tasks at wall-clock deadlines through one FLTK timeout, armed for
+// the earliest. The timeout is capped at a minute so that a changed clock
+// or a suspended machine delays a task by at most that much.
+class DeadlineScheduler {
+public:
+  typedef std::function<void()> Task;
+
+  DeadlineScheduler() : next_token(1) {}
+  ~DeadlineScheduler() { Fl::remove_timeout(fire_cb, this); }
+
+  // Run task once time() reaches when (on the next loop pass if it has)
+  int schedule(time_t when, const Task &task) {
+    int token = next_token++;
+    tokens[token] = tasks.insert(
+        std::make_pair(when, std::make_pair(token, task)));
+    arm();
+    return token;
+  }
+
+  void cancel(int token) {
+    auto found = tokens.find(token);
+    if (found == tokens.end())
+      return;
+    tasks.erase(found->second);
+    tokens.erase(found);
+    arm();
+  }
+
+private:
+  typedef std::multimap<time_t, std::pair<int, Task> > Tasks;
+
+  void arm() {
+    Fl::remove_timeout(fire_cb, this);
+    if (tasks.empty())
+      return;
+    double delay = difftime(tasks.begin()->first, time(nullptr));
+    Fl::add_timeout(std::max(0.0, std::min(delay, 60.0)), fire_cb, this);
+  }
+
+  static void fire_cb(void *data) {
+    DeadlineScheduler *scheduler = (DeadlineScheduler *)data;
+    time_t now = time(nullptr);
+    while (!scheduler->tasks.empty() &&
+           scheduler->tasks.begin()->first <= now) {
+      Task task = scheduler->tasks.begin()->second.second;
+      scheduler->tokens.erase(scheduler->tasks.begin()->second.first);
+      scheduler->tasks.erase(scheduler->tasks.begin());
+      task(); // May schedule or cancel
+    }
+    scheduler->arm();
+  }
+
+  int next_token;
+  Tasks tasks;
+  std::map<int, Tasks::iterator> tokens;
+};
+
+// The list and what all windows showing it share: the change bus, the
+// storage (one persistence pipeline, saving every transaction once) and
+// the trash. Each window (ClearApp) is a view onto it with its own scroll
+// position, selection and caches.
+class TodoModel {
+public:
+  // Told about failed saves and about lists replaced by a merge with
+  // another program's changes
+  typedef std::function<void(const std::string &error, bool merged)>
+      SaveObserver;
+
+  TodoModel(const std::string &storage_name, const std::string &key_file)
+      : storage(nullptr), thumbnails(8 << 20), persistence_enabled(true),
+        loaded(false), unsaved(false), origin(nullptr), next_token(1),
+        recurrence_token(0) {
+    data_dir = get_data_directory();
+    storage =
+        create_storage_backend(storage_name, data_path("todos"), key_file);
+    if (!storage) {
+      storage = create_storage_backend("text", data_path("todos"));
+    }
+    notes.attach(data_path("notes"));
+    attachments.attach(data_path("attachments"));
+    thumbnail_loader.attach(data_path("attachments"), data_path("thumbs"),
+                            THUMB_SIZE, thumbnails_ready_cb, this);
+    startup_profile.mark("get_data_directory");
+
+    // Persistence runs first, before any view reacts to a change
+    bus.subscribe([this](const ChangeSet &changes) { save(&changes); });
+    bus.subscribe(
+        [this](const ChangeSet &changes) { recurrence_changed(changes); });
+  }
+
+  // Every transaction saves, so only a failed save is left to retry. Before
+  // load() (a window closed on the resume snapshot) items is not the list
+  // and must not be written over it.
+  ~TodoModel() {
+    thumbnail_loader.stop();
+    if (loaded && unsaved) {
+      save();
+    }
+    delete storage;
+  }
+
+  std::vector<TodoItem> items;
+  ModelEventBus bus;        // Change notifications for every list mutation
+  StorageBackend *storage;  // Where items are persisted (--storage)
+  TrashRing trash;          // Deleted items (trash.bin), opened on first use
+  BlobStore notes;          // Item notes, read only when expanded
+  BlobStore attachments;    // Attached images
+  ThumbnailLoader thumbnail_loader; // Decodes them off the main thread
+  ThumbnailCache thumbnails; // Decoded attachments, for every window
+  static const int THUMB_SIZE = 48;
+  bool persistence_enabled; // Save to storage (off while benchmarking)
+  bool loaded;              // load() has run
+  bool unsaved;             // The last save failed; retried on exit
+  const void *origin;       // View whose input is being handled
+  DeadlineScheduler scheduler; // Timed work on the list (recurrences)
+
+  int observe_saves(const SaveObserver &observer) {
+    observers.push_back(std::make_pair(next_token, observer));
+    return next_token++;
+  }
+
+  void unobserve_saves(int token) {
+    for (size_t i = 0; i < observers.size(); i++) {
+      if (observers[i].first == token) {
+        observers.erase(observers.begin() + i);
+        return;
+      }
+    }
+  }
+
+  // Path of a file in the application data directory
+  std::string data_path(const std::string &name) const {
+    if (data_dir == ".") {
+      return name; // Fallback to current directory
+    }
+#ifdef _WIN32
+    return data_dir + "\\" + name;
+#else
+    return data_dir + "/" + name;
+#endif
+  }
+
+  // Replace items with the stored list. Returns false if nothing is stored.
+  bool load(std::string &error) {
+    MemoryScope scope(MEM_MODEL);
+    bool loaded_any;
+    {
+      ScopedLatency latency(metrics.load);
+      loaded_any = storage->load(items, error);
+    }
+    loaded = true;
+    index_recurrences();
+    return loaded_any;
+  }
+
+  // load() for a list read a window at a time (see
+  // StorageBackend::open_window()). Returns false if it must be loaded
+  // again with load().
+  bool load_window(std::vector<TodoItem> &stored) {
+    MemoryScope scope(MEM_MODEL);
+    if (!storage->load_window(stored))
+      return false;
+    items.swap(stored);
+    loaded = true;
+    index_recurrences();
+    return true;
+  }
+
+  // Store the list; changes (if given) lets the backend write incrementally
+  void save(const ChangeSet *changes = nullptr) {
+    if (!persistence_enabled || !storage) {
+      return;
+    }
+
+    MemoryScope scope(MEM_IO);
+    std::string error;
+    bool saved;
+    {
+      ScopedLatency latency(metrics.save);
+      saved = storage->save(items, changes, error);
+    }
+    if (!saved && error.empty()) {
+      error = "Failed to save file: " + storage->path();
+    }
+    unsaved = !saved;
+
+    // Another program saved the list too; items now hold both sets of
+    // changes
+    bool merged = storage->take_merged(items);
+    if (merged) {
+      index_recurrences();
+    }
+    if (!error.empty() || merged) {
+      for (size_t i = 0; i < observers.size(); i++) {
+        observers[i].second(error, merged);
+      }
+    }
+  }
+
+  // Find the recurring items of a newly loaded list and give them a pass
+  void index_recurrences() {
+    recurring.clear();
+    for (const TodoItem &item : items) {
+      if (recurrence_rule(item.text) != RECUR_NONE)
+        recurring.insert(item.id);
+    }
+    if (!recurring.empty()) {
+      schedule_recurrences(time(nullptr));
+    }
+  }
+
+  // Track which items recur. Completing, adding or editing one calls for a
+  // pass, run from the scheduler once this delivery is over.
+  void recurrence_changed(const ChangeSet &changes) {
+    bool pass = false;
+    for (const ModelChange &change : changes.changes) {
+      if (change.kind == ModelChange::REMOVE) {
+        recurring.erase(change.item_id);
+        continue;
+      }
+      int index = change.index;
+      if (index < 0 || index >= (int)items.size() ||
+          items[index].id != change.item_id) {
+        index = -1;
+        for (size_t i = 0; i < items.size() && index < 0; i++) {
+          if (items[i].id == change.item_id)
+            index = i;
+        }
+      }
+      if (index < 0 || change.kind == ModelChange::MOVE)
+        continue;
+      if (recurrence_rule(items[index].text) != RECUR_NONE) {
+        recurring.insert(change.item_id);
+        pass = true;
+      } else {
+        recurring.erase(change.item_id);
+      }
+    }
+    if (pass) {
+      schedule_recurrences(time(nullptr));
+    }
+  }
+
+  void schedule_recurrences(time_t when) {
+    scheduler.cancel(recurrence_token);
+    recurrence_token = scheduler.schedule(when, [this]() {
+      recurrence_token = 0;
+      advance_recurrences();
+    });
+  }
+
+  // A pass is one transaction of its own. While a view holds one open (a
+  // reorder drag) the pass waits: delivered with the drag's moves, its
+  // changes would pass for that view's own.
+  void advance_recurrences() {
+    if (bus.in_transaction()) {
+      schedule_recurrences(time(nullptr) + 1);
+      return;
+    }
+    const void *input_origin = origin;
+    origin = nullptr; // Every view must remap for these changes
+    {
+      ModelTransaction transaction(bus);
+      spawn_recurrences();
+    }
+    origin = input_origin;
+  }
+
+  // Make the next instance of each recurring item that was completed or
+  // whose next date has arrived, moving the rule over to it, and schedule
+  // the next pass for the earliest date still to come. An instance gives
+  // a date a gap skipped over no instance of its own.
+  void spawn_recurrences() {
+    long today = today_day();
+    long earliest = NO_DUE_DAY;
+    std::vector<std::pair<int, long> > spawn; // Instance, next due day
+    for (size_t i = 0; i < items.size() && !recurring.empty(); i++) {
+      TodoItem &item = items[i];
+      int rule = recurring.count(item.id) ? recurrence_rule(item.text)
+                                          : RECUR_NONE;
+      if (rule == RECUR_NONE)
+        continue;
+      long due = item_due_day(item.text);
+      if (item.completed) {
+        long from = (due == NO_DUE_DAY) ? today : std::max(due, today);
+        spawn.push_back(std::make_pair(i, next_occurrence(rule, from)));
+        continue;
+      }
+      if (due == NO_DUE_DAY) {
+        // First instance: the first date the rule falls on from today
+        due = (rule < 7 || rule == RECUR_DAY) ? next_occurrence(rule, today - 1)
+                                              : today;
+        item.set_text(replace_due_day(item.text, due));
+        bus.emit(ModelChange(ModelChange::UPDATE_TEXT, item.id, i));
+      }
+      long next = next_occurrence(rule, due);
+      if (next <= today) {
+        while (next_occurrence(rule, next) <= today) {
+          next = next_occurrence(rule, next);
+        }
+        spawn.push_back(std::make_pair(i, next));
+      } else if (earliest == NO_DUE_DAY || next < earliest) {
+        earliest = next;
+      }
+    }
+
+    // Last first, so the earlier indices stay valid
+    for (size_t k = spawn.size(); k-- > 0;) {
+      int index = spawn[k].first;
+      size_t rule_length = 0;
+      recurrence_rule(items[index].text, &rule_length);
+      TodoItem instance(replace_due_day(items[index].text, spawn[k].second));
+      items[index].set_text(items[index].text.substr(rule_length));
+      bus.emit(ModelChange(ModelChange::UPDATE_TEXT, items[index].id, index));
+      items.insert(items.begin() + index + 1, instance);
+      bus.emit(ModelChange(ModelChange::INSERT, instance.id, index + 1));
+    }
+    if (earliest != NO_DUE_DAY) {
+      schedule_recurrences(day_start(earliest));
+    }
+  }
+
+  // Thumbnails decoded by the loader's workers: cache them and redraw the
+  // windows that were showing placeholders
+  static void thumbnails_ready_cb(void *data) {
+    TodoModel *model = (TodoModel *)data;
+    std::vector<std::pair<std::string, Thumbnail> > ready;
+    model->thumbnail_loader.take_ready(ready);
+    for (auto &result : ready) {
+      model->thumbnails.put(result.first, result.second);
+    }
+    for (Fl_Window *window = Fl::first_window(); window;
+         window = Fl::next_window(window)) {
+      window->redraw();
+    }
+  }
+
+  // Get application data directory path
+  static std::string get_data_directory() {
+    std::string home_dir;
+    std::string data_dir;
+
+#ifdef _WIN32
+    // Windows: Use %APPDATA%\Clear
+    char appdata_path[MAX_PATH];
+    if (SUCCEEDED(SHGetFolderPathA(NULL, CSIDL_APPDATA, NULL,
+                                   SHGFP_TYPE_CURRENT, appdata_path))) {
+      home_dir = appdata_path;
+      data_dir = home_dir + "\\Clear";
+    } else {
+      // Fallback to current directory
+      data_dir = ".";
+    }
+#else
+    // Unix-like systems (macOS, Linux)
+    const char *home = getenv("HOME");
+    if (!home) {
+      // Fallback to getpwuid
+      struct passwd *pw = getpwuid(getuid());
+      if (pw) {
+        home = pw->pw_dir;
+      }
+    }
+
+    if (home) {
+      home_dir = home;
+#ifdef __APPLE__
+      // macOS: ~/Library/Application Support/Clear
+      data_dir = home_dir + "/Library/Application Support/Clear";
+#else
+      // Linux: ~/.config/Clear (or ~/.local/share/Clear)
+      // Using XDG_CONFIG_HOME if set, otherwise ~/.config
+      const char *xdg_config = getenv("XDG_CONFIG_HOME");
+      if (xdg_config) {
+        data_dir = std::string(xdg_config) + "/Clear";
+      } else {
+        data_dir = home_dir + "/.config/Clear";
+      }
+#endif
+    } else {
+      // Fallback to current directory
+      data_dir = ".";
+    }
+#endif
+
+    // Create directory if it doesn't exist (recursively). Skip the walk
+    // over the parents when it is already there, which is every run but
+    // the first.
+    struct stat dir_info;
+    if (data_dir != "." && stat(data_dir.c_str(), &dir_info) != 0) {
+#ifdef _WIN32
+      // Create all parent directories recursively on Windows
+      std::string path = data_dir;
+      size_t pos = 0;
+      while ((pos = path.find_first_of("\\/", pos + 1)) != std::string::npos) {
+        std::string dir = path.substr(0, pos);
+        CreateDirectoryA(dir.c_str(), NULL);
+      }
+      // Create the final directory
+      CreateDirectoryA(data_dir.c_str(), NULL);
+#else
+      // Create all parent directories recursively
+      std::string path = data_dir;
+      size_t pos = 0;
+      while ((pos = path.find_first_of('/', pos + 1)) != std::string::npos) {
+        std::string dir = path.substr(0, pos);
+        mkdir(dir.c_str(), 0755);
+      }
+      // Create the final directory
+      mkdir(data_dir.c_str(), 0755);
+#endif
+    }
+
+    return data_dir;
+  }
+
+private:
+  std::string data_dir;
+  int next_token;
+  std::unordered_set<unsigned> recurring; // Items with a recurrence rule
+  int recurrence_token; // Scheduled pass, 0 if none
+  std::vector<std::pair<int, SaveObserver> > observers;
+};
+
+class ClearApp : public Fl_Window {
+  friend struct GestureTest; // gesture_test.cc
+
+private:
+  TodoModel &model;             // Shared with the other windows
+  std::vector<TodoItem> &items; // model.items
+  int selected_index;
+  int drag_start_y;
+  int drag_start_x;
+  bool is_dragging;
+  bool is_swiping;
+  bool is_pulling_down; // Pull down to add new item
+  int pull_down_offset; // Offset for pull-down animation
+  int drag_offset;
+  int item_height;
+  int editing_index;        // Index of item being edited
+  std::string editing_text; // Text being edited
+  int speculative_edit_index; // Item opened for editing by a single click
+                              // that may still turn into a double-click
+  bool can_reorder;         // Whether reordering is allowed (after long press)
+  Fl_Input *input_widget;   // Input widget for editing items
+  Fl_Multiline_Input *notes_input; // Notes of the expanded item (F3)
+  unsigned notes_item_id;   // Item whose notes are expanded, 0 if none
+  int drop_y;               // Where files are being dropped, -1 if not
+
+  // Find and replace panel (Ctrl+F) over the top of the list
+  struct ReplacedText {
+    unsigned id;
+    std::string before;
+    std::string after;
+  };
+  bool show_find;
+  Fl_Input *find_input;
+  Fl_Input *replace_input;
+  bool find_regex;          // Regex mode, else literal text
+  std::string find_status;  // Live match count, or the last replace
+  bool find_invalid;        // The pattern is not a valid regex
+  bool find_pressed;        // A click went to the panel's inputs
+  std::vector<ReplacedText> last_replace; // Undone by Ctrl+Z
+  static const int FIND_H = 44;
+  static const int FIND_INFO_W = 170;
+  std::string notes_loaded; // Its notes as read, to tell if they changed
+  static const int NOTES_H = 160;
+  int scroll_offset;        // Vertical scroll offset (positive = scrolled down)
+  std::map<int, ScaledRows> scaled_rows; // Row caches by scale, in percent
+  ScaledRows *scaled;       // Those of the window's current scale
+  int row_frame;            // Frames drawn, for pruning the row caches
+  static const int SCALE_KEEP_FRAMES = 600; // Unused scale sets kept
+  int layout_w, layout_h;   // Window size the layout was last fitted to
+  std::unordered_map<unsigned, RichText> text_layouts; // Spans, by item id
+  bool use_glyph_atlas;     // Compose row text from the glyph atlas
+  bool smooth_gradient;     // Per-pixel gradient instead of one colour per row
+  DrawBatch batch;          // Drawing for the current frame, submitted in draw()
+  bool show_hud;            // Show frame statistics (toggled with F12)
+  std::string metrics_path; // OpenMetrics file (--metrics-file), or empty
+  double metrics_interval;  // Seconds between metrics exports
+  bool metrics_failing;     // Last metrics export failed (reported once)
+  bool show_trash;          // Trash view is open (toggled with F8)
+  std::vector<TrashRing::Entry> trash_entries; // Listed in the trash view
+  int trash_scroll;         // First entry shown in the trash view
+  static const int TRASH_ROW_H = 40;
+
+  // Board view (F7): the list split into columns by status or by tag
+  enum BoardMode { BOARD_OFF, BOARD_STATUS, BOARD_TAG };
+  struct BoardColumn {
+    std::string key;       // board_key() of its items
+    std::string title;
+    std::vector<int> rows; // Item indices, in list order
+    int scroll_offset;     // Scrolled independently of the other columns
+
+    BoardColumn() : scroll_offset(0) {}
+  };
+  BoardMode board_mode;
+  std::vector<BoardColumn> board_columns;
+  bool board_valid;         // board_columns matches items
+  int board_x_offset;       // Horizontal scroll when the columns don't fit
+  int board_drag_x;         // Pointer while a card is dragged
+  int board_drag_y;
+  static const int BOARD_HEADER_H = 36;
+  static const int BOARD_CARD_H = 56;
+  static const int BOARD_MIN_COLUMN_W = 180;
+
+  // Agenda view (F6): items with a due date, by day, for a week or a month
+  enum AgendaMode { AGENDA_OFF, AGENDA_WEEK, AGENDA_MONTH };
+  struct AgendaEntry {
+    unsigned id;
+    std::string text;
+    bool completed;
+  };
+  AgendaMode agenda_mode;
+  std::map<long, std::vector<AgendaEntry> > due_index; // Day -> items due
+  std::map<unsigned, long> due_day_of; // Item id -> day, for due_index
+  std::unordered_set<unsigned> due_unplaced; // Changed, position not known
+  bool due_index_valid;     // Kept up to date by update_due_index()
+  long agenda_day;          // A day of the week or month shown
+  unsigned agenda_drag_id;  // Item pressed in the agenda, 0 if none
+  bool agenda_dragging;
+  int agenda_drag_x;
+  int agenda_drag_y;
+  static const int AGENDA_TOP = 50;
+  static const int AGENDA_DAY_H = 20;
+  static const int AGENDA_LINE_H = 16;
+  bool first_frame_drawn;   // Startup work after the first frame is scheduled
+  bool window_visible;      // Shown and not iconified
+  bool window_focused;      // Keyboard focus is in this window
+  bool catch_up_pending;    // Changes arrived while hidden, not drawn yet
+  bool save_pending;        // Sample items still need saving
+  bool model_ready;         // Items loaded (false while showing the snapshot)
+  ModelEventBus &bus;       // model.bus
+  bool reorder_transaction_open; // A reorder drag batches its moves
+  bool primary;             // First window: loads the list, keeps the session
+  std::string base_title;   // Window title without the filter
+  std::string filter_tag;   // List only items with this tag (F4), or ""
+  int bus_token;            // Subscriptions to the model, ended on close
+  int save_token;
+
+  // State carried over from the previous session (see save_session)
+  struct ResumeState {
+    bool snapshot_valid; // Data file unchanged since the snapshot was taken
+    int scroll_offset;
+    int selected_index;  // Item indices; only valid with snapshot_valid
+    int editing_index;
+    int snapshot_w;
+    int snapshot_h;
+    std::vector<uchar> snapshot; // Downscaled RGB of the last frame
+    Fl_Image *scaled;            // snapshot scaled up to the window
+
+    ResumeState()
+        : snapshot_valid(false), scroll_offset(0), selected_index(-1),
+          editing_index(-1), snapshot_w(0), snapshot_h(0), scaled(nullptr) {}
+  } resume;
+
+  // A list the backend reads a window at a time (see
+  // StorageBackend::open_window) is shown that way instead of the snapshot:
+  // until it is loaded, the list view fetches the rows it draws and scrolls.
+  // The list loads LOAD_STEP items per step after the first frame.
+  static const int LOAD_STEP = 16384;
+  struct WindowedLoad {
+    bool active;
+    unsigned count;               // Items stored
+    unsigned open_count;          // Of which not completed
+    int first;                    // rows are list view rows [first, ...)
+    int shown;                    // Rows asked for
+    std::vector<TodoItem> rows;
+    std::vector<TodoItem> items;  // Loaded so far, in stored order
+
+    WindowedLoad()
+        : active(false), count(0), open_count(0), first(0), shown(0) {}
+  } loading;
+
+  // Error message display
+  struct ErrorDisplay {
+    std::string message;
+    bool is_visible;
+
+    ErrorDisplay() : message(""), is_visible(false) {}
+  } error_display;
+
+  // Calculate luminance of a color (0-255)
+  double get_luminance(Fl_Color color) {
+    unsigned char r, g, b;
+    Fl::get_color(color, r, g, b);
+    // Use relative luminance formula (ITU-R BT.709)
+    return 0.2126 * r + 0.7152 * g + 0.0722 * b;
+  }
+
+  // Get appropriate text color based on background color
+  Fl_Color get_text_color(Fl_Color bg_color) {
+    double luminance = get_luminance(bg_color);
+    // If background is bright (luminance > 128), use black text
+    // Otherwise use white text
+    return (luminance > 128) ? FL_BLACK : FL_WHITE;
+  }
+
+  // Get color based on position in list (red -> orange -> yellow gradient)
+  Fl_Color get_color_by_position(int position, int total_items) {
+    if (total_items <= 1) {
+      return FL_RED;
+    }
+
+    // Calculate ratio from 0.0 (top, red) to 1.0 (bottom, yellow)
+    double ratio = (double)position / (total_items - 1);
+
+    // Interpolate from red (255,0,0) -> orange (255,165,0) -> yellow
+    // (255,255,0)
+    unsigned char r, g, b;
+
+    if (ratio < 0.5) {
+      // Red to Orange (0.0 to 0.5)
+      double local_ratio = ratio * 2.0; // 0.0 to 1.0
+      r = 255;
+      g = (unsigned char)(165 * local_ratio);
+      b = 0;
+    } else {
+      // Orange to Yellow (0.5 to 1.0)
+      double local_ratio = (ratio - 0.5) * 2.0; // 0.0 to 1.0
+      r = 255;
+      g = (unsigned char)(165 + (255 - 165) * local_ratio);
+      b = 0;
+    }
+
+    return fl_rgb_color(r, g, b);
+  }
+
+  void show_error(const std::string &message) {
+    // Cancel any existing timeout to prevent multiple timers
+    Fl::remove_timeout(hide_error_cb, this);
+
+    error_display.message = message;
+    error_display.is_visible = true;
+    arm_error_timer();
+    redraw();
+  }
+
+  // Auto-hide after 3 seconds, counted only while the window is shown and
+  // focused so that an error is not gone before it could be read
+  void arm_error_timer() {
+    Fl::remove_timeout(hide_error_cb, this);
+    if (error_display.is_visible && window_visible && window_focused) {
+      Fl::add_timeout(3.0, hide_error_cb, this);
+    }
+  }
+
+  void hide_error() {
+    error_display.is_visible = false;
+    error_display.message = "";
+    Fl::remove_timeout(hide_error_cb, this);
+    redraw();
+  }
+
+  static void hide_error_cb(void *data) {
+    ClearApp *app = static_cast<ClearApp *>(data);
+    app->hide_error();
+  }
+
+  // Calculate text dimensions more accurately
+  void measure_text(const std::string &text, int &width, int &height,
+                    int font_size = 14) {
+    fl_font(FL_HELVETICA_BOLD, font_size);
+    width = (int)fl_width(text.c_str());
+    height = (int)fl_height();
+  }
+
+  // Draw rounded rectangle with specified color and corner radius
+  void draw_rounded_rect(int x, int y, int w, int h, int radius) {
+    // Draw four rounded corners using pie slices
+    // Top-left corner
+    batch.pie(x, y, radius * 2, radius * 2, 90, 180);
+    // Top-right corner
+    batch.pie(x + w - radius * 2, y, radius * 2, radius * 2, 0, 90);
+    // Bottom-right corner
+    batch.pie(x + w - radius * 2, y + h - radius * 2, radius * 2, radius * 2, 270,
+              360);
+    // Bottom-left corner
+    batch.pie(x, y + h - radius * 2, radius * 2, radius * 2, 180, 270);
+
+    // Draw rectangular parts (top, middle, bottom)
+    batch.rectf(x + radius, y, w - radius * 2, h);      // Middle vertical strip
+    batch.rectf(x, y + radius, radius, h - radius * 2); // Left strip
+    batch.rectf(x + w - radius, y + radius, radius, h - radius * 2); // Right strip
+  }
+
+  // Draw rounded rectangle border
+  void draw_rounded_rect_border(int x, int y, int w, int h, int radius) {
+    // Draw four corner arcs
+    batch.arc(x, y, radius * 2, radius * 2, 90, 180);                // Top-left
+    batch.arc(x + w - radius * 2, y, radius * 2, radius * 2, 0, 90); // Top-right
+    batch.arc(x + w - radius * 2, y + h - radius * 2, radius * 2, radius * 2, 270,
+              360); // Bottom-right
+    batch.arc(x, y + h - radius * 2, radius * 2, radius * 2, 180,
+              270); // Bottom-left
+
+    // Draw straight edges
+    batch.line(x + radius, y, x + w - radius, y);         // Top
+    batch.line(x + w, y + radius, x + w, y + h - radius); // Right
+    batch.line(x + w - radius, y + h, x + radius, y + h); // Bottom
+    batch.line(x, y + h - radius, x, y + radius);         // Left
+  }
+
+  // Another program saved the list too and items now hold both sets of
+  // changes; positions this view kept are meaningless
+  void model_replaced() {
+    board_valid = false;
+    due_index_valid = false;
+    clear_rows();
+    if (editing_index >= 0) {
+      editing_index = -1;
+      if (input_widget) {
+        input_widget->hide();
+      }
+    }
+    selected_index = -1;
+    clamp_scroll_offset();
+    redraw();
+  }
+
+  bool load_from_file() {
+    std::string error;
+    bool loaded_any = model.load(error);
+    if (!error.empty()) {
+      show_error(error);
+    }
+    return loaded_any; // Return true if we loaded at least one item
+  }
+
+  // Hand the list read by load_step() to the model, or load it again if it
+  // came up short or another program saved it meanwhile
+  bool load_from_window() {
+    std::vector<TodoItem> stored;
+    stored.swap(loading.items);
+    bool complete = stored.size() == loading.count;
+    loading = WindowedLoad();
+    if (complete && model.load_window(stored))
+      return !items.empty();
+    return load_from_file();
+  }
+
+  // Read the next LOAD_STEP items of the list; the last step loads it
+  void load_step() {
+    MemoryScope scope(MEM_MODEL);
+    size_t before = loading.items.size();
+    if (before < loading.count) {
+      model.storage->fetch_window(before, LOAD_STEP, ALL_ITEMS,
+                                  loading.items);
+    }
+    if (loading.items.size() > before &&
+        loading.items.size() < loading.count) {
+      Fl::add_timeout(0.0, load_step_cb, this);
+      return;
+    }
+    finish_resume();
+  }
+
+  static void load_step_cb(void *data) {
+    ClearApp *app = static_cast<ClearApp *>(data);
+    app->load_step();
+  }
+
+  // The list view while the list loads: the rows on screen, fetched from
+  // storage in the order get_sorted_indices() gives, open items first
+  void draw_window() {
+    int first = std::max(0, scroll_offset) / item_height;
+    int shown = h() / item_height + 2;
+    if (first != loading.first || shown != loading.shown) {
+      loading.rows.clear();
+      unsigned open = loading.open_count;
+      if ((unsigned)first < open) {
+        model.storage->fetch_window(first, shown, OPEN_ITEMS, loading.rows);
+      }
+      unsigned done = std::max<unsigned>(first, open) - open;
+      if (loading.rows.size() < (size_t)shown) {
+        model.storage->fetch_window(done, shown - loading.rows.size(),
+                                    COMPLETED_ITEMS, loading.rows);
+      }
+      loading.first = first;
+      loading.shown = shown;
+    }
+    for (size_t i = 0; i < loading.rows.size(); i++) {
+      const TodoItem &item = loading.rows[i];
+      int position = loading.first + i;
+      int y = position * item_height - scroll_offset;
+      Fl_Color item_color =
+          item.completed ? fl_rgb_color(64, 64, 64)
+                         : get_color_by_position(position, loading.count);
+      batch.color(item_color);
+      batch.rectf(0, y, w(), item_height);
+      draw_item_text(item, item_color, 20, y + item_height / 2 + 6);
+    }
+    prune_row_cache();
+  }
+
+  void add_sample_items() {
+    // Add sample items for first-time users
+    items.push_back(TodoItem("Welcome to Clear"));
+    items.push_back(TodoItem("Pull down to add new task"));
+    items.push_back(TodoItem("Click to edit task"));
+    items.push_back(TodoItem("Double-click to complete"));
+    items.push_back(TodoItem("Swipe right to delete"));
+    items.push_back(TodoItem("Long press to reorder"));
+  }
+
+  void draw_item(int index, int y, bool is_editing = false, int visual_position = -1, int total_visual_items = -1) {
+    if (index < 0 || index >= (int)items.size())
+      return;
+
+    TodoItem &item = items[index];
+    item.y_position = y;
+
+    int x_offset = item.swipe_offset;
+    int abs_offset = abs(x_offset);
+
+    // Get color based on position in list (not item's stored color)
+    // For completed items, use dark gray instead
+    Fl_Color item_color;
+    if (item.completed) {
+      item_color = fl_rgb_color(64, 64, 64); // Dark gray for completed items
+    } else {
+      // Use visual position if provided (for sorted display), otherwise use actual index
+      if (visual_position >= 0 && total_visual_items > 0) {
+        item_color = get_color_by_position(visual_position, total_visual_items);
+      } else {
+        item_color = get_color_by_position(index, items.size());
+      }
+    }
+
+    // Draw swipe background based on direction
+    if (x_offset > 0) {
+      // Swiped right (finger moves right) - item moves right, show complete
+      // background (green) on left
+      int right_offset = abs_offset;
+      if (right_offset > w())
+        right_offset = w();
+      batch.color(FL_GREEN);
+      batch.rectf(0, y, right_offset, item_height);
+      batch.color(FL_WHITE);
+      batch.font(FL_HELVETICA_BOLD, 16);
+      batch.text("COMPLETE", right_offset / 2 - 40, y + item_height / 2 + 5);
+    } else if (x_offset < 0) {
+      // Swiped left (finger moves left) - item moves left, show delete
+      // background (red) on right
+      int left_offset = abs_offset;
+      if (left_offset > w())
+        left_offset = w();
+      batch.color(FL_RED);
+      batch.rectf(w() - left_offset, y, left_offset, item_height);
+      batch.color(FL_WHITE);
+      batch.font(FL_HELVETICA_BOLD, 16);
+      batch.text("DELETE", w() - left_offset / 2 - 30, y + item_height / 2 + 5);
+    }
+
+    // Draw colored background (shifted by swipe)
+    int bg_x = (x_offset > 0) ? abs_offset : 0;
+    int bg_w = w() - abs_offset;
+    if (bg_w < 0)
+      bg_w = 0;
+
+    if (is_editing) {
+      // When editing, only draw background in the left 20px padding area
+      // Fl_Input widget will handle the rest
+      batch.color(item_color);
+      batch.rectf(bg_x, y, 20, item_height);
+    } else if (x_offset == 0 &&
+               (smooth_gradient ||
+                (use_glyph_atlas && scaled->atlas.can_render(item.text)))) {
+      // Not swiped: blit the composed row image. Text the atlas can't
+      // render is drawn on top of it.
+      bool text_in_image = use_glyph_atlas && !rich_text(item).formatted &&
+                           scaled->atlas.can_render(item.text);
+      int gradient_position = -1;
+      int gradient_total = 0;
+      if (smooth_gradient && !item.completed) {
+        if (visual_position >= 0 && total_visual_items > 0) {
+          gradient_position = visual_position;
+          gradient_total = total_visual_items;
+        } else {
+          gradient_position = index;
+          gradient_total = items.size();
+        }
+      }
+      const RowImage &row = get_row_image(index, item_color, gradient_position,
+                                          gradient_total, text_in_image);
+      batch.image(&row.pixels[0], 0, y, row.width, row.height,
+                  scaled->scale);
+      if (!text_in_image) {
+        draw_item_text(item, item_color, 20, y + item_height / 2 + 6);
+      }
+    } else {
+      // When not editing, draw full background and text
+      batch.color(item_color);
+      batch.rectf(bg_x, y, bg_w, item_height);
+
+      int text_x = (x_offset > 0) ? (abs_offset + 20) : (bg_x + 20);
+      int text_y = y + item_height / 2 + 6;
+      draw_item_text(item, item_color, text_x, text_y);
+    }
+
+    int right = bg_x + bg_w;
+    const RichText &rich = rich_text(item);
+    if (!is_editing && !rich.attachment.empty()) {
+      right -= TodoModel::THUMB_SIZE + 8;
+      draw_thumbnail(rich.attachment, right,
+                     y + (item_height - TodoModel::THUMB_SIZE) / 2);
+    }
+    if (!is_editing && !item.notes_hash.empty()) {
+      // Notes marker: three short lines at the right end of the row
+      int marker_x = right - 34;
+      int mid = y + item_height / 2;
+      batch.color(get_text_color(item_color));
+      for (int line = -1; line <= 1; line++) {
+        batch.line(marker_x, mid + line * 5, marker_x + 14, mid + line * 5);
+      }
+    }
+  }
+
+  // Draw item text with fl_draw, with strikethrough for completed items
+  void draw_item_text(const TodoItem &item, Fl_Color item_color, int text_x,
+                      int text_y) {
+    RichText &rich = rich_text(item);
+    if (rich.formatted) {
+      draw_rich_text(rich, item, item_color, text_x, text_y);
+      return;
+    }
+    // Draw text with appropriate color based on background
+    Fl_Color text_color = get_text_color(item_color);
+    batch.color(text_color);
+    batch.font(FL_HELVETICA_BOLD, 18);
+
+    std::string display_text = item.text;
+    if (item.completed) {
+      // display_text = "✓ " + display_text;
+    }
+
+    // Draw text
+    batch.text(display_text.c_str(), text_x, text_y);
+
+    // Draw strikethrough for completed items
+    if (item.completed) {
+      int text_w, text_h;
+      if (scaled->atlas.can_render(display_text)) {
+        text_w = (int)(scaled->atlas.text_width(display_text) / scaled->scale);
+        text_h = (int)(scaled->atlas.line_height() / scaled->scale);
+      } else {
+        measure_text(display_text, text_w, text_h, 18);
+      }
+      // Draw strikethrough line with same color as text
+      batch.line(text_x, text_y - text_h / 2, text_x + text_w, text_y - text_h / 2);
+    }
+  }
+
+  // An attachment's thumbnail, or a placeholder while the loader decodes
+  // it. Never decodes here.
+  void draw_thumbnail(const std::string &name, int x, int y) {
+    const int size = TodoModel::THUMB_SIZE;
+    const Thumbnail *thumb = model.thumbnails.get(name);
+    if (!thumb) {
+      model.thumbnail_loader.request(name);
+    } else if (thumb->width > 0) {
+      batch.image(&thumb->pixels[0], x + (size - thumb->width) / 2,
+                  y + (size - thumb->height) / 2, thumb->width,
+                  thumb->height);
+      return;
+    }
+    batch.color(fl_rgb_color(200, 200, 200));
+    batch.rectf(x, y, size, size);
+    batch.color(fl_rgb_color(150, 150, 150));
+    batch.line(x, y, x + size - 1, y + size - 1);
+    batch.line(x, y + size - 1, x + size - 1, y);
+  }
+
+  // An image file dropped on a row: copy it into the attachment store and
+  // point the item's attachment word at it
+  void attach_file(const std::string &path, int y) {
+    int index = get_item_at_y(y);
+    if (index < 0)
+      return;
+    if (model.storage->confidential()) {
+      show_error("Attachments are not available with encrypted storage");
+      return;
+    }
+    std::string suffix;
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos) {
+      for (size_t i = dot; i < path.size(); i++) {
+        suffix += (char)tolower((unsigned char)path[i]);
+      }
+    }
+    if (suffix != ".png" && suffix != ".jpg" && suffix != ".jpeg") {
+      show_error("Only PNG and JPEG images can be attached: " + path);
+      return;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    std::string data;
+    if (file.is_open()) {
+      data.assign((std::istreambuf_iterator<char>(file)),
+                  std::istreambuf_iterator<char>());
+    }
+    if (!file.is_open() || file.bad() || data.empty()) {
+      show_error("Error reading file: " + path);
+      return;
+    }
+    std::string name, error;
+    if (!model.attachments.put(data, name, error, suffix)) {
+      show_error(error);
+      return;
+    }
+    ModelTransaction transaction(bus);
+    items[index].set_text(replace_attachment(items[index].text, name));
+    bus.emit(ModelChange(ModelChange::UPDATE_TEXT, items[index].id, index));
+  }
+
+  // First path in dropped text: a path or a file:// URI per line
+  static std::string dropped_path(const char *text, int length) {
+    std::string line(text, length);
+    line = line.substr(0, line.find_first_of("\r\n"));
+    if (line.compare(0, 7, "file://") != 0)
+      return line;
+    std::string path;
+    for (size_t i = line.find('/', 7); i < line.size(); i++) {
+      if (line[i] == '%' && i + 2 < line.size() &&
+          isxdigit((unsigned char)line[i + 1]) &&
+          isxdigit((unsigned char)line[i + 2])) {
+        path += (char)strtol(line.substr(i + 1, 2).c_str(), nullptr, 16);
+        i += 2;
+      } else {
+        path += line[i];
+      }
+    }
+    return path;
+  }
+
+  // Ctrl+F: open or close the find and replace panel
+  void toggle_find() {
+    end_reorder();
+    show_find = !show_find;
+    if (!show_find) {
+      find_input->hide();
+      replace_input->hide();
+      take_focus();
+      redraw();
+      return;
+    }
+    if (editing_index >= 0) {
+      finish_editing();
+    }
+    close_notes();
+    if (!find_input) {
+      find_input = new Fl_Input(0, 0, 0, 0);
+      find_input->callback(find_changed_cb, this);
+      find_input->when(FL_WHEN_CHANGED);
+      replace_input = new Fl_Input(0, 0, 0, 0);
+      replace_input->callback(replace_entered_cb, this);
+      replace_input->when(FL_WHEN_ENTER_KEY_ALWAYS);
+      add(find_input);
+      add(replace_input);
+    }
+    place_find_widgets();
+    find_input->show();
+    replace_input->show();
+    find_input->take_focus();
+    update_find_preview();
+  }
+
+  void place_find_widgets() {
+    int input_w = (w() - FIND_INFO_W - 30) / 2;
+    find_input->resize(10, 8, input_w, 28);
+    replace_input->resize(20 + input_w, 8, input_w, 28);
+  }
+
+  static void find_changed_cb(Fl_Widget *, void *data) {
+    ((ClearApp *)data)->update_find_preview();
+  }
+
+  static void replace_entered_cb(Fl_Widget *, void *data) {
+    ((ClearApp *)data)->replace_all();
+  }
+
+  bool compile_find(TextReplacer &replacer) {
+    std::string error;
+    find_invalid = !replacer.compile(find_input->value(),
+                                     replace_input->value(), find_regex,
+                                     error);
+    if (find_invalid) {
+      find_status = error;
+      redraw();
+    }
+    return !find_invalid;
+  }
+
+  // Live preview: count the matches of the find pattern in every item
+  void update_find_preview() {
+    TextReplacer replacer;
+    if (!compile_find(replacer))
+      return;
+    std::vector<size_t> counts(items.size());
+    parallel_for(items.size(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        counts[i] = replacer.apply(items[i].text, nullptr);
+      }
+    });
+    size_t matches = 0, matched_items = 0;
+    for (size_t count : counts) {
+      matches += count;
+      matched_items += count ? 1 : 0;
+    }
+    find_status = std::to_string(matches) + " in " +
+                  std::to_string(matched_items) + " items";
+    redraw();
+  }
+
+  // Enter in the replace field: replace every match in every item as one
+  // transaction, so the list is saved once and views update once. The
+  // new texts are computed in parallel, then applied here.
+  void replace_all() {
+    TextReplacer replacer;
+    if (!compile_find(replacer))
+      return;
+    std::vector<std::string> replaced(items.size());
+    std::vector<char> changed(items.size());
+    parallel_for(items.size(), [&](size_t begin, size_t end) {
+      MemoryScope scope(MEM_TEXT);
+      for (size_t i = begin; i < end; i++) {
+        changed[i] = replacer.apply(items[i].text, &replaced[i]) > 0 &&
+                     replaced[i] != items[i].text;
+      }
+    });
+
+    size_t count = 0;
+    {
+      ModelTransaction transaction(bus);
+      last_replace.clear();
+      for (size_t i = 0; i < items.size(); i++) {
+        if (!changed[i])
+          continue;
+        {
+          MemoryScope scope(MEM_UNDO);
+          ReplacedText undo;
+          undo.id = items[i].id;
+          undo.before = items[i].text;
+          undo.after = replaced[i];
+          last_replace.push_back(undo);
+        }
+        items[i].set_text(replaced[i]);
+        bus.emit(ModelChange(ModelChange::UPDATE_TEXT, items[i].id, i));
+        count++;
+      }
+    }
+    find_status = "Replaced in " + std::to_string(count) +
+                  " items, Ctrl+Z undoes";
+    redraw();
+  }
+
+  // Ctrl+Z: put back the texts of the last replace-all, except items
+  // edited or deleted since. Returns false if there is nothing to undo.
+  bool undo_replace() {
+    if (last_replace.empty())
+      return false;
+    std::unordered_map<unsigned, size_t> index_of;
+    for (size_t i = 0; i < items.size(); i++) {
+      index_of[items[i].id] = i;
+    }
+    ModelTransaction transaction(bus);
+    for (const ReplacedText &undo : last_replace) {
+      auto found = index_of.find(undo.id);
+      if (found == index_of.end() || items[found->second].text != undo.after)
+        continue;
+      items[found->second].set_text(undo.before);
+      bus.emit(ModelChange(ModelChange::UPDATE_TEXT, undo.id, found->second));
+    }
+    last_replace.clear();
+    return true;
+  }
+
+  // The panel's inputs get clicks on it; the mode toggle sits at the right
+  // and Escape closes it
+  int handle_find_event(int event) {
+    switch (event) {
+    case FL_PUSH:
+      find_pressed = Fl::event_y() < FIND_H;
+      if (!find_pressed)
+        return 0;
+      if (Fl::event_x() >= w() - FIND_INFO_W) {
+        find_regex = !find_regex;
+        update_find_preview();
+        return 1;
+      }
+      Fl_Window::handle(event);
+      return 1;
+    case FL_DRAG:
+    case FL_RELEASE:
+      if (!find_pressed)
+        return 0;
+      Fl_Window::handle(event);
+      return 1;
+    case FL_KEYBOARD:
+      if (Fl::event_key() == FL_Escape) {
+        toggle_find();
+        return 1;
+      }
+      return 0;
+    }
+    return 0;
+  }
+
+  void draw_find_panel() {
+    place_find_widgets();
+    batch.color(fl_rgb_color(40, 40, 40));
+    batch.rectf(0, 0, w(), FIND_H);
+    int info_x = w() - FIND_INFO_W + 6;
+    batch.font(FL_HELVETICA_BOLD, 12);
+    batch.color(find_regex ? fl_rgb_color(120, 200, 255)
+                           : fl_rgb_color(180, 180, 180));
+    batch.text(find_regex ? "Regex (click for text)" : "Text (click for regex)",
+               info_x, 18);
+    batch.font(FL_HELVETICA, 12);
+    batch.color(find_invalid ? fl_rgb_color(255, 120, 120) : FL_WHITE);
+    batch.text(find_status.c_str(), info_x, 35);
+  }
+
+  // Spans of the item's text, parsed when the text last changed
+  RichText &rich_text(const TodoItem &item) {
+    MemoryScope scope(MEM_LAYOUT);
+    RichText &rich = text_layouts[item.id];
+    if (!rich.parsed || rich.source != item.text) {
+      rich.parse(item.text);
+    }
+    rich.last_frame = row_frame;
+    return rich;
+  }
+
+  // Spans keep the font of plain rows (FL_HELVETICA_BOLD); code uses its
+  // monospaced counterpart. That font is already bold, so **bold** spans
+  // are drawn twice, a pixel apart, to look heavier.
+  static Fl_Font span_font(unsigned style) {
+    return (style & TextSpan::CODE) ? FL_COURIER_BOLD : FL_HELVETICA_BOLD;
+  }
+
+  // Lay out the spans left to right in the row font size
+  void measure_rich_text(RichText &rich) {
+    if (rich.measured)
+      return;
+    int x = 0;
+    for (TextSpan &span : rich.spans) {
+      fl_font(span_font(span.style), 18);
+      span.x = x;
+      span.width = (int)fl_width(span.text.c_str());
+      if (span.style & TextSpan::BOLD)
+        span.width++; // The second copy
+      x += span.width;
+    }
+    rich.width = x;
+    rich.measured = true;
+  }
+
+  // Draw formatted text span by span. Code gets a shaded box, bold spans a
+  // second copy, links are underlined and struck spans (or the whole
+  // completed item) crossed out.
+  void draw_rich_text(RichText &rich, const TodoItem &item,
+                      Fl_Color item_color, int text_x, int text_y) {
+    measure_rich_text(rich);
+    Fl_Color text_color = get_text_color(item_color);
+    Fl_Color link_color =
+        text_color == FL_WHITE ? fl_rgb_color(200, 230, 255) : FL_BLUE;
+    int mid = text_y - 6;
+    for (const TextSpan &span : rich.spans) {
+      int x = text_x + span.x;
+      if (span.style & TextSpan::CODE) {
+        batch.color(fl_color_average(item_color, text_color, 0.8f));
+        batch.rectf(x, text_y - 16, span.width, 21);
+      }
+      Fl_Color color = (span.style & TextSpan::LINK) ? link_color : text_color;
+      batch.color(color);
+      batch.font(span_font(span.style), 18);
+      batch.text(span.text.c_str(), x, text_y);
+      if (span.style & TextSpan::BOLD) {
+        batch.text(span.text.c_str(), x + 1, text_y);
+      }
+      if (span.style & TextSpan::LINK) {
+        batch.line(x, text_y + 2, x + span.width, text_y + 2);
+      }
+      if ((span.style & TextSpan::STRIKE) && !item.completed) {
+        batch.line(x, mid, x + span.width, mid);
+      }
+    }
+    if (item.completed) {
+      batch.color(text_color);
+      batch.line(text_x, mid, text_x + rich.width, mid);
+    }
+  }
+
+  // Open the link under (mx, my) in the list, if there is one. Uses the span
+  // geometry cached by the last draw.
+  bool open_link_at(int index, int mx) {
+    const TodoItem &item = items[index];
+    auto found = text_layouts.find(item.id);
+    if (found == text_layouts.end() || found->second.source != item.text ||
+        item.swipe_offset != 0)
+      return false;
+    const TextSpan *link = found->second.link_at(mx - 20);
+    if (!link)
+      return false;
+    char message[256] = "";
+    if (!fl_open_uri(link->text.c_str(), message, sizeof(message))) {
+      show_error("Failed to open link: " + link->text +
+                 (message[0] ? std::string(" (") + message + ")" : ""));
+    }
+    return true;
+  }
+
+  // Keep the composed rows of about two screens; rows scrolled out of view
+  // long ago are dropped. Span layouts follow the same rule. Rows of other
+  // scales go at once, their glyphs once unused for a while.
+  void prune_row_cache() {
+    size_t keep = 2 * (h() / item_height + 2);
+    std::unordered_map<unsigned, RowImage> &rows = scaled->rows;
+    if (rows.size() > keep) {
+      for (auto row = rows.begin(); row != rows.end();) {
+        if (row->second.last_frame != row_frame) {
+          row = rows.erase(row);
+        } else {
+          ++row;
+        }
+      }
+    }
+    for (auto set = scaled_rows.begin(); set != scaled_rows.end();) {
+      if (&set->second != scaled) {
+        set->second.rows.clear();
+        if (row_frame - set->second.last_frame > SCALE_KEEP_FRAMES) {
+          set = scaled_rows.erase(set);
+          continue;
+        }
+      }
+      ++set;
+    }
+    if (text_layouts.size() > keep) {
+      for (auto rich = text_layouts.begin(); rich != text_layouts.end();) {
+        if (rich->second.last_frame != row_frame) {
+          rich = text_layouts.erase(rich);
+        } else {
+          ++rich;
+        }
+      }
+    }
+    row_frame++;
+  }
+
+  // Return the composed image for a non-swiped, non-editing row, composing
+  // it if the cached one is stale. A gradient_position >= 0 fills the
+  // background from the smooth gradient ramp instead of item_color.
+  const RowImage &get_row_image(int index, Fl_Color item_color,
+                                int gradient_position, int gradient_total,
+                                bool with_text) {
+    MemoryScope scope(MEM_ROW_IMAGES);
+    const TodoItem &item = items[index];
+    Fl_Color text_color = get_text_color(item_color);
+    RowImage &row = scaled->rows[item.id];
+    row.last_frame = row_frame;
+    int row_w = scaled->pixels(w());
+    int row_h = scaled->pixels(item_height);
+    if (row.matches(item, item_color, text_color, row_w, row_h,
+                    gradient_position, gradient_total, with_text)) {
+      return row;
+    }
+
+    row.text = with_text ? item.text : std::string();
+    row.bg_color = item_color;
+    row.text_color = text_color;
+    row.completed = item.completed;
+    row.width = row_w;
+    row.height = row_h;
+    row.gradient_position = gradient_position;
+    row.gradient_total = gradient_total;
+    row.has_text = with_text;
+    row.pixels.resize(row.width * row.height * 3);
+
+    unsigned char r, g, b;
+    if (gradient_position >= 0) {
+      std::vector<uchar> green(row_h);
+      gradient_green(gradient_total, row_h, gradient_position * row_h, row_h,
+                     &green[0]);
+      for (int y = 0; y < row.height; y++) {
+        uchar *line = &row.pixels[y * row.width * 3];
+        for (int x = 0; x < row.width * 3; x += 3) {
+          line[x] = 255;
+          line[x + 1] = green[y];
+          line[x + 2] = 0;
+        }
+      }
+    } else {
+      Fl::get_color(item_color, r, g, b);
+      for (size_t i = 0; i < row.pixels.size(); i += 3) {
+        row.pixels[i] = r;
+        row.pixels[i + 1] = g;
+        row.pixels[i + 2] = b;
+      }
+    }
+
+    if (!with_text) {
+      return row;
+    }
+
+    // Same text origin as the fl_draw path in draw_item()
+    const GlyphAtlas &atlas = scaled->atlas;
+    int text_x = scaled->pixels(20);
+    int baseline = scaled->pixels(item_height / 2 + 6);
+    Fl::get_color(text_color, r, g, b);
+    atlas.compose(&row.pixels[0], row.width, row.height, text_x, baseline,
+                  item.text, r, g, b);
+
+    if (item.completed) {
+      // Strikethrough, one pixel high, through the middle of the text
+      int line_y = baseline - atlas.line_height() / 2;
+      int line_end = std::min(text_x + atlas.text_width(item.text),
+                              row.width - 1);
+      if (line_y >= 0 && line_y < row.height) {
+        for (int x = text_x; x <= line_end; x++) {
+          uchar *p = &row.pixels[(line_y * row.width + x) * 3];
+          p[0] = r;
+          p[1] = g;
+          p[2] = b;
+        }
+      }
+    }
+    return row;
+  }
+
+  // Get sorted indices (incomplete first, then completed)
+  std::vector<int> get_sorted_indices() {
+    std::vector<int> indices;
+    // First add incomplete items
+    for (size_t i = 0; i < items.size(); i++) {
+      if (!items[i].completed && listed(i)) {
+        indices.push_back(i);
+      }
+    }
+    // Then add completed items
+    for (size_t i = 0; i < items.size(); i++) {
+      if (items[i].completed && listed(i)) {
+        indices.push_back(i);
+      }
+    }
+    return indices;
+  }
+
+  int get_item_at_y(int y) {
+    int start_y = 0; // Start from top
+    // Adjust y coordinate for scroll offset
+    int adjusted_y = y + scroll_offset;
+    if (adjusted_y < start_y)
+      return -1; // Above first item
+    int visual_index = (adjusted_y - start_y) / item_height;
+    
+    // Get sorted indices to map visual position to actual index
+    std::vector<int> sorted_indices = get_sorted_indices();
+    if (visual_index >= 0 && visual_index < (int)sorted_indices.size()) {
+      return sorted_indices[visual_index];
+    }
+    return -1;
+  }
+
+  // Get maximum scroll offset (how far we can scroll down)
+  int get_max_scroll_offset() {
+    int total_height = listed_count() * item_height;
+    int visible_height = h() - 40; // Subtract space for instructions at bottom
+    int max_scroll = total_height - visible_height;
+    return (max_scroll > 0) ? max_scroll : 0;
+  }
+
+  // Clamp scroll offset to valid range
+  void clamp_scroll_offset() {
+    int max_scroll = get_max_scroll_offset();
+    if (scroll_offset < 0) {
+      scroll_offset = 0;
+    } else if (scroll_offset > max_scroll) {
+      scroll_offset = max_scroll;
+    }
+  }
+
+  void reorder_items(int from_index, int to_index) {
+    if (from_index < 0 || from_index >= (int)items.size() || to_index < 0 ||
+        to_index >= (int)items.size() || from_index == to_index) {
+      return;
+    }
+
+    TodoItem item = items[from_index];
+    items.erase(items.begin() + from_index);
+    items.insert(items.begin() + to_index, item);
+    bus.emit(ModelChange(ModelChange::MOVE, item.id, to_index, from_index));
+  }
+
+public:
+  // The first window loads the list and restores the previous session;
+  // further windows (F5) open on the same model
+  ClearApp(int W, int H, const char *title, TodoModel &shared_model,
+           bool primary_window = true)
+      : Fl_Window(W, H, title), model(shared_model), items(model.items),
+        selected_index(-1), is_dragging(false),
+        is_swiping(false), is_pulling_down(false), pull_down_offset(0),
+        drag_offset(0), item_height(60), editing_index(-1),
+        speculative_edit_index(-1), can_reorder(false), input_widget(nullptr),
+        notes_input(nullptr), notes_item_id(0), drop_y(-1), show_find(false),
+        find_input(nullptr), replace_input(nullptr), find_regex(false),
+        find_invalid(false), find_pressed(false),
+        scroll_offset(0), scaled(nullptr), row_frame(0),
+        layout_w(W), layout_h(H),
+        use_glyph_atlas(true), smooth_gradient(false),
+        show_hud(false), metrics_interval(0),
+        metrics_failing(false), show_trash(false),
+        trash_scroll(0), board_mode(BOARD_OFF), board_valid(false),
+        board_x_offset(0), board_drag_x(0), board_drag_y(0),
+        agenda_mode(AGENDA_OFF), due_index_valid(false), agenda_day(0),
+        agenda_drag_id(0), agenda_dragging(false), agenda_drag_x(0),
+        agenda_drag_y(0),
+        first_frame_drawn(false), window_visible(false),
+        window_focused(false), catch_up_pending(false),
+        save_pending(false), model_ready(false), bus(model.bus),
+        reorder_transaction_open(false), primary(primary_window),
+        base_title(title) {
+    color(fl_rgb_color(64, 64, 64));  // deep gray
+    callback(window_close_cb, this);
+    resizable(this);
+    size_range(360, 300);
+    subscribe_model_consumers();
+
+    if (!primary) {
+      model_ready = model.loaded;
+      end();
+      return;
+    }
+
+    // The input widget is created on the first edit (ensure_input_widget)
+
+    // With a valid snapshot of the last session, show it first and load the
+    // list after the first frame; a list read a window at a time shows its
+    // rows instead. Otherwise load now.
+    load_session();
+    if (model.storage->open_window(loading.count, loading.open_count)) {
+      loading.active = true;
+      scroll_offset = resume.scroll_offset;
+      clamp_scroll_offset();
+    } else if (!resume.snapshot_valid) {
+      load_model();
+      scroll_offset = resume.scroll_offset;
+      clamp_scroll_offset();
+    }
+
+    end();
+  }
+
+  // Path of a file in the application data directory
+  std::string data_path(const std::string &name) const {
+    return model.data_path(name);
+  }
+
+  void load_model() {
+    // Load items from file, or take those read a window at a time
+    bool loaded = loading.active ? load_from_window() : load_from_file();
+    startup_profile.mark("load_from_file");
+
+    // If no items loaded (first run), add sample items. They are saved
+    // after the first frame is on screen.
+    if (!loaded || items.empty()) {
+      add_sample_items();
+      save_pending = true;
+      model.unsaved = true; // Saved on exit if closed before that
+    }
+    model_ready = true;
+  }
+
+  // Read session.txt and, if the data file is unchanged, session.ppm
+  void load_session() {
+    std::ifstream file(data_path("session.txt"));
+    if (!file.is_open()) {
+      return;
+    }
+
+    long long data_size = -1, data_stamp = -1;
+    std::string line;
+    while (std::getline(file, line)) {
+      size_t eq = line.find('=');
+      if (eq == std::string::npos)
+        continue;
+      std::string key = line.substr(0, eq);
+      std::istringstream value(line.substr(eq + 1));
+      if (key == "scroll_offset") {
+        value >> resume.scroll_offset;
+      } else if (key == "selected") {
+        value >> resume.selected_index;
+      } else if (key == "editing") {
+        value >> resume.editing_index;
+      } else if (key == "data_size") {
+        value >> data_size;
+      } else if (key == "data_stamp") {
+        value >> data_stamp;
+      } else if (key == "snapshot") {
+        value >> resume.snapshot_w >> resume.snapshot_h;
+      }
+    }
+
+    long long size, stamp;
+    if (!model.storage->signature(size, stamp) || size != data_size ||
+        stamp != data_stamp) {
+      resume.selected_index = -1;
+      resume.editing_index = -1;
+      return;
+    }
+
+    // Binary PPM written by save_session()
+    std::ifstream image(data_path("session.ppm"), std::ios::binary);
+    std::string magic;
+    int image_w = 0, image_h = 0, max_value = 0;
+    image >> magic >> image_w >> image_h >> max_value;
+    image.get(); // Single whitespace before the pixel data
+    if (!image || magic != "P6" || max_value != 255 || image_w <= 0 ||
+        image_h <= 0 || image_w != resume.snapshot_w ||
+        image_h != resume.snapshot_h) {
+      return;
+    }
+    resume.snapshot.resize(image_w * image_h * 3);
+    image.read((char *)&resume.snapshot[0], resume.snapshot.size());
+    if (image.gcount() != (std::streamsize)resume.snapshot.size()) {
+      resume.snapshot.clear();
+      return;
+    }
+    resume.snapshot_valid = true;
+  }
+
+  // Render the current frame offscreen and downscale it by two
+  bool capture_snapshot(std::vector<uchar> &pixels, int &snap_w, int &snap_h) {
+    if (!shown() || w() < 2 || h() < 2) {
+      return false;
+    }
+    make_current();
+    Fl_Offscreen offscreen = fl_create_offscreen(w(), h());
+    if (!offscreen) {
+      return false;
+    }
+    std::vector<uchar> frame(w() * h() * 3);
+    fl_begin_offscreen(offscreen);
+    draw();
+    fl_read_image(&frame[0], 0, 0, w(), h());
+    fl_end_offscreen();
+    fl_delete_offscreen(offscreen);
+
+    // Average each 2x2 block
+    snap_w = w() / 2;
+    snap_h = h() / 2;
+    pixels.resize(snap_w * snap_h * 3);
+    for (int y = 0; y < snap_h; y++) {
+      for (int x = 0; x < snap_w; x++) {
+        const uchar *top = &frame[((y * 2) * w() + x * 2) * 3];
+        const uchar *bottom = top + w() * 3;
+        for (int c = 0; c < 3; c++) {
+          pixels[(y * snap_w + x) * 3 + c] =
+              (uchar)((top[c] + top[c + 3] + bottom[c] + bottom[c + 3]) / 4);
+        }
+      }
+    }
+    return true;
+  }
+
+  // Persist scroll position, selection, the item being edited and a small
+  // image of the last frame, to be restored by the next launch
+  void save_session() {
+    if (!model.persistence_enabled || !model_ready) {
+      return;
+    }
+
+    // Commit the edit so the data file is final before it is fingerprinted
+    int editing = editing_index;
+    if (editing >= 0) {
+      finish_editing();
+      if (editing >= (int)items.size() || items[editing].text.empty()) {
+        editing = -1;
+      }
+    }
+
+    std::vector<uchar> pixels;
+    int snap_w = 0, snap_h = 0;
+    bool have_snapshot = capture_snapshot(pixels, snap_w, snap_h);
+    long long size = 0, stamp = 0;
+    bool have_signature = model.storage->signature(size, stamp);
+
+    std::ofstream file(data_path("session.txt"));
+    if (!file.is_open()) {
+      return;
+    }
+    file << "scroll_offset=" << scroll_offset << "\n";
+    file << "selected=" << selected_index << "\n";
+    file << "editing=" << editing << "\n";
+    if (have_snapshot && have_signature) {
+      file << "data_size=" << size << "\n";
+      file << "data_stamp=" << stamp << "\n";
+      file << "snapshot=" << snap_w << " " << snap_h << "\n";
+
+      std::ofstream image(data_path("session.ppm"), std::ios::binary);
+      image << "P6\n" << snap_w << " " << snap_h << "\n255\n";
+      image.write((const char *)&pixels[0], pixels.size());
+    }
+  }
+
+  // Swap the snapshot for the live list and restore the session state. Where
+  // the list was scrolled while it loaded, it stays there.
+  void finish_resume() {
+    int offset = loading.active ? scroll_offset : resume.scroll_offset;
+    load_model();
+
+    scroll_offset = offset;
+    clamp_scroll_offset();
+    if (resume.selected_index < (int)items.size()) {
+      selected_index = resume.selected_index;
+    }
+    if (resume.editing_index >= 0 &&
+        resume.editing_index < (int)items.size()) {
+      start_editing(resume.editing_index);
+    }
+
+    delete resume.scaled;
+    resume.scaled = nullptr;
+    resume.snapshot.clear();
+    resume.snapshot.shrink_to_fit();
+    redraw();
+  }
+
+  static void window_close_cb(Fl_Widget *widget, void *data) {
+    ClearApp *app = static_cast<ClearApp *>(data);
+    app->end_reorder();
+    if (app->primary) {
+      app->save_session();
+      app->hide();
+    } else {
+      app->hide();
+      Fl::delete_widget(app);
+    }
+  }
+
+  ~ClearApp() {
+    end_reorder();
+    bus.unsubscribe(bus_token);
+    model.unobserve_saves(save_token);
+    Fl::remove_timeout(redraw_cb, this);
+    Fl::remove_timeout(load_step_cb, this);
+  }
+
+  // Views update once per transaction, after every change of a user action
+  // has been applied and the model has saved it
+  void subscribe_model_consumers() {
+    bus_token = bus.subscribe(
+        [this](const ChangeSet &changes) { model_changed(changes); });
+    save_token = model.observe_saves(
+        [this](const std::string &error, bool merged) {
+          if (!error.empty()) {
+            show_error(error);
+          }
+          if (merged) {
+            model_replaced();
+          }
+        });
+  }
+
+  // Where an item index ends up after changes
+  static int remap_index(int index, const ChangeSet &changes) {
+    for (const ModelChange &change : changes.changes) {
+      if (index < 0)
+        break;
+      if (change.kind == ModelChange::INSERT) {
+        if (change.index <= index)
+          index++;
+      } else if (change.kind == ModelChange::REMOVE) {
+        if (change.index == index)
+          index = -1;
+        else if (change.index < index)
+          index--;
+      } else if (change.kind == ModelChange::MOVE) {
+        if (change.from_index == index) {
+          index = change.index;
+        } else {
+          if (change.from_index < index)
+            index--;
+          if (change.index <= index)
+            index++;
+        }
+      }
+    }
+    return index;
+  }
+
+  // Drop only what the changes affect: the rows of changed items, and the
+  // positions this view holds if another window moved items
+  void model_changed(const ChangeSet &changes) {
+    if (model.origin != this && changes.structural()) {
+      selected_index = remap_index(selected_index, changes);
+      speculative_edit_index = remap_index(speculative_edit_index, changes);
+      if (editing_index >= 0) {
+        editing_index = remap_index(editing_index, changes);
+        if (editing_index < 0 && input_widget) {
+          input_widget->hide(); // Deleted in another window
+        }
+      }
+      clamp_scroll_offset();
+    }
+    for (const ModelChange &change : changes.changes) {
+      if (change.kind == ModelChange::UPDATE_TEXT ||
+          change.kind == ModelChange::TOGGLE ||
+          change.kind == ModelChange::REMOVE) {
+        forget_row(change.item_id);
+      }
+      if (change.kind == ModelChange::UPDATE_TEXT ||
+          change.kind == ModelChange::REMOVE) {
+        text_layouts.erase(change.item_id);
+      }
+      if (change.kind == ModelChange::REMOVE &&
+          change.item_id == notes_item_id) {
+        close_notes(); // Deleted in another window
+      }
+    }
+    update_due_index(changes);
+    update_board(changes);
+    if (!window_visible) {
+      catch_up_pending = true; // Preview and draw once shown again
+      return;
+    }
+    if (show_find) {
+      update_find_preview();
+    }
+    redraw();
+  }
+
+  // Track whether the window is on screen and has the focus. While it is
+  // hidden (iconified), changes from other windows and the scheduler are
+  // only noted; showing it again catches up with a single redraw.
+  void track_visibility(int event) {
+    if (event == FL_SHOW) {
+      window_visible = true;
+    } else if (event == FL_HIDE) {
+      window_visible = false;
+      end_reorder();
+    }
+    // Fl::focus() still names the old widget while FL_FOCUS or FL_UNFOCUS
+    // is delivered, so the event itself says where the focus went. A click
+    // means the window is active.
+    if (event == FL_FOCUS || event == FL_PUSH) {
+      window_focused = true;
+    } else if (event == FL_UNFOCUS || event == FL_HIDE) {
+      window_focused = false;
+    }
+    arm_error_timer();
+    if (window_visible && catch_up_pending) {
+      catch_up_pending = false;
+      if (show_find) {
+        update_find_preview();
+      }
+      redraw();
+    }
+  }
+
+  // F5: another window onto the same list
+  void open_window() {
+    ClearApp *view = new ClearApp(w(), h(), base_title.c_str(), model, false);
+    view->set_smooth_gradient(smooth_gradient);
+    view->show();
+  }
+
+  // Whether the list view shows the item (F4 filters by tag)
+  bool listed(int index) const {
+    return filter_tag.empty() || index == editing_index ||
+           item_tag(items[index].text) == filter_tag;
+  }
+
+  int listed_count() {
+    if (loading.active)
+      return loading.count; // Not loaded yet
+    return filter_tag.empty() ? (int)items.size()
+                              : (int)get_sorted_indices().size();
+  }
+
+  // F4: show all items, then only those of each tag in turn
+  void cycle_filter() {
+    if (editing_index >= 0) {
+      finish_editing();
+    }
+    std::map<std::string, int> tags;
+    for (const TodoItem &item : items) {
+      std::string tag = item_tag(item.text);
+      if (!tag.empty())
+        tags[tag] = 0;
+    }
+    auto next = tags.upper_bound(filter_tag);
+    filter_tag = (next != tags.end()) ? next->first : "";
+    copy_label(filter_tag.empty() ? base_title.c_str()
+                                  : (base_title + " - " + filter_tag).c_str());
+    selected_index = -1;
+    scroll_offset = 0;
+    redraw();
+  }
+
+  void add_item(const std::string &text = "") {
+    ModelTransaction transaction(bus);
+
+    // Finish any existing editing first
+    if (editing_index >= 0) {
+      finish_editing();
+    }
+
+    // Reset pull down state to avoid position calculation issues
+    is_pulling_down = false;
+    pull_down_offset = 0;
+
+    // Reset scroll to top when adding new item at the beginning
+    scroll_offset = 0;
+
+    // Insert new item at the beginning
+    items.insert(items.begin(), TodoItem(text));
+    bus.emit(ModelChange(ModelChange::INSERT, items[0].id, 0));
+
+    // Start editing the new item
+    editing_index = 0;
+    editing_text = text;
+    start_editing(0);
+  }
+
+  // Create the input widget on first use (initially hidden)
+  void ensure_input_widget() {
+    if (input_widget) {
+      return;
+    }
+    input_widget = new Fl_Input(0, 0, w(), item_height);
+    input_widget->callback(input_callback, this);
+    input_widget->when(FL_WHEN_CHANGED | FL_WHEN_ENTER_KEY | FL_WHEN_RELEASE);
+    input_widget->box(FL_FLAT_BOX); // Flat box (background but no border)
+    input_widget->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
+    // Ensure the widget can receive focus and display properly
+    input_widget->set_visible_focus();
+    input_widget->hide();
+    add(input_widget);
+  }
+
+  // F3: expand the notes of the item being edited or under the mouse, or
+  // collapse the open ones. This is the only place note bodies are read.
+  void toggle_notes() {
+    if (notes_item_id) {
+      close_notes();
+      return;
+    }
+    if (model.storage->confidential()) {
+      show_error("Notes are not available with encrypted storage");
+      return;
+    }
+    unsigned id = 0;
+    if (editing_index >= 0 && editing_index < (int)items.size()) {
+      id = items[editing_index].id;
+      finish_editing(); // May drop the item if its text is empty
+    } else {
+      int index = get_item_at_y(Fl::event_y());
+      if (index >= 0)
+        id = items[index].id;
+    }
+    int index = find_item_index(id);
+    if (index < 0)
+      return;
+
+    std::string body, error;
+    if (!model.notes.get(items[index].notes_hash, body, error)) {
+      show_error(error);
+      return;
+    }
+    if (!notes_input) {
+      notes_input = new Fl_Multiline_Input(0, 0, w(), NOTES_H);
+      notes_input->box(FL_FLAT_BOX);
+      notes_input->color(fl_rgb_color(248, 248, 240));
+      notes_input->textfont(FL_HELVETICA);
+      notes_input->textsize(14);
+      add(notes_input);
+    }
+    notes_item_id = id;
+    notes_loaded = body;
+    notes_input->value(body.c_str());
+    place_notes();
+    notes_input->show();
+    notes_input->take_focus();
+    redraw();
+  }
+
+  // Collapse the notes panel, storing the notes if they were edited
+  void close_notes() {
+    if (!notes_item_id)
+      return;
+    std::string body = notes_input->value() ? notes_input->value() : "";
+    unsigned id = notes_item_id;
+    notes_item_id = 0;
+    notes_input->hide();
+    redraw();
+    int index = find_item_index(id);
+    if (index < 0 || body == notes_loaded)
+      return;
+    std::string hash, error;
+    if (!model.notes.put(body, hash, error)) {
+      show_error(error);
+      return;
+    }
+    ModelTransaction transaction(bus);
+    items[index].notes_hash = hash;
+    bus.emit(ModelChange(ModelChange::UPDATE_TEXT, id, index));
+  }
+
+  // Keep the notes panel under its row, or above it near the bottom
+  void place_notes() {
+    int index = find_item_index(notes_item_id);
+    if (index < 0)
+      return;
+    int y = items[index].y_position + item_height;
+    if (y + NOTES_H > h() - 40)
+      y = items[index].y_position - NOTES_H;
+    y = std::max(0, y);
+    if (notes_input->y() != y || notes_input->w() != w() - 40)
+      notes_input->resize(20, y, w() - 40, NOTES_H);
+  }
+
+  void start_editing(int index) {
+    if (index < 0 || index >= (int)items.size()) {
+      return;
+    }
+
+    ensure_input_widget();
+
+    // Finish any existing editing first
+    if (editing_index >= 0 && editing_index != index) {
+      finish_editing();
+    }
+
+    editing_index = index;
+    editing_text = items[index].text;
+
+    // Calculate position for input widget
+    int start_y = 0;
+    int item_y = start_y + index * item_height - scroll_offset;
+    if (is_pulling_down && pull_down_offset > 0) {
+      item_y += pull_down_offset;
     }
 
     // Adjust for swipe offset
@@ -615,155 +7667,1198 @@ public:
     if (input_w < 0)
       input_w = 0;
 
-    // Position and show input widget
-    // Make it cover the full item area, with left padding for text alignment
-    input_widget->resize(input_x, item_y, input_w, item_height);
+    // Position and show input widget
+    // Make it cover the full item area, with left padding for text alignment
+    input_widget->resize(input_x, item_y, input_w, item_height);
+
+    // Set colors based on item position
+    // For completed items, use dark gray; otherwise use visual position in sorted list
+    Fl_Color item_color;
+    if (items[index].completed) {
+      item_color = fl_rgb_color(64, 64, 64); // Dark gray for completed items
+    } else {
+      // Find visual position in sorted list
+      std::vector<int> sorted_indices = get_sorted_indices();
+      int visual_pos = -1;
+      for (size_t i = 0; i < sorted_indices.size(); i++) {
+        if (sorted_indices[i] == index) {
+          visual_pos = i;
+          break;
+        }
+      }
+      if (visual_pos >= 0) {
+        item_color = get_color_by_position(visual_pos, sorted_indices.size());
+      } else {
+        item_color = get_color_by_position(index, items.size());
+      }
+    }
+    Fl_Color text_color = get_text_color(item_color);
+
+    // Set background color
+    input_widget->color(item_color);
+
+    // Set text color - ensure high contrast and visibility
+    input_widget->textcolor(text_color);
+    input_widget->textfont(FL_HELVETICA_BOLD);
+    input_widget->textsize(18);
+
+    // Set selection color for cursor visibility (use contrasting color)
+    Fl_Color selection_color = (text_color == FL_BLACK) ? FL_BLUE : FL_YELLOW;
+    input_widget->selection_color(selection_color);
+
+    // Set value - ensure it's set before showing
+    std::string text_value = items[index].text;
+    input_widget->value(text_value.c_str());
+
+    // Show and activate
+    input_widget->show();
+    input_widget->activate();
+    input_widget->set_visible_focus();
+
+    // Set cursor to end of text
+    int text_len = input_widget->size();
+    if (text_len > 0) {
+      input_widget->insert_position(text_len);
+      input_widget->mark(text_len); // Clear any selection
+    } else {
+      input_widget->insert_position(0);
+      input_widget->mark(0);
+    }
+
+    // Take focus to ensure input works
+    input_widget->take_focus();
+
+    // Force complete redraw
+    input_widget->damage(FL_DAMAGE_ALL);
+    input_widget->redraw();
+
+    // Process events to ensure everything is updated
+    Fl::check();
+    Fl::flush();
+    redraw();
+  }
+
+  void finish_editing() {
+    confirm_speculative_edit();
+    if (editing_index >= 0 && editing_index < (int)items.size()) {
+      ModelTransaction transaction(bus);
+
+      // Get text from input widget
+      if (input_widget && input_widget->visible()) {
+        editing_text = input_widget->value() ? input_widget->value() : "";
+      }
+
+      if (input_widget) {
+        input_widget->hide();
+      }
+
+      int old_editing_index = editing_index;
+      std::string old_editing_text = editing_text;
+
+      if (old_editing_text.empty()) {
+        // Remove empty item, but keep at least one empty item if list becomes
+        // empty
+        bus.emit(ModelChange(ModelChange::REMOVE, items[old_editing_index].id,
+                             old_editing_index));
+        items.erase(items.begin() + old_editing_index);
+        if (items.empty()) {
+          items.push_back(TodoItem(""));
+          bus.emit(ModelChange(ModelChange::INSERT, items[0].id, 0));
+          editing_index = -1; // Reset first to avoid recursion
+          editing_text = "";
+          start_editing(0);
+          return;
+        } else {
+          editing_index = -1;
+          editing_text = "";
+        }
+      } else {
+        // An edit that changed nothing (e.g. clicking away) emits nothing
+        bool changed = items[old_editing_index].text != old_editing_text;
+        items[old_editing_index].set_text(old_editing_text);
+        editing_index = -1;
+        editing_text = "";
+        if (changed) {
+          bus.emit(ModelChange(ModelChange::UPDATE_TEXT,
+                               items[old_editing_index].id,
+                               old_editing_index));
+        }
+      }
+      redraw();
+    }
+  }
+
+  void delete_item(int index) {
+    if (index >= 0 && index < (int)items.size()) {
+      ModelTransaction transaction(bus);
+      trash_item(index);
+      bus.emit(ModelChange(ModelChange::REMOVE, items[index].id, index));
+      items.erase(items.begin() + index);
+      if (selected_index >= (int)items.size()) {
+        selected_index = -1;
+      }
+      // Reset swipe offsets for all items
+      for (auto &item : items) {
+        item.swipe_offset = 0;
+      }
+
+      // Clamp scroll offset after deletion
+      clamp_scroll_offset();
+
+      // If all items are deleted, add an empty item for input
+      if (items.empty()) {
+        items.push_back(TodoItem(""));
+        bus.emit(ModelChange(ModelChange::INSERT, items[0].id, 0));
+        editing_index = 0;
+        editing_text = "";
+        scroll_offset = 0;
+        start_editing(0);
+      }
+    }
+  }
+
+  // Keep a copy of the item in the trash before it is deleted
+  void trash_item(int index) {
+    const TodoItem &item = items[index];
+    if (!model.persistence_enabled || item.text.empty() ||
+        model.storage->confidential())
+      return;
+    MemoryScope scope(MEM_IO);
+    std::string error;
+    if (!model.trash.is_open() &&
+        !model.trash.open(data_path("trash.bin"), error)) {
+      show_error(error);
+      return;
+    }
+    TrashRing::Entry entry;
+    entry.deleted_at = (long long)time(nullptr);
+    entry.item_id = item.id;
+    entry.position = index;
+    entry.before = (index > 0) ? TrashRing::item_hash(items[index - 1]) : 0;
+    entry.after = (index + 1 < (int)items.size())
+                      ? TrashRing::item_hash(items[index + 1])
+                      : 0;
+    entry.completed = item.completed;
+    entry.text = item.text;
+    if (!model.trash.push(entry, error)) {
+      show_error(error);
+    }
+  }
 
-    // Set colors based on item position
-    // For completed items, use dark gray; otherwise use visual position in sorted list
-    Fl_Color item_color;
-    if (items[index].completed) {
-      item_color = fl_rgb_color(64, 64, 64); // Dark gray for completed items
-    } else {
-      // Find visual position in sorted list
-      std::vector<int> sorted_indices = get_sorted_indices();
-      int visual_pos = -1;
-      for (size_t i = 0; i < sorted_indices.size(); i++) {
-        if (sorted_indices[i] == index) {
-          visual_pos = i;
-          break;
+  // Where a restored entry goes: between its old neighbours if they are
+  // still near its old position, else next to one of them, else at the
+  // old position
+  int restore_position(const TrashRing::Entry &entry) const {
+    const int window = 64;
+    int size = items.size();
+    int hint = std::min((int)entry.position, size);
+    int best = hint;
+    int best_score = 0;
+    for (int i = std::max(0, hint - window);
+         i <= std::min(size, hint + window); i++) {
+      int score = 0;
+      if (entry.before &&
+          (i > 0 && TrashRing::item_hash(items[i - 1]) == entry.before))
+        score += 2;
+      if (entry.after &&
+          (i < size && TrashRing::item_hash(items[i]) == entry.after))
+        score += 1;
+      if (score > best_score ||
+          (score == best_score && score > 0 &&
+           std::abs(i - hint) < std::abs(best - hint))) {
+        best = i;
+        best_score = score;
+      }
+    }
+    return best;
+  }
+
+  void restore_from_trash(int row) {
+    if (row < 0 || row >= (int)trash_entries.size())
+      return;
+    TrashRing::Entry entry;
+    std::string error;
+    if (!model.trash.take(trash_entries[row].slot, entry, error)) {
+      show_error(error);
+      load_trash_entries();
+      return;
+    }
+
+    // Drop the empty item left behind when the last item was deleted
+    int index;
+    {
+      ModelTransaction transaction(bus);
+      if (items.size() == 1 && items[0].text.empty()) {
+        if (editing_index >= 0 && input_widget) {
+          input_widget->hide();
         }
+        editing_index = -1;
+        editing_text = "";
+        bus.emit(ModelChange(ModelChange::REMOVE, items[0].id, 0));
+        items.clear();
       }
-      if (visual_pos >= 0) {
-        item_color = get_color_by_position(visual_pos, sorted_indices.size());
-      } else {
-        item_color = get_color_by_position(index, items.size());
+      index = restore_position(entry);
+      TodoItem item(entry.text);
+      item.completed = entry.completed;
+      items.insert(items.begin() + index, item);
+      bus.emit(ModelChange(ModelChange::INSERT, item.id, index));
+    }
+    selected_index = index;
+    load_trash_entries();
+    redraw();
+  }
+
+  void load_trash_entries() {
+    MemoryScope scope(MEM_IO);
+    trash_entries.clear();
+    std::string error;
+    if (!model.trash.is_open() &&
+        !model.trash.open(data_path("trash.bin"), error)) {
+      show_error(error);
+      return;
+    }
+    model.trash.entries(trash_entries);
+    trash_scroll = std::max(
+        0, std::min(trash_scroll, (int)trash_entries.size() - 1));
+  }
+
+  void toggle_trash_view() {
+    end_reorder();
+    if (!show_trash && model.storage->confidential()) {
+      show_error("Trash is not kept for encrypted storage");
+      return;
+    }
+    if (!show_trash && editing_index >= 0) {
+      finish_editing();
+    }
+    show_trash = !show_trash;
+    trash_scroll = 0;
+    if (show_trash) {
+      load_trash_entries();
+    } else {
+      trash_entries.clear();
+    }
+    redraw();
+  }
+
+  // Input while the trash view is open; the list underneath gets none
+  int handle_trash_event(int event) {
+    const int top = 50;
+    switch (event) {
+    case FL_PUSH:
+      if (Fl::event_button() == FL_LEFT_MOUSE && Fl::event_y() >= top) {
+        restore_from_trash((Fl::event_y() - top) / TRASH_ROW_H + trash_scroll);
+      }
+      return 1;
+    case FL_DRAG:
+    case FL_RELEASE:
+      return 1;
+    case FL_MOUSEWHEEL:
+      trash_scroll = std::max(
+          0, std::min(trash_scroll + Fl::event_dy(),
+                      (int)trash_entries.size() - 1));
+      redraw();
+      return 1;
+    case FL_KEYBOARD:
+      if (Fl::event_key() == FL_F + 8 || Fl::event_key() == FL_Escape) {
+        toggle_trash_view();
       }
+      return 1;
     }
-    Fl_Color text_color = get_text_color(item_color);
+    return 0;
+  }
 
-    // Set background color
-    input_widget->color(item_color);
+  static std::string format_age(long long seconds) {
+    char text[32];
+    if (seconds < 60) {
+      return "just now";
+    } else if (seconds < 3600) {
+      snprintf(text, sizeof(text), "%lld min ago", seconds / 60);
+    } else if (seconds < 86400) {
+      snprintf(text, sizeof(text), "%lld h ago", seconds / 3600);
+    } else {
+      snprintf(text, sizeof(text), "%lld days ago", seconds / 86400);
+    }
+    return text;
+  }
 
-    // Set text color - ensure high contrast and visibility
-    input_widget->textcolor(text_color);
-    input_widget->textfont(FL_HELVETICA_BOLD);
-    input_widget->textsize(18);
+  // Deleted items, newest first, over the whole window
+  void draw_trash() {
+    const int top = 50;
+    batch.color(fl_rgb_color(40, 40, 40));
+    batch.rectf(0, 0, w(), h());
+    batch.color(FL_WHITE);
+    batch.font(FL_HELVETICA_BOLD, 18);
+    batch.text("Trash", 20, 32);
+    batch.font(FL_HELVETICA, 12);
+    batch.text("Click to restore | F8 to close", w() - 190, 32);
+
+    if (trash_entries.empty()) {
+      batch.font(FL_HELVETICA, 14);
+      batch.text("No deleted items", 20, top + 26);
+      return;
+    }
 
-    // Set selection color for cursor visibility (use contrasting color)
-    Fl_Color selection_color = (text_color == FL_BLACK) ? FL_BLUE : FL_YELLOW;
-    input_widget->selection_color(selection_color);
+    long long now = (long long)time(nullptr);
+    batch.push_clip(0, top, w(), h() - top);
+    for (int row = trash_scroll; row < (int)trash_entries.size(); row++) {
+      int y = top + (row - trash_scroll) * TRASH_ROW_H;
+      if (y >= h())
+        break;
+      const TrashRing::Entry &entry = trash_entries[row];
+      batch.color(fl_rgb_color(70, 70, 70));
+      batch.rectf(10, y + TRASH_ROW_H - 1, w() - 20, 1);
+      batch.color(entry.completed ? fl_rgb_color(150, 150, 150) : FL_WHITE);
+      batch.font(FL_HELVETICA_BOLD, 16);
+      batch.push_clip(20, y, w() - 140, TRASH_ROW_H);
+      batch.text(entry.text.c_str(), 20, y + 26);
+      batch.pop_clip();
+      batch.color(fl_rgb_color(180, 180, 180));
+      batch.font(FL_HELVETICA, 12);
+      batch.text(format_age(now - entry.deleted_at).c_str(), w() - 110,
+                 y + 26);
+    }
+    batch.pop_clip();
+  }
 
-    // Set value - ensure it's set before showing
-    std::string text_value = items[index].text;
-    input_widget->value(text_value.c_str());
+  void toggle_complete(int index) {
+    if (index >= 0 && index < (int)items.size()) {
+      items[index].completed = !items[index].completed;
+      bus.emit(ModelChange(ModelChange::TOGGLE, items[index].id, index));
+    }
+  }
 
-    // Show and activate
-    input_widget->show();
-    input_widget->activate();
-    input_widget->set_visible_focus();
+  // First "#tag" word of an item's text, or "" if it has none
+  static std::string item_tag(const std::string &text) {
+    size_t pos = 0;
+    while ((pos = text.find('#', pos)) != std::string::npos) {
+      if ((pos == 0 || text[pos - 1] == ' ') && pos + 1 < text.size() &&
+          text[pos + 1] != ' ' && text[pos + 1] != '#') {
+        size_t end = text.find(' ', pos);
+        return text.substr(pos, end == std::string::npos ? end : end - pos);
+      }
+      pos++;
+    }
+    return "";
+  }
 
-    // Set cursor to end of text
-    int text_len = input_widget->size();
-    if (text_len > 0) {
-      input_widget->insert_position(text_len);
-      input_widget->mark(text_len); // Clear any selection
+  // text with its first tag replaced by tag ("" removes it)
+  static std::string replace_tag(const std::string &text,
+                                 const std::string &tag) {
+    std::string old_tag = item_tag(text);
+    std::string result = text;
+    if (!old_tag.empty()) {
+      size_t pos = (text.compare(0, old_tag.size(), old_tag) == 0 &&
+                    (text.size() == old_tag.size() ||
+                     text[old_tag.size()] == ' '))
+                       ? 0
+                       : text.find(" " + old_tag) + 1;
+      size_t length = old_tag.size();
+      if (tag.empty()) {
+        // Take one of the surrounding spaces along
+        if (pos > 0) {
+          pos--;
+          length++;
+        } else if (length < result.size()) {
+          length++;
+        }
+      }
+      result.replace(pos, length, tag);
+    } else if (!tag.empty()) {
+      result += result.empty() ? tag : " " + tag;
+    }
+    return result;
+  }
+
+  // Column an item belongs in for the current board mode
+  std::string board_key(const TodoItem &item) const {
+    if (board_mode == BOARD_STATUS)
+      return item.completed ? "done" : "open";
+    return item_tag(item.text);
+  }
+
+  // Build the column indexes from scratch, when the board is shown or
+  // update_board() could not follow the list. Columns keep their scroll
+  // position.
+  void ensure_board() {
+    if (board_valid)
+      return;
+    MemoryScope scope(MEM_INDEX);
+    board_valid = true;
+    std::map<std::string, int> scroll;
+    for (const BoardColumn &column : board_columns) {
+      scroll[column.key] = column.scroll_offset;
+    }
+
+    board_columns.clear();
+    std::map<std::string, int> column_of;
+    if (board_mode == BOARD_STATUS) {
+      column_of["open"] = 0;
+      column_of["done"] = 1;
+      board_columns.resize(2);
+      board_columns[0].key = "open";
+      board_columns[0].title = "To do";
+      board_columns[1].key = "done";
+      board_columns[1].title = "Done";
     } else {
-      input_widget->insert_position(0);
-      input_widget->mark(0);
+      // Untagged first, then tags in alphabetical order
+      column_of[""] = 0;
+      for (const TodoItem &item : items) {
+        std::string tag = item_tag(item.text);
+        if (!tag.empty())
+          column_of[tag] = 0;
+      }
+      for (auto &entry : column_of) {
+        entry.second = board_columns.size();
+        board_columns.push_back(BoardColumn());
+        board_columns.back().key = entry.first;
+        board_columns.back().title =
+            entry.first.empty() ? "Untagged" : entry.first;
+      }
+    }
+    for (BoardColumn &column : board_columns) {
+      auto found = scroll.find(column.key);
+      column.scroll_offset = (found != scroll.end()) ? found->second : 0;
     }
 
-    // Take focus to ensure input works
-    input_widget->take_focus();
+    for (size_t i = 0; i < items.size(); i++) {
+      board_columns[column_of[board_key(items[i])]].rows.push_back(i);
+    }
+    for (size_t i = 0; i < board_columns.size(); i++) {
+      clamp_board_scroll(i);
+    }
+  }
 
-    // Force complete redraw
-    input_widget->damage(FL_DAMAGE_ALL);
-    input_widget->redraw();
+  // Cards whose column is settled once a whole ChangeSet is replayed:
+  // item id and position
+  typedef std::vector<std::pair<unsigned, int> > BoardPending;
+
+  // Add delta to every card position in [first, last)
+  void shift_board(int first, int last, int delta, BoardPending &pending) {
+    for (BoardColumn &column : board_columns) {
+      std::vector<int>::iterator row =
+          std::lower_bound(column.rows.begin(), column.rows.end(), first);
+      for (; row != column.rows.end() && *row < last; ++row) {
+        *row += delta;
+      }
+    }
+    for (auto &card : pending) {
+      if (card.second >= first && card.second < last)
+        card.second += delta;
+    }
+  }
 
-    // Process events to ensure everything is updated
-    Fl::check();
-    Fl::flush();
+  // Take the card at index out of its column; false if there is none
+  bool detach_board_card(unsigned id, int index, BoardPending &pending) {
+    for (size_t i = 0; i < pending.size(); i++) {
+      if (pending[i].second == index) {
+        if (pending[i].first != id)
+          return false;
+        pending.erase(pending.begin() + i);
+        return true;
+      }
+    }
+    for (BoardColumn &column : board_columns) {
+      std::vector<int>::iterator row =
+          std::lower_bound(column.rows.begin(), column.rows.end(), index);
+      if (row != column.rows.end() && *row == index) {
+        column.rows.erase(row);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Put the card of the item at index in its column, adding the column
+  // for a tag the board didn't have yet
+  void place_board_card(int index) {
+    std::string key = board_key(items[index]);
+    size_t column = 0;
+    while (column < board_columns.size() && board_columns[column].key != key)
+      column++;
+    if (column == board_columns.size()) {
+      // Tag columns are in alphabetical order, after "Untagged"
+      column = 0;
+      while (column < board_columns.size() &&
+             board_columns[column].key < key)
+        column++;
+      board_columns.insert(board_columns.begin() + column, BoardColumn());
+      board_columns[column].key = key;
+      board_columns[column].title = key;
+    }
+    std::vector<int> &rows = board_columns[column].rows;
+    rows.insert(std::lower_bound(rows.begin(), rows.end(), index), index);
+  }
+
+  // Apply one transaction to the board: positions after a change are
+  // shifted along, and only the changed items are sorted into columns
+  // again. Anything that doesn't add up is left to ensure_board().
+  void update_board(const ChangeSet &changes) {
+    if (!board_valid)
+      return;
+    MemoryScope scope(MEM_INDEX);
+    board_valid = false; // Until the replay checks out
+    if (!changes.positions_exact)
+      return;
+    BoardPending pending;
+    for (const ModelChange &change : changes.changes) {
+      unsigned id = change.item_id;
+      switch (change.kind) {
+      case ModelChange::INSERT:
+        shift_board(change.index, INT_MAX, 1, pending);
+        pending.push_back(std::make_pair(id, change.index));
+        break;
+      case ModelChange::REMOVE:
+        if (!detach_board_card(id, change.index, pending))
+          return;
+        shift_board(change.index + 1, INT_MAX, -1, pending);
+        break;
+      case ModelChange::MOVE:
+        if (!detach_board_card(id, change.from_index, pending))
+          return;
+        if (change.from_index < change.index)
+          shift_board(change.from_index + 1, change.index + 1, -1, pending);
+        else
+          shift_board(change.index, change.from_index, 1, pending);
+        pending.push_back(std::make_pair(id, change.index));
+        break;
+      case ModelChange::UPDATE_TEXT:
+      case ModelChange::TOGGLE:
+        // May have a new tag or status
+        if (!detach_board_card(id, change.index, pending))
+          return;
+        pending.push_back(std::make_pair(id, change.index));
+        break;
+      }
+    }
+
+    size_t cards = pending.size();
+    for (const BoardColumn &column : board_columns) {
+      cards += column.rows.size();
+    }
+    if (cards != items.size())
+      return;
+    for (const auto &card : pending) {
+      if (card.second < 0 || card.second >= (int)items.size() ||
+          items[card.second].id != card.first)
+        return;
+    }
+    for (const auto &card : pending) {
+      place_board_card(card.second);
+    }
+    if (board_mode == BOARD_TAG) {
+      for (size_t i = board_columns.size(); i-- > 1;) {
+        if (board_columns[i].rows.empty())
+          board_columns.erase(board_columns.begin() + i); // Tag gone
+      }
+    }
+    board_valid = true;
+    int max_x =
+        std::max(0, (int)board_columns.size() * board_column_width() - w());
+    board_x_offset = std::min(board_x_offset, max_x);
+    for (size_t i = 0; i < board_columns.size(); i++) {
+      clamp_board_scroll(i);
+    }
+  }
+
+  int board_column_width() const {
+    int count = std::max((int)board_columns.size(), 1);
+    return std::max(BOARD_MIN_COLUMN_W, w() / count);
+  }
+
+  void clamp_board_scroll(int column) {
+    BoardColumn &col = board_columns[column];
+    int visible = h() - 40 - BOARD_HEADER_H;
+    int max_scroll = (int)col.rows.size() * BOARD_CARD_H - visible;
+    col.scroll_offset =
+        std::max(0, std::min(col.scroll_offset, std::max(max_scroll, 0)));
+  }
+
+  int board_column_at(int x) const {
+    int column = (x + board_x_offset) / board_column_width();
+    return (column >= 0 && column < (int)board_columns.size()) ? column : -1;
+  }
+
+  // Item index of the card at (x, y), or -1
+  int board_card_at(int x, int y) {
+    ensure_board();
+    int column = board_column_at(x);
+    if (column < 0 || y < BOARD_HEADER_H || y >= h() - 40)
+      return -1;
+    const BoardColumn &col = board_columns[column];
+    int row = (y - BOARD_HEADER_H + col.scroll_offset) / BOARD_CARD_H;
+    return (row < (int)col.rows.size()) ? col.rows[row] : -1;
+  }
+
+  // F7: list, board by status, board by tag
+  void cycle_board_mode() {
+    end_reorder();
+    if (editing_index >= 0) {
+      finish_editing();
+    }
+    board_mode = (BoardMode)((board_mode + 1) % 3);
+    agenda_mode = AGENDA_OFF;
+    board_columns.clear();
+    board_valid = false;
+    board_x_offset = 0;
+    selected_index = -1;
     redraw();
   }
 
-  void finish_editing() {
-    if (editing_index >= 0 && editing_index < (int)items.size()) {
-      // Get text from input widget
-      if (input_widget && input_widget->visible()) {
-        editing_text = input_widget->value() ? input_widget->value() : "";
+  // Move the dragged card (selected_index) into the column and slot under
+  // (x, y). Runs inside the reorder transaction, so the drop is saved once.
+  void board_drop(int x, int y) {
+    ensure_board();
+    int column = board_column_at(x);
+    int from = selected_index;
+    if (column < 0 || from < 0 || from >= (int)items.size())
+      return;
+    const BoardColumn &target = board_columns[column];
+    int slot = (y - BOARD_HEADER_H + target.scroll_offset) / BOARD_CARD_H;
+    slot = std::max(0, std::min(slot, (int)target.rows.size()));
+    // The card goes in front of anchor, or after last for the column's end
+    int anchor = (slot < (int)target.rows.size()) ? target.rows[slot] : -1;
+    int last = target.rows.empty() ? -1 : target.rows.back();
+    std::string key = target.key;
+
+    if (board_key(items[from]) != key) {
+      if (board_mode == BOARD_STATUS) {
+        toggle_complete(from);
+      } else {
+        items[from].set_text(replace_tag(items[from].text, key));
+        bus.emit(ModelChange(ModelChange::UPDATE_TEXT, items[from].id, from));
+      }
+    }
+
+    int to = from;
+    if (anchor >= 0) {
+      to = (from < anchor) ? anchor - 1 : anchor;
+    } else if (last >= 0) {
+      to = (from <= last) ? last : last + 1;
+    }
+    reorder_items(from, to);
+    selected_index = to;
+  }
+
+  // Input in board mode; keys go on to the normal handling
+  int handle_board_event(int event) {
+    int mx = Fl::event_x();
+    int my = Fl::event_y();
+    switch (event) {
+    case FL_PUSH: {
+      int index = board_card_at(mx, my);
+      selected_index = index;
+      if (index >= 0 && Fl::event_button() == FL_RIGHT_MOUSE) {
+        delete_item(index);
+        selected_index = -1;
+      } else if (index >= 0 && Fl::event_button() == FL_LEFT_MOUSE) {
+        drag_start_x = board_drag_x = mx;
+        drag_start_y = board_drag_y = my;
+        can_reorder = false;
+        Fl::add_timeout(0.3, long_press_timeout_cb, this);
+      }
+      redraw();
+      return 1;
+    }
+    case FL_DRAG:
+      if (can_reorder) {
+        board_drag_x = mx;
+        board_drag_y = my;
+        redraw();
+      } else if (abs(mx - drag_start_x) > 5 || abs(my - drag_start_y) > 5) {
+        Fl::remove_timeout(long_press_timeout_cb, this);
+      }
+      return 1;
+    case FL_RELEASE:
+      Fl::remove_timeout(long_press_timeout_cb, this);
+      if (can_reorder && selected_index >= 0) {
+        board_drop(mx, my);
+      } else if (selected_index >= 0 && Fl::event_clicks() > 0 &&
+                 abs(mx - drag_start_x) < 5 && abs(my - drag_start_y) < 5) {
+        toggle_complete(selected_index);
+      }
+      end_reorder();
+      redraw();
+      return 1;
+    case FL_MOUSEWHEEL: {
+      ensure_board();
+      if (Fl::event_dx() != 0) {
+        int max_x = std::max(0, (int)board_columns.size() *
+                                    board_column_width() - w());
+        board_x_offset = std::max(
+            0, std::min(board_x_offset + Fl::event_dx() * 40, max_x));
+      }
+      int column = board_column_at(mx);
+      if (column >= 0 && Fl::event_dy() != 0) {
+        board_columns[column].scroll_offset += Fl::event_dy() * BOARD_CARD_H;
+        clamp_board_scroll(column);
+      }
+      redraw();
+      return 1;
+    }
+    }
+    return 0;
+  }
+
+  // Columns side by side, each drawing only the cards in its viewport
+  void draw_board() {
+    ensure_board();
+    const int column_w = board_column_width();
+    const int bottom = h() - 40;
+    batch.color(fl_rgb_color(40, 40, 40));
+    batch.rectf(0, 0, w(), h());
+
+    int dragged_column = -1;
+    for (int c = 0; c < (int)board_columns.size(); c++) {
+      int x = c * column_w - board_x_offset;
+      if (x + column_w <= 0 || x >= w())
+        continue;
+      const BoardColumn &column = board_columns[c];
+      char header[128];
+      snprintf(header, sizeof(header), "%s (%u)", column.title.c_str(),
+               (unsigned)column.rows.size());
+      batch.color(FL_WHITE);
+      batch.font(FL_HELVETICA_BOLD, 14);
+      batch.push_clip(x, 0, column_w, BOARD_HEADER_H);
+      batch.text(header, x + 12, BOARD_HEADER_H - 12);
+      batch.pop_clip();
+
+      batch.push_clip(x, BOARD_HEADER_H, column_w, bottom - BOARD_HEADER_H);
+      int total = column.rows.size();
+      int first = column.scroll_offset / BOARD_CARD_H;
+      for (int row = first; row < total; row++) {
+        int y = BOARD_HEADER_H + row * BOARD_CARD_H - column.scroll_offset;
+        if (y >= bottom)
+          break;
+        int index = column.rows[row];
+        const TodoItem &item = items[index];
+        if (can_reorder && index == selected_index) {
+          dragged_column = c;
+          continue; // Drawn under the pointer below
+        }
+        draw_board_card(item, x + 6, y + 2, column_w - 12,
+                        BOARD_CARD_H - 4, row, total,
+                        index == selected_index);
+      }
+      batch.pop_clip();
+    }
+
+    // The dragged card follows the pointer
+    if (dragged_column >= 0 && selected_index < (int)items.size()) {
+      draw_board_card(items[selected_index],
+                      board_drag_x - column_w / 2 + 6,
+                      board_drag_y - BOARD_CARD_H / 2, column_w - 12,
+                      BOARD_CARD_H - 4, 0, 1, true);
+    }
+  }
+
+  void draw_board_card(const TodoItem &item, int x, int y, int card_w,
+                       int card_h, int position, int total, bool selected) {
+    Fl_Color color = item.completed ? fl_rgb_color(64, 64, 64)
+                                    : get_color_by_position(position, total);
+    batch.color(color);
+    batch.rectf(x, y, card_w, card_h);
+    if (selected) {
+      batch.color(FL_WHITE);
+      batch.rectf(x, y, 3, card_h);
+    }
+    batch.color(item.completed ? FL_GREEN : get_text_color(color));
+    batch.font(FL_HELVETICA_BOLD, 14);
+    batch.push_clip(x, y, card_w - 8, card_h);
+    batch.text(item.text.c_str(), x + 10, y + card_h / 2 + 5);
+    batch.pop_clip();
+  }
+
+  // Index of item with the given id, starting the search at hint
+  int find_item_index(unsigned id, int hint = -1) const {
+    if (hint >= 0 && hint < (int)items.size() && items[hint].id == id)
+      return hint;
+    for (size_t i = 0; i < items.size(); i++) {
+      if (items[i].id == id)
+        return i;
+    }
+    return -1;
+  }
+
+  void unschedule(unsigned id) {
+    auto day = due_day_of.find(id);
+    if (day == due_day_of.end())
+      return;
+    auto bin = due_index.find(day->second);
+    std::vector<AgendaEntry> &entries = bin->second;
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i].id == id) {
+        entries.erase(entries.begin() + i);
+        break;
       }
+    }
+    if (entries.empty()) {
+      due_index.erase(bin);
+    }
+    due_day_of.erase(day);
+  }
+
+  // Bins are kept in id order, so a day lists its items in creation order
+  void schedule(const TodoItem &item) {
+    long day = item_due_day(item.text);
+    if (day == NO_DUE_DAY)
+      return;
+    MemoryScope scope(MEM_INDEX);
+    AgendaEntry entry;
+    entry.id = item.id;
+    entry.text = item.text;
+    entry.completed = item.completed;
+    std::vector<AgendaEntry> &entries = due_index[day];
+    auto pos = std::lower_bound(
+        entries.begin(), entries.end(), entry,
+        [](const AgendaEntry &a, const AgendaEntry &b) { return a.id < b.id; });
+    entries.insert(pos, entry);
+    due_day_of[item.id] = day;
+  }
+
+  void rebuild_due_index() {
+    due_index.clear();
+    due_day_of.clear();
+    due_unplaced.clear();
+    for (const TodoItem &item : items) {
+      schedule(item);
+    }
+    due_index_valid = true;
+  }
+
+  // Apply one transaction to the due-date index: O(log n) per changed item
+  // (plus the size of its day's bin). An item whose position hint is stale
+  // (merged away by later inserts or removals) is set aside until the
+  // agenda next needs the index, rather than looked up now.
+  void update_due_index(const ChangeSet &changes) {
+    if (!due_index_valid)
+      return; // Rebuilt when the agenda is next shown
+    MemoryScope scope(MEM_INDEX);
+    for (const ModelChange &change : changes.changes) {
+      if (change.kind == ModelChange::MOVE)
+        continue;
+      unschedule(change.item_id);
+      due_unplaced.erase(change.item_id);
+      if (change.kind == ModelChange::REMOVE)
+        continue;
+      if (change.index >= 0 && change.index < (int)items.size() &&
+          items[change.index].id == change.item_id) {
+        schedule(items[change.index]);
+      } else {
+        due_unplaced.insert(change.item_id);
+      }
+    }
+  }
+
+  // Bring the index up to date before the agenda uses it. Items set aside
+  // by update_due_index() are found in one pass, however many
+  // transactions went by since.
+  void refresh_due_index() {
+    if (!due_index_valid) {
+      rebuild_due_index();
+      return;
+    }
+    for (size_t i = 0; i < items.size() && !due_unplaced.empty(); i++) {
+      if (due_unplaced.erase(items[i].id)) {
+        schedule(items[i]);
+      }
+    }
+    due_unplaced.clear(); // Any left are no longer in the list
+  }
+
+  // First and last day shown by the agenda
+  void agenda_range(long &first, long &last) const {
+    if (agenda_mode == AGENDA_WEEK) {
+      first = agenda_day - weekday_of(agenda_day);
+      last = first + 6;
+      return;
+    }
+    int year, month, day;
+    civil_from_days(agenda_day, year, month, day);
+    long first_of_month = days_from_civil(year, month, 1);
+    first = first_of_month - weekday_of(first_of_month);
+    last = first + 6 * 7 - 1;
+  }
+
+  // Day cell geometry: 7 columns, one row per week
+  void agenda_cell(long day, long first, int &x, int &y, int &cell_w,
+                   int &cell_h) const {
+    int rows = (agenda_mode == AGENDA_WEEK) ? 1 : 6;
+    cell_w = w() / 7;
+    cell_h = (h() - 40 - AGENDA_TOP) / rows;
+    int offset = day - first;
+    x = (offset % 7) * cell_w;
+    y = AGENDA_TOP + (offset / 7) * cell_h;
+  }
+
+  long agenda_day_at(int x, int y) const {
+    long first, last;
+    agenda_range(first, last);
+    int rows = (agenda_mode == AGENDA_WEEK) ? 1 : 6;
+    int cell_w = w() / 7;
+    int cell_h = (h() - 40 - AGENDA_TOP) / rows;
+    if (x < 0 || y < AGENDA_TOP || x >= cell_w * 7 || y >= h() - 40)
+      return NO_DUE_DAY;
+    int row = std::min((y - AGENDA_TOP) / cell_h, rows - 1);
+    return first + row * 7 + x / cell_w;
+  }
+
+  // Id of the entry drawn at (x, y), or 0
+  unsigned agenda_entry_at(int x, int y) const {
+    long day = agenda_day_at(x, y);
+    auto bin = due_index.find(day);
+    if (day == NO_DUE_DAY || bin == due_index.end())
+      return 0;
+    long first, last;
+    agenda_range(first, last);
+    int cell_x, cell_y, cell_w, cell_h;
+    agenda_cell(day, first, cell_x, cell_y, cell_w, cell_h);
+    int line = (y - cell_y - AGENDA_DAY_H) / AGENDA_LINE_H;
+    int lines = (cell_h - AGENDA_DAY_H) / AGENDA_LINE_H;
+    if (y < cell_y + AGENDA_DAY_H || line >= lines ||
+        line >= (int)bin->second.size())
+      return 0;
+    if (line == lines - 1 && (int)bin->second.size() > lines)
+      return 0; // The "+N more" line
+    return bin->second[line].id;
+  }
 
-      input_widget->hide();
+  // F6: list, week agenda, month agenda
+  void cycle_agenda_mode() {
+    end_reorder();
+    if (editing_index >= 0) {
+      finish_editing();
+    }
+    agenda_mode = (AgendaMode)((agenda_mode + 1) % 3);
+    board_mode = BOARD_OFF;
+    agenda_day = today_day();
+    agenda_drag_id = 0;
+    redraw();
+  }
 
-      int old_editing_index = editing_index;
-      std::string old_editing_text = editing_text;
+  // Move the shown week or month by step periods
+  void agenda_step(int step) {
+    if (agenda_mode == AGENDA_WEEK) {
+      agenda_day += step * 7;
+      return;
+    }
+    int year, month, day;
+    civil_from_days(agenda_day, year, month, day);
+    month += step;
+    year += (month > 12) ? (month - 1) / 12 : (month < 1) ? month / 12 - 1 : 0;
+    month = ((month - 1) % 12 + 12) % 12 + 1;
+    agenda_day = days_from_civil(year, month, 1);
+  }
 
-      if (old_editing_text.empty()) {
-        // Remove empty item, but keep at least one empty item if list becomes
-        // empty
-        items.erase(items.begin() + old_editing_index);
-        if (items.empty()) {
-          items.push_back(TodoItem(""));
-          editing_index = -1; // Reset first to avoid recursion
-          editing_text = "";
-          redraw();
-          start_editing(0);
-          return;
-        } else {
-          editing_index = -1;
-          editing_text = "";
+  void reschedule(unsigned id, long day) {
+    int index = find_item_index(id);
+    if (index < 0 || item_due_day(items[index].text) == day)
+      return;
+    ModelTransaction transaction(bus);
+    items[index].set_text(replace_due_day(items[index].text, day));
+    bus.emit(ModelChange(ModelChange::UPDATE_TEXT, id, index));
+  }
+
+  // Input in agenda mode; other keys go on to the normal handling
+  int handle_agenda_event(int event) {
+    int mx = Fl::event_x();
+    int my = Fl::event_y();
+    refresh_due_index();
+    switch (event) {
+    case FL_PUSH:
+      agenda_drag_id = agenda_entry_at(mx, my);
+      agenda_dragging = false;
+      drag_start_x = agenda_drag_x = mx;
+      drag_start_y = agenda_drag_y = my;
+      if (agenda_drag_id && Fl::event_button() == FL_RIGHT_MOUSE) {
+        delete_item(find_item_index(agenda_drag_id));
+        agenda_drag_id = 0;
+      }
+      redraw();
+      return 1;
+    case FL_DRAG:
+      if (agenda_drag_id &&
+          (agenda_dragging || abs(mx - drag_start_x) > 5 ||
+           abs(my - drag_start_y) > 5)) {
+        agenda_dragging = true;
+        agenda_drag_x = mx;
+        agenda_drag_y = my;
+        redraw();
+      }
+      return 1;
+    case FL_RELEASE:
+      if (agenda_drag_id && agenda_dragging) {
+        long day = agenda_day_at(mx, my);
+        if (day != NO_DUE_DAY) {
+          reschedule(agenda_drag_id, day);
         }
+      } else if (agenda_drag_id && Fl::event_clicks() > 0) {
+        toggle_complete(find_item_index(agenda_drag_id));
+      }
+      agenda_dragging = false;
+      redraw();
+      return 1;
+    case FL_MOUSEWHEEL:
+      if (Fl::event_dy() != 0) {
+        agenda_step(Fl::event_dy() > 0 ? 1 : -1);
+        redraw();
+      }
+      return 1;
+    case FL_KEYBOARD:
+      if (Fl::event_key() == FL_Page_Down || Fl::event_key() == FL_Page_Up) {
+        agenda_step(Fl::event_key() == FL_Page_Down ? 1 : -1);
+      } else if (Fl::event_key() == FL_Home) {
+        agenda_day = today_day();
       } else {
-        items[old_editing_index].text = old_editing_text;
-        editing_index = -1;
-        editing_text = "";
-        save_to_file();
+        return 0;
       }
       redraw();
+      return 1;
     }
+    return 0;
   }
 
-  void delete_item(int index) {
-    if (index >= 0 && index < (int)items.size()) {
-      items.erase(items.begin() + index);
-      if (selected_index >= (int)items.size()) {
-        selected_index = -1;
-      }
-      // Reset swipe offsets for all items
-      for (auto &item : items) {
-        item.swipe_offset = 0;
-      }
+  // Day cells of the shown week or month; only the index bins for these
+  // days are visited
+  void draw_agenda() {
+    refresh_due_index();
+    static const char *weekdays[] = {"Mon", "Tue", "Wed", "Thu",
+                                     "Fri", "Sat", "Sun"};
+    static const char *months[] = {"January", "February", "March",
+                                   "April",   "May",      "June",
+                                   "July",    "August",   "September",
+                                   "October", "November", "December"};
+    long first, last;
+    agenda_range(first, last);
+    long today = today_day();
+    int year, month, day;
+    civil_from_days(agenda_day, year, month, day);
+
+    batch.color(fl_rgb_color(40, 40, 40));
+    batch.rectf(0, 0, w(), h());
+    char title[64];
+    if (agenda_mode == AGENDA_WEEK) {
+      snprintf(title, sizeof(title), "Week of %s",
+               format_day(first).c_str());
+    } else {
+      snprintf(title, sizeof(title), "%s %d", months[month - 1], year);
+    }
+    batch.color(FL_WHITE);
+    batch.font(FL_HELVETICA_BOLD, 16);
+    batch.text(title, 12, 24);
+    int cell_x, cell_y, cell_w, cell_h;
+    batch.font(FL_HELVETICA, 12);
+    for (int i = 0; i < 7; i++) {
+      agenda_cell(first + i, first, cell_x, cell_y, cell_w, cell_h);
+      batch.text(weekdays[i], cell_x + 6, AGENDA_TOP - 6);
+    }
 
-      // Clamp scroll offset after deletion
-      clamp_scroll_offset();
+    // Cell backgrounds and day numbers
+    for (long d = first; d <= last; d++) {
+      agenda_cell(d, first, cell_x, cell_y, cell_w, cell_h);
+      int y_, m_, day_of_month;
+      civil_from_days(d, y_, m_, day_of_month);
+      bool in_month = (agenda_mode == AGENDA_WEEK) || m_ == month;
+      batch.color(d == today ? fl_rgb_color(90, 60, 40)
+                             : in_month ? fl_rgb_color(56, 56, 56)
+                                        : fl_rgb_color(46, 46, 46));
+      batch.rectf(cell_x + 1, cell_y + 1, cell_w - 2, cell_h - 2);
+      char number[8];
+      snprintf(number, sizeof(number), "%d", day_of_month);
+      batch.color(in_month ? FL_WHITE : fl_rgb_color(130, 130, 130));
+      batch.font(FL_HELVETICA_BOLD, 12);
+      batch.text(number, cell_x + 6, cell_y + 15);
+    }
 
-      // If all items are deleted, add an empty item for input
-      if (items.empty()) {
-        items.push_back(TodoItem(""));
-        editing_index = 0;
-        editing_text = "";
-        scroll_offset = 0;
-        start_editing(0);
+    // Items of the bins in view
+    batch.font(FL_HELVETICA, 12);
+    for (auto bin = due_index.lower_bound(first);
+         bin != due_index.end() && bin->first <= last; ++bin) {
+      agenda_cell(bin->first, first, cell_x, cell_y, cell_w, cell_h);
+      const std::vector<AgendaEntry> &entries = bin->second;
+      int lines = (cell_h - AGENDA_DAY_H) / AGENDA_LINE_H;
+      batch.push_clip(cell_x + 2, cell_y, cell_w - 4, cell_h);
+      for (int i = 0; i < (int)entries.size() && i < lines; i++) {
+        int y = cell_y + AGENDA_DAY_H + i * AGENDA_LINE_H;
+        if (i == lines - 1 && (int)entries.size() > lines) {
+          char more[32];
+          snprintf(more, sizeof(more), "+%d more",
+                   (int)entries.size() - lines + 1);
+          batch.color(fl_rgb_color(180, 180, 180));
+          batch.text(more, cell_x + 6, y + 12);
+          break;
+        }
+        const AgendaEntry &entry = entries[i];
+        if (agenda_dragging && entry.id == agenda_drag_id)
+          continue; // Drawn under the pointer below
+        batch.color(entry.completed ? fl_rgb_color(64, 64, 64)
+                                    : get_color_by_position(i, lines));
+        batch.rectf(cell_x + 4, y + 1, cell_w - 8, AGENDA_LINE_H - 2);
+        batch.color(entry.completed ? FL_GREEN : FL_BLACK);
+        batch.text(entry.text.c_str(), cell_x + 8, y + 12);
       }
-
-      save_to_file();
-      redraw();
+      batch.pop_clip();
     }
-  }
 
-  void toggle_complete(int index) {
-    if (index >= 0 && index < (int)items.size()) {
-      items[index].completed = !items[index].completed;
-      save_to_file();
-      redraw();
+    if (agenda_dragging) {
+      auto day_of = due_day_of.find(agenda_drag_id);
+      if (day_of != due_day_of.end()) {
+        for (const AgendaEntry &entry : due_index[day_of->second]) {
+          if (entry.id != agenda_drag_id)
+            continue;
+          int x = agenda_drag_x - cell_w / 2;
+          batch.color(FL_YELLOW);
+          batch.rectf(x, agenda_drag_y - AGENDA_LINE_H / 2, cell_w - 8,
+                      AGENDA_LINE_H);
+          batch.color(FL_BLACK);
+          batch.push_clip(x, agenda_drag_y - AGENDA_LINE_H / 2, cell_w - 8,
+                          AGENDA_LINE_H);
+          batch.text(entry.text.c_str(), x + 4, agenda_drag_y + 5);
+          batch.pop_clip();
+        }
+      }
     }
   }
 
   int handle(int event) override {
+    ScopedLatency latency(metrics.event);
+    MemoryScope scope(MEM_MODEL);
+    if (event == FL_SHOW || event == FL_HIDE || event == FL_FOCUS ||
+        event == FL_UNFOCUS || event == FL_PUSH) {
+      track_visibility(event);
+    }
+    model.origin = this;
     int mx = Fl::event_x();
     int my = Fl::event_y();
     int start_y = 0;
 
+    // Input on the resume snapshot would refer to items not loaded yet. A
+    // list loading a window at a time scrolls meanwhile.
+    if (loading.active && event == FL_MOUSEWHEEL) {
+      scroll_offset -= Fl::event_dy() * item_height;
+      clamp_scroll_offset();
+      redraw();
+      return 1;
+    }
+    if (!model_ready &&
+        (event == FL_PUSH || event == FL_DRAG || event == FL_RELEASE ||
+         event == FL_MOUSEWHEEL || event == FL_KEYBOARD ||
+         event == FL_PASTE)) {
+      return 1;
+    }
+    if (show_find && handle_find_event(event)) {
+      return 1;
+    }
+    if (show_trash && handle_trash_event(event)) {
+      return 1;
+    }
+    if (board_mode != BOARD_OFF && handle_board_event(event)) {
+      return 1;
+    }
+    if (agenda_mode != AGENDA_OFF && handle_agenda_event(event)) {
+      return 1;
+    }
+
     switch (event) {
     case FL_PUSH: {
       // Finish editing if clicking elsewhere
@@ -798,7 +8893,6 @@ public:
           drag_start_y = my;
           drag_start_x = mx;
           drag_offset = my - (start_y + index * item_height);
-          pending_click_index = -1; // Reset pending click
 
           // Start long press timer (0.3 seconds) for reordering
           Fl::add_timeout(0.3, long_press_timeout_cb, this);
@@ -912,8 +9006,9 @@ public:
       if (is_pulling_down) {
         // If pulled down enough, create new item
         if (pull_down_offset > item_height * 0.6) {
-          // Add new item (this will reset pull down state and start editing)
-          add_item("");
+          // Add new item (this will reset pull down state and start editing).
+          // In a filtered view it gets the tag, or it would vanish.
+          add_item(filter_tag.empty() ? "" : filter_tag + " ");
         } else {
           pull_down_offset = 0;
           is_pulling_down = false;
@@ -965,30 +9060,37 @@ public:
           // Small movement - treat as click
           // Check if this is a double-click
           if (Fl::event_clicks() > 0) {
-            // Double-click - toggle complete
-            // Cancel any pending single click
-            if (pending_click_index >= 0) {
-              Fl::remove_timeout(click_timeout_cb, this);
-              pending_click_index = -1;
+            // Double-click - toggle complete. If the first click opened the
+            // editor, close it again without touching the text.
+            if (speculative_edit_index >= 0 &&
+                speculative_edit_index == selected_index) {
+              rollback_speculative_edit();
             }
             if (editing_index < 0) {
               toggle_complete(selected_index);
             }
-          } else {
-            // Single click - delay to check for double-click
-            // Cancel previous pending click if any
-            if (pending_click_index >= 0) {
-              Fl::remove_timeout(click_timeout_cb, this);
+          } else if (editing_index != selected_index &&
+                     open_link_at(selected_index, mx)) {
+            // Single click on a link - opened instead of editing
+          } else if (editing_index != selected_index) {
+            // Single click - start editing right away. Until the
+            // double-click window passes or the user types, a second click
+            // rolls the editor back. Marked before start_editing(), which
+            // may already process the second click.
+            int index = selected_index;
+            if (editing_index >= 0) {
+              finish_editing();
             }
-            pending_click_index = selected_index;
-            Fl::add_timeout(0.3, click_timeout_cb, this);
+            speculative_edit_index = index;
+            Fl::remove_timeout(speculative_edit_timeout_cb, this);
+            Fl::add_timeout(0.3, speculative_edit_timeout_cb, this);
+            start_editing(index);
           }
         }
       }
 
-      is_dragging = false;
       is_swiping = false;
-      can_reorder = false;
+      end_reorder();
       redraw();
       return 1;
     }
@@ -1006,18 +9108,59 @@ public:
       break;
     }
 
+    case FL_DND_ENTER:
+    case FL_DND_DRAG:
+    case FL_DND_LEAVE:
+      return 1; // Accept files dropped on the list
+    case FL_DND_RELEASE:
+      drop_y = my;
+      return 1;
+    case FL_PASTE:
+      if (drop_y >= 0 && Fl::event_length() > 0) {
+        attach_file(dropped_path(Fl::event_text(), Fl::event_length()),
+                    drop_y);
+        drop_y = -1;
+        return 1;
+      }
+      break;
+
     case FL_KEYBOARD: {
+      if (Fl::event_key() == FL_F + 3) {
+        toggle_notes();
+        return 1;
+      }
+      if (Fl::event_state(FL_CTRL) && Fl::event_key() == 'f') {
+        toggle_find();
+        return 1;
+      }
+      if (Fl::event_state(FL_CTRL) && Fl::event_key() == 'z' &&
+          undo_replace()) {
+        return 1;
+      }
+      if (notes_item_id) {
+        // Typing goes to the notes; Escape collapses them
+        if (Fl::event_key() == FL_Escape) {
+          close_notes();
+          return 1;
+        }
+        break;
+      }
       // If editing, only handle Escape key, let Fl_Input handle everything else
       if (editing_index >= 0 && input_widget && input_widget->visible()) {
         int key = Fl::event_key();
         if (key == FL_Escape) {
           // Cancel editing
+          confirm_speculative_edit();
+          ModelTransaction transaction(bus);
           std::string current_text =
               input_widget->value() ? input_widget->value() : "";
           if (current_text.empty() && editing_index < (int)items.size()) {
+            bus.emit(ModelChange(ModelChange::REMOVE, items[editing_index].id,
+                                 editing_index));
             items.erase(items.begin() + editing_index);
             if (items.empty()) {
               items.push_back(TodoItem(""));
+              bus.emit(ModelChange(ModelChange::INSERT, items[0].id, 0));
               editing_index = 0;
               editing_text = "";
               start_editing(0);
@@ -1027,13 +9170,34 @@ public:
           input_widget->hide();
           editing_index = -1;
           editing_text = "";
-          save_to_file();
           redraw();
           return 1;
         }
         // For all other keys, don't intercept - let Fl_Input handle them
         // Call the parent handle to let event propagate naturally
         break; // Don't handle, let it fall through to parent or Fl_Input
+      } else if (Fl::event_key() == FL_F + 9) {
+        set_smooth_gradient(!smooth_gradient);
+        return 1;
+      } else if (Fl::event_key() == FL_F + 4) {
+        cycle_filter();
+        return 1;
+      } else if (Fl::event_key() == FL_F + 5) {
+        open_window();
+        return 1;
+      } else if (Fl::event_key() == FL_F + 6) {
+        cycle_agenda_mode();
+        return 1;
+      } else if (Fl::event_key() == FL_F + 7) {
+        cycle_board_mode();
+        return 1;
+      } else if (Fl::event_key() == FL_F + 8) {
+        toggle_trash_view();
+        return 1;
+      } else if (Fl::event_key() == FL_F + 12) {
+        show_hud = !show_hud;
+        redraw();
+        return 1;
       } else if (Fl::event_key() == FL_Delete && selected_index >= 0) {
         delete_item(selected_index);
         selected_index = -1;
@@ -1046,9 +9210,97 @@ public:
     return Fl_Window::handle(event);
   }
 
+  // A live resize sends a stream of configure events. Each only resizes
+  // the window; the layout follows in draw(), once per frame however many
+  // events arrived in between.
+  void resize(int X, int Y, int W, int H) override {
+    Fl_Window::resize(X, Y, W, H);
+    if (W != layout_w || H != layout_h) {
+      redraw();
+    }
+  }
+
+  // Fit the layout to a new window size. Rows on screen are recomposed at
+  // the new width as draw() reaches them; cached rows of the old width are
+  // dropped and composed again only if they scroll back into view.
+  void relayout() {
+    layout_w = w();
+    layout_h = h();
+    for (auto &set : scaled_rows) {
+      std::unordered_map<unsigned, RowImage> &rows = set.second.rows;
+      for (auto row = rows.begin(); row != rows.end();) {
+        if (row->second.width != set.second.pixels(w())) {
+          row = rows.erase(row);
+        } else {
+          ++row;
+        }
+      }
+    }
+    delete resume.scaled; // Scaled again to the new size
+    resume.scaled = nullptr;
+    if (model_ready || loading.active) {
+      clamp_scroll_offset();
+    }
+    if (board_valid) {
+      int max_x =
+          std::max(0, (int)board_columns.size() * board_column_width() - w());
+      board_x_offset = std::min(board_x_offset, max_x);
+      for (size_t i = 0; i < board_columns.size(); i++) {
+        clamp_board_scroll(i);
+      }
+    }
+    if (show_find) {
+      place_find_widgets();
+    }
+  }
+
   void draw() override {
+    ScopedLatency latency(metrics.draw);
+    MemoryScope scope(MEM_LAYOUT);
+    select_scale();
+    if (w() != layout_w || h() != layout_h) {
+      relayout(); // Before the children are drawn at their old places
+    }
     Fl_Window::draw();
 
+    // Until the list is loaded, show its rows a window at a time, or the
+    // last frame of the previous session
+    if (loading.active) {
+      draw_window();
+      draw_overlays();
+      return;
+    }
+    if (!model_ready) {
+      if (!resume.scaled && !resume.snapshot.empty()) {
+        Fl_RGB_Image snapshot(&resume.snapshot[0], resume.snapshot_w,
+                              resume.snapshot_h, 3);
+        resume.scaled = snapshot.copy(w(), h());
+      }
+      if (resume.scaled) {
+        resume.scaled->draw(0, 0);
+      }
+      frame_drawn();
+      return;
+    }
+
+    // Glyphs can only be rendered once the window has a drawing context.
+    // The first frame uses fl_draw so that building them doesn't delay it.
+    if (use_glyph_atlas && !scaled->atlas.ready() && first_frame_drawn &&
+        scaled->first_frame != row_frame) {
+      scaled->atlas.build();
+    }
+
+    if (board_mode != BOARD_OFF) {
+      draw_board();
+      draw_overlays();
+      return;
+    }
+    if (agenda_mode != AGENDA_OFF) {
+      draw_agenda();
+      draw_overlays();
+      return;
+    }
+
     int start_y = 0;
     int y = start_y;
 
@@ -1060,17 +9312,17 @@ public:
         // Draw the new item being pulled down
         // New item will be at position 0, so use red color
         Fl_Color new_color = get_color_by_position(0, items.size() + 1);
-        fl_color(new_color);
-        fl_rectf(0, new_item_y, w(), item_height);
+        batch.color(new_color);
+        batch.rectf(0, new_item_y, w(), item_height);
 
         // Use appropriate text color based on background
         Fl_Color text_color = get_text_color(new_color);
-        fl_color(text_color);
-        fl_font(FL_HELVETICA_BOLD, 18);
+        batch.color(text_color);
+        batch.font(FL_HELVETICA_BOLD, 18);
         if (pull_down_offset > item_height * 0.6) {
-          fl_draw("Release to add...", 20, new_item_y + item_height / 2 + 6);
+          batch.text("Release to add...", 20, new_item_y + item_height / 2 + 6);
         } else {
-          fl_draw("Pull down to add...", 20, new_item_y + item_height / 2 + 6);
+          batch.text("Pull down to add...", 20, new_item_y + item_height / 2 + 6);
         }
       }
     }
@@ -1094,6 +9346,10 @@ public:
       }
       y += item_height;
     }
+    prune_row_cache();
+    if (notes_item_id) {
+      place_notes();
+    }
 
     // Update Fl_Input position if editing
     if (editing_index >= 0 && editing_index < (int)items.size() &&
@@ -1175,12 +9431,36 @@ public:
       input_widget->redraw();
     }
 
+    draw_overlays();
+  }
+
+  // Instructions, trash view, error message and HUD over the current view,
+  // then submit the frame
+  void draw_overlays() {
     // Draw instructions at bottom
-    fl_color(FL_WHITE);
-    fl_font(FL_HELVETICA, 12);
-    fl_draw("Pull down to add | Click to edit | Double-click to complete | "
-            "Swipe right to delete",
-            10, h() - 20);
+    batch.color(FL_WHITE);
+    batch.font(FL_HELVETICA, 12);
+    if (agenda_mode != AGENDA_OFF) {
+      batch.text("Drag to reschedule | Double-click to complete | Wheel or "
+                 "PgUp/PgDn to browse | F6 list view",
+                 10, h() - 20);
+    } else if (board_mode != BOARD_OFF) {
+      batch.text("Long press to drag between columns | Double-click to "
+                 "complete | F7 list view | F8 trash",
+                 10, h() - 20);
+    } else {
+      batch.text("Pull down to add | Click to edit | Double-click to complete "
+                 "| Swipe right to delete | F3 notes F6 agenda F7 board "
+                 "F8 trash",
+                 10, h() - 20);
+    }
+
+    if (show_trash) {
+      draw_trash();
+    }
+    if (show_find) {
+      draw_find_panel();
+    }
 
     // Draw error message in bottom right corner
     if (error_display.is_visible && !error_display.message.empty()) {
@@ -1189,7 +9469,7 @@ public:
       const int margin = 10;
       const int corner_radius = 8;
 
-      fl_font(FL_HELVETICA_BOLD, font_size);
+      batch.font(FL_HELVETICA_BOLD, font_size);
 
       // Measure text accurately
       int text_w, text_h;
@@ -1208,10 +9488,10 @@ public:
       int box_y = h() - box_h - 35; // Above the instruction text
 
       // Save current drawing state
-      fl_push_clip(box_x, box_y, box_w, box_h);
+      batch.push_clip(box_x, box_y, box_w, box_h);
 
       // Draw shadow for depth (offset by 2 pixels) with rounded corners
-      fl_color(fl_rgb_color(20, 20, 20)); // Dark gray for shadow effect
+      batch.color(fl_rgb_color(20, 20, 20)); // Dark gray for shadow effect
       draw_rounded_rect(box_x + 2, box_y + 2, box_w, box_h, corner_radius);
 
       // Draw rounded rectangle background with 90% opacity (10% transparency)
@@ -1222,27 +9502,324 @@ public:
       // Final = 38*0.9 + 255*0.1 = 34.2 + 25.5 ≈ 60
       // Using base color (40,40,40) for better visibility:
       // Final = 40*0.9 + 255*0.1 = 36 + 25.5 ≈ 62
-      fl_color(fl_rgb_color(62, 62, 62));
+      batch.color(fl_rgb_color(62, 62, 62));
       draw_rounded_rect(box_x, box_y, box_w, box_h, corner_radius);
 
       // Restore clipping
-      fl_pop_clip();
+      batch.pop_clip();
 
       // Draw error text in white
-      fl_color(FL_WHITE);
-      fl_draw(error_display.message.c_str(), box_x + padding,
-              box_y + padding + text_h - 4);
+      batch.color(FL_WHITE);
+      batch.text(error_display.message.c_str(), box_x + padding,
+                 box_y + padding + text_h - 4);
+    }
+
+    if (show_hud) {
+      draw_hud();
+    }
+
+    batch.submit();
+
+    // Widgets over the list were painted over by it; draw them again
+    if (notes_input && notes_input->visible()) {
+      draw_child(*notes_input);
+    }
+    if (show_find) {
+      draw_child(*find_input);
+      draw_child(*replace_input);
+    }
+    frame_drawn();
+  }
+
+  void frame_drawn() {
+    if (!first_frame_drawn) {
+      first_frame_drawn = true;
+      startup_profile.mark("first draw()");
+      startup_profile.report(items.size());
+      Fl::add_timeout(0.0, after_first_frame_cb, this);
+    }
+  }
+
+  // Work deferred until the first frame is on screen
+  void after_first_frame() {
+    if (loading.active) {
+      load_step();
+    } else if (!model_ready) {
+      finish_resume();
+    }
+    if (save_pending) {
+      save_pending = false;
+      model.save(); // Save sample items to file
+    }
+    if (use_glyph_atlas) {
+      redraw(); // Builds the glyph atlas
+    }
+  }
+
+  static void after_first_frame_cb(void *data) {
+    ClearApp *app = static_cast<ClearApp *>(data);
+    app->after_first_frame();
+  }
+
+  // Switch to the row caches of the window's current screen scale. A scale
+  // new to the window is drawn with fl_draw for one frame and its glyphs
+  // built on the next, as on the first frame.
+  void select_scale() {
+    float scale = window_scale(this);
+    int key = (int)lround(scale * 100);
+    auto found = scaled_rows.find(key);
+    if (found == scaled_rows.end()) {
+      // Built in place: copying the unbuilt atlas would read its glyph
+      // tables before build() fills them
+      found = scaled_rows
+                  .emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                           std::forward_as_tuple(scale, row_frame))
+                  .first;
+      if (first_frame_drawn) {
+        Fl::add_timeout(0.0, redraw_cb, this);
+      }
+    }
+    scaled = &found->second;
+    scaled->last_frame = row_frame;
+  }
+
+  static void redraw_cb(void *data) { ((ClearApp *)data)->redraw(); }
+
+  // Drop an item's composed row at every scale
+  void forget_row(unsigned id) {
+    for (auto &set : scaled_rows) {
+      set.second.rows.erase(id);
+    }
+  }
+
+  void clear_rows() {
+    for (auto &set : scaled_rows) {
+      set.second.rows.clear();
+    }
+  }
+
+  // Frame statistics overlay in the top right corner (previous frame's counts)
+  void draw_hud() {
+    const DrawBatch::Stats &stats = batch.stats();
+    char lines[4 + MEM_TAGS][64];
+    snprintf(lines[0], sizeof(lines[0]), "draw cmds: %d", stats.recorded);
+    snprintf(lines[1], sizeof(lines[1]), "submitted: %d", stats.submitted);
+    snprintf(lines[2], sizeof(lines[2]), "state dropped: %d",
+             stats.dropped_state);
+    snprintf(lines[3], sizeof(lines[3]), "rects merged: %d",
+             stats.merged_rects);
+    int count = 4;
+    if (memory_tracked()) {
+      for (int tag = 0; tag < MEM_TAGS; tag++, count++) {
+        snprintf(lines[count], sizeof(lines[count]), "%-10s %7lluK",
+                 memory_tag_names[tag], memory_bytes(tag) / 1024);
+      }
+    }
+
+    const int line_h = 14;
+    const int hud_w = 150;
+    const int hud_x = w() - hud_w - 10;
+    const int hud_y = 10;
+    batch.color(fl_rgb_color(20, 20, 20));
+    batch.rectf(hud_x, hud_y, hud_w, line_h * count + 8);
+    batch.color(FL_WHITE);
+    batch.font(FL_COURIER, 11);
+    for (int i = 0; i < count; i++) {
+      batch.text(lines[i], hud_x + 6, hud_y + 4 + line_h * (i + 1) - 3);
     }
   }
 
-  void handle_single_click(int index) {
-    if (index >= 0 && index < (int)items.size() &&
-        pending_click_index == index) {
-      // This is a single click (not a double-click), start editing
-      if (editing_index != index) {
-        start_editing(index);
+  // Scroll through a synthetic list with fl_draw, with the glyph atlas and
+  // with the smooth gradient, and print frame times. The user's list is not
+  // modified.
+  int run_scroll_benchmark(int item_count) {
+    const int frames = 600;
+    model.persistence_enabled = false;
+    model_ready = true; // Skip the resume snapshot
+
+    items.clear();
+    for (int i = 0; i < item_count; i++) {
+      std::ostringstream text;
+      text << "Benchmark task #" << i << " - scroll throughput";
+      TodoItem item(text.str());
+      item.completed = (i % 5 == 4);
+      items.push_back(item);
+    }
+    clear_rows();
+
+    printf("Scrolling %d items, %d frames per mode\n", item_count, frames);
+    static const char *mode_names[] = {"fl_draw", "glyph atlas", "smooth"};
+    for (int mode = 0; mode < 3; mode++) {
+      use_glyph_atlas = (mode >= 1);
+      smooth_gradient = (mode == 2);
+      scroll_offset = 0;
+      redraw();
+      Fl::flush();
+
+      int max_scroll = get_max_scroll_offset();
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      for (int frame = 0; frame < frames; frame++) {
+        // A third of a row per frame, wrapping at the end of the list
+        scroll_offset = (frame * item_height / 3) % (max_scroll + 1);
+        redraw();
+        Fl::flush();
+      }
+      double elapsed_ms = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+
+      int rows_per_frame = h() / item_height + 1;
+      printf("  %-12s %8.3f ms/frame  %8.1f frames/s  %10.0f rows/s\n",
+             mode_names[mode], elapsed_ms / frames,
+             frames * 1000.0 / elapsed_ms,
+             frames * rows_per_frame * 1000.0 / elapsed_ms);
+    }
+    return 0;
+  }
+
+  void set_smooth_gradient(bool smooth) {
+    smooth_gradient = smooth;
+    redraw();
+  }
+
+  // Write metrics to path every interval seconds (--metrics-file)
+  void enable_metrics(const std::string &path, double interval) {
+    metrics_path = path;
+    metrics_interval = interval;
+    Fl::add_timeout(metrics_interval, metrics_cb, this);
+  }
+
+  static void metrics_cb(void *data) {
+    ClearApp *app = static_cast<ClearApp *>(data);
+    app->write_metrics();
+    Fl::repeat_timeout(app->metrics_interval, metrics_cb, data);
+  }
+
+  static void write_histogram(std::ostream &out, const char *name,
+                              const char *help,
+                              const LatencyHistogram &histogram) {
+    out << "# TYPE " << name << " histogram\n"
+        << "# UNIT " << name << " seconds\n"
+        << "# HELP " << name << " " << help << "\n";
+    unsigned long long total = 0;
+    for (int i = 0; i <= LatencyHistogram::BUCKETS; i++) {
+      total += histogram.count(i);
+      out << name << "_bucket{le=\"";
+      if (i < LatencyHistogram::BUCKETS) {
+        out << LatencyHistogram::bound(i);
+      } else {
+        out << "+Inf";
+      }
+      out << "\"} " << total << "\n";
+    }
+    out << name << "_count " << total << "\n"
+        << name << "_sum " << histogram.sum() << "\n";
+  }
+
+  // Write the OpenMetrics text file, replacing the previous one atomically
+  void write_metrics() {
+    int completed = 0;
+    for (const TodoItem &item : items) {
+      if (item.completed)
+        completed++;
+    }
+    MemoryScope scope(MEM_IO);
+    std::string temp_file = temp_path(metrics_path);
+    {
+      std::ofstream out(temp_file);
+      write_histogram(out, "clear_save_latency_seconds",
+                      "Time to save the list.", metrics.save);
+      write_histogram(out, "clear_load_latency_seconds",
+                      "Time to load the list.", metrics.load);
+      write_histogram(out, "clear_draw_latency_seconds",
+                      "Time to draw a frame.", metrics.draw);
+      write_histogram(out, "clear_event_latency_seconds",
+                      "Time to handle an input event.", metrics.event);
+      out << "# TYPE clear_items gauge\n"
+          << "# HELP clear_items Items in the list.\n"
+          << "clear_items{state=\"total\"} " << items.size() << "\n"
+          << "clear_items{state=\"completed\"} " << completed << "\n"
+          << "# TYPE clear_storage_written_bytes counter\n"
+          << "# UNIT clear_storage_written_bytes bytes\n"
+          << "# HELP clear_storage_written_bytes Bytes written by the "
+          << model.storage->name() << " storage backend.\n"
+          << "clear_storage_written_bytes_total "
+          << model.storage->bytes_written() << "\n"
+          << "# TYPE clear_fsyncs counter\n"
+          << "# HELP clear_fsyncs Files flushed to disk.\n"
+          << "clear_fsyncs_total " << metrics.fsyncs.load() << "\n"
+          << "# TYPE clear_stalls counter\n"
+          << "# HELP clear_stalls Saves, loads, frames or events slower "
+          << "than " << STALL_SECONDS << " s.\n"
+          << "clear_stalls_total " << metrics.stalls.load() << "\n"
+          << "# TYPE clear_memory_bytes gauge\n"
+          << "# UNIT clear_memory_bytes bytes\n"
+          << "# HELP clear_memory_bytes Live heap bytes by subsystem, "
+          << "with a " << MEMORY_HEADER << "-byte header per block.\n";
+      for (int tag = 0; tag < MEM_TAGS; tag++) {
+        out << "clear_memory_bytes{subsystem=\"" << memory_tag_names[tag]
+            << "\"} " << memory_bytes(tag) << "\n";
+      }
+      out << "# TYPE clear_memory_objects gauge\n"
+          << "# HELP clear_memory_objects Live heap blocks by subsystem.\n";
+      for (int tag = 0; tag < MEM_TAGS; tag++) {
+        out << "clear_memory_objects{subsystem=\"" << memory_tag_names[tag]
+            << "\"} " << memory_objects(tag) << "\n";
+      }
+      out << "# EOF\n";
+      out.close();
+      if (out.fail()) {
+        ::remove(temp_file.c_str());
+        metrics_failed("Error saving file: " + metrics_path);
+        return;
       }
-      pending_click_index = -1;
+    }
+    if (!replace_file(temp_file, metrics_path)) {
+      ::remove(temp_file.c_str());
+      metrics_failed("Failed to save file: " + metrics_path);
+      return;
+    }
+    metrics_failing = false;
+  }
+
+  // Report the first of a run of failed exports only
+  void metrics_failed(const std::string &error) {
+    if (!metrics_failing) {
+      metrics_failing = true;
+      show_error(error);
+    }
+  }
+
+  // The editor opened by a single click is now a regular edit
+  void confirm_speculative_edit() {
+    if (speculative_edit_index >= 0) {
+      Fl::remove_timeout(speculative_edit_timeout_cb, this);
+      speculative_edit_index = -1;
+    }
+  }
+
+  // Close the editor opened by the first click of a double-click. Nothing
+  // was typed, so the item is left as it was and nothing is saved.
+  void rollback_speculative_edit() {
+    confirm_speculative_edit();
+    if (input_widget) {
+      input_widget->hide();
+    }
+    editing_index = -1;
+    editing_text = "";
+  }
+
+  // Deliver the moves of a reorder drag. Besides the release, anything that
+  // cuts a drag short (a view switch, hiding or closing the window) ends it
+  // here, so the bus is never left inside the drag's transaction.
+  void end_reorder() {
+    Fl::remove_timeout(long_press_timeout_cb, this);
+    is_dragging = false;
+    can_reorder = false;
+    if (reorder_transaction_open) {
+      reorder_transaction_open = false;
+      bus.commit();
     }
   }
 
@@ -1250,6 +9827,11 @@ public:
     if (selected_index >= 0) {
       can_reorder = true;
       is_dragging = true;
+      // Moves during the drag are delivered once, on release
+      if (!reorder_transaction_open) {
+        bus.begin();
+        reorder_transaction_open = true;
+      }
       redraw();
     }
   }
@@ -1260,6 +9842,11 @@ public:
     if (!input || !input->visible())
       return;
 
+    app->model.origin = app;
+
+    // Typing (or Enter) means the click was not the start of a double-click
+    app->confirm_speculative_edit();
+
     // Check if Enter was pressed
     int key = Fl::event_key();
     if (key == FL_Enter || key == FL_KP_Enter) {
@@ -1275,11 +9862,9 @@ public:
     Fl::flush();
   }
 
-  static void click_timeout_cb(void *data) {
+  static void speculative_edit_timeout_cb(void *data) {
     ClearApp *app = static_cast<ClearApp *>(data);
-    if (app->pending_click_index >= 0) {
-      app->handle_single_click(app->pending_click_index);
-    }
+    app->confirm_speculative_edit();
   }
 
   static void long_press_timeout_cb(void *data) {
@@ -1288,9 +9873,112 @@ public:
   }
 };
 
+const int ClearApp::BOARD_MIN_COLUMN_W; // Bound by std::max
+
+// gesture_test.cc includes this file with its own main()
+#ifndef CLEAR_NO_MAIN
 int main(int argc, char **argv) {
+  // Pick out our own options, pass everything else on to FLTK
+  int bench_scroll_items = 0;
+  int bench_storage_items = 0;
+  bool smooth_gradient = false;
+  std::string metrics_file;
+  bool mem_report = false;
+  bool track_memory = false;
+  double metrics_interval = 15;
+  std::string storage_name = "text";
+  std::string key_file;
+  std::vector<char *> fltk_argv;
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "--bench-scroll", 14) == 0) {
+      bench_scroll_items = (argv[i][14] == '=') ? atoi(argv[i] + 15) : 10000;
+      if (bench_scroll_items <= 0)
+        bench_scroll_items = 10000;
+    } else if (strncmp(argv[i], "--bench-storage", 15) == 0) {
+      bench_storage_items = (argv[i][15] == '=') ? atoi(argv[i] + 16) : 10000;
+      if (bench_storage_items <= 0)
+        bench_storage_items = 10000;
+    } else if ((strcmp(argv[i], "--import-paged") == 0 ||
+                strcmp(argv[i], "--export-paged") == 0) &&
+               i + 2 < argc) {
+      return convert_paged_file(argv[i][2] == 'i', argv[i + 1], argv[i + 2]);
+    } else if (strncmp(argv[i], "--storage=", 10) == 0) {
+      storage_name = argv[i] + 10;
+    } else if (strncmp(argv[i], "--key-file=", 11) == 0) {
+      key_file = argv[i] + 11;
+    } else if (strncmp(argv[i], "--metrics-file=", 15) == 0) {
+      metrics_file = argv[i] + 15;
+      track_memory = true;
+    } else if (strncmp(argv[i], "--metrics-interval=", 19) == 0) {
+      metrics_interval = atof(argv[i] + 19);
+      if (metrics_interval <= 0)
+        metrics_interval = 15;
+    } else if (strcmp(argv[i], "--track-memory") == 0) {
+      track_memory = true;
+    } else if (strcmp(argv[i], "--mem-report") == 0) {
+      track_memory = true;
+      mem_report = true;
+    } else if (strcmp(argv[i], "--startup-profile") == 0) {
+      startup_profile.enabled = true;
+    } else if (strcmp(argv[i], "--smooth-gradient") == 0) {
+      smooth_gradient = true;
+    } else {
+      fltk_argv.push_back(argv[i]);
+    }
+  }
+  int fltk_argc = (int)fltk_argv.size();
+  fltk_argv.push_back(nullptr);
+
+  // Accounting needs every block to carry its header from the first
+  // allocation on, so start over in a process that accounts
+  if (track_memory && !memory_tracked()) {
+#ifdef _WIN32
+    _putenv_s("CLEAR_TRACK_MEMORY", "1");
+    _execv(argv[0], argv);
+#else
+    setenv("CLEAR_TRACK_MEMORY", "1", 1);
+    execvp(argv[0], argv);
+#endif
+    fprintf(stderr, "Cannot restart %s to track memory\n", argv[0]);
+    return 1;
+  }
+  startup_profile.mark("main()");
+
+  if (bench_storage_items > 0) {
+    return run_storage_benchmark(bench_storage_items);
+  }
+  StorageBackend *probe = create_storage_backend(storage_name, "");
+  if (!probe) {
+    fprintf(stderr, "Unknown storage backend '%s' (use text, binary, "
+                    "journal, paged, encrypted or memory)\n",
+            storage_name.c_str());
+    return 1;
+  }
+  delete probe;
+  if (storage_name == "encrypted" && key_file.empty()) {
+    fprintf(stderr, "The encrypted backend needs --key-file=<file>, outside "
+                    "the data directory\n");
+    return 1;
+  }
+
+  Fl::lock(); // Lets the thumbnail workers wake the loop with Fl::awake()
+  TodoModel model(storage_name, key_file);
   ClearApp *app =
-      new ClearApp(600, 800, "Clear-txt - Todo List with .txt file.");
-  app->show(argc, argv);
-  return Fl::run();
+      new ClearApp(600, 800, "Clear-txt - Todo List with .txt file.", model);
+  startup_profile.mark("ClearApp construction");
+  app->set_smooth_gradient(smooth_gradient);
+  if (!metrics_file.empty()) {
+    app->enable_metrics(metrics_file, metrics_interval);
+  }
+  app->show(fltk_argc, &fltk_argv[0]);
+  startup_profile.mark("show()");
+  if (bench_scroll_items > 0) {
+    return app->run_scroll_benchmark(bench_scroll_items);
+  }
+  int result = Fl::run();
+  if (mem_report) {
+    print_memory_report(stderr); // The list and caches are still alive
+  }
+  return result;
 }
+#endif // CLEAR_NO_MAIN
@@ -0,0 +1,129 @@
+// Headless tests of the click gestures on a list item (make test).
+// ClearApp::handle() is driven with synthetic mouse events on a window that
+// is never shown, over the memory backend, so no display or data files are
+// touched.
+#define CLEAR_NO_MAIN
+#include "clear.cc"
+
+struct GestureTest {
+  TodoModel model;
+  ClearApp *app;
+  int delivered;            // ChangeSets delivered, one per save
+  ChangeSet last_delivered;
+
+  GestureTest() : model("memory", ""), app(nullptr), delivered(0) {
+    std::string error;
+    model.load(error);
+    model.items.push_back(TodoItem("First"));
+    model.items.push_back(TodoItem("Second"));
+    model.items.push_back(TodoItem("Third"));
+    app = new ClearApp(400, 600, "Clear test", model, false);
+    model.bus.subscribe([this](const ChangeSet &set) {
+      delivered++;
+      last_delivered = set;
+    });
+  }
+
+  ~GestureTest() { delete app; }
+
+  int editing() const { return app->editing_index; }
+  int speculative() const { return app->speculative_edit_index; }
+
+  // What typing or the end of the double-click window does
+  void confirm() { app->confirm_speculative_edit(); }
+
+  // Press and release the left button in the middle of the item at this
+  // visual position. clicks is Fl::event_clicks(): 0 for a single click,
+  // 1 for the second click of a double-click.
+  void click(int position, int clicks) {
+    Fl::e_x = 100;
+    Fl::e_y = position * app->item_height + app->item_height / 2;
+    Fl::e_keysym = FL_Button + FL_LEFT_MOUSE;
+    Fl::e_clicks = clicks;
+    Fl::e_is_click = 1;
+    app->handle(FL_PUSH);
+    app->handle(FL_RELEASE);
+  }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *test, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "%s: %s\n", test, what);
+    failures++;
+  }
+}
+
+// A single click opens the editor at once, speculatively
+static void test_single_click_edits() {
+  const char *name = "single click";
+  GestureTest t;
+  t.click(0, 0);
+  check(t.editing() == 0, name, "item not being edited");
+  check(t.speculative() == 0, name, "edit not speculative");
+  check(t.delivered == 0, name, "something was saved");
+}
+
+// The second click closes the editor without a save and toggles the item
+static void test_double_click_rolls_back() {
+  const char *name = "double click";
+  GestureTest t;
+  t.click(0, 0);
+  t.click(0, 1);
+  check(t.editing() == -1, name, "editor still open");
+  check(t.speculative() == -1, name, "edit still speculative");
+  check(t.model.items[0].completed, name, "item not completed");
+  check(t.model.items[0].text == "First", name, "text changed");
+  check(t.delivered == 1, name, "not exactly one save");
+  check(t.last_delivered.changes.size() == 1 &&
+            t.last_delivered.changes[0].kind == ModelChange::TOGGLE,
+        name, "saved more than the toggle");
+}
+
+// Once the user typed or the double-click window passed, the edit is kept
+static void test_confirmed_edit_is_kept() {
+  const char *name = "confirmed edit";
+  GestureTest t;
+  t.click(0, 0);
+  t.confirm();
+  t.click(0, 1);
+  check(t.editing() == 0, name, "editor closed");
+  check(!t.model.items[0].completed, name, "item toggled");
+  check(t.delivered == 0, name, "something was saved");
+}
+
+// A double-click on another item leaves the edited one alone
+static void test_double_click_elsewhere() {
+  const char *name = "double click elsewhere";
+  GestureTest t;
+  t.click(0, 0);
+  t.click(1, 1);
+  check(t.editing() == -1, name, "editor still open");
+  check(!t.model.items[0].completed, name, "edited item toggled");
+  check(t.model.items[0].text == "First", name, "edited item changed");
+  check(t.model.items[1].completed, name, "clicked item not completed");
+  check(t.delivered == 1, name, "not exactly one save");
+}
+
+int main() {
+  // The model finds its data directory under HOME
+  char home[] = "/tmp/clear-gesture-XXXXXX";
+  if (!mkdtemp(home)) {
+    fprintf(stderr, "Cannot create a temporary HOME\n");
+    return 1;
+  }
+  setenv("HOME", home, 1);
+
+  test_single_click_edits();
+  test_double_click_rolls_back();
+  test_confirmed_edit_is_kept();
+  test_double_click_elsewhere();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All gesture tests passed\n");
+  return 0;
+}